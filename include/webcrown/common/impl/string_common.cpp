@@ -23,6 +23,27 @@ bool string_utils::starts_with(std::string_view source, std::string_view prefix)
             (source.compare(0, prefix.size(), prefix) == 0);
 }
 
+bool
+string_utils::iequals(std::string_view a, std::string_view b) noexcept
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (std::size_t i = 0; i < a.size(); ++i)
+    {
+        auto x = static_cast<unsigned char>(a[i]);
+        auto y = static_cast<unsigned char>(b[i]);
+        if (x == y)
+            continue;
+
+        // Only letters differ by the 0x20 bit between cases
+        auto lower = x | 0x20;
+        if (lower != (y | 0x20) || lower < 'a' || lower > 'z')
+            return false;
+    }
+
+    return true;
+}
 
 std::vector<std::string>
 string_utils::split(std::string_view str, char delimiter, bool skip_empty)
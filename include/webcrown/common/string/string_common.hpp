@@ -13,6 +13,9 @@ public:
 
     static bool starts_with(std::string_view source, std::string_view prefix);
 
+    /// ASCII case-insensitive comparison
+    static bool iequals(std::string_view a, std::string_view b) noexcept;
+
     static std::vector<std::string> split(std::string_view str, char delimiter, bool skip_empty = false);
 
     static char to_lower(char ch);
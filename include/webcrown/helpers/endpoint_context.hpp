@@ -96,10 +96,10 @@ json_any_missing_field(json const& request_json, T arg, Args... args)
 
 inline
 std::optional<route_parameters_t>
-get_parameter(std::vector<route_parameters_t> const& rt, std::string_view p_name)
+get_parameter(path_parameters_type const& rt, std::string_view p_name)
 {
     auto it = std::find_if(rt.cbegin(), rt.cend(),
-                           [&p_name](route_parameters_t p)
+                           [&p_name](route_parameters_t const& p)
     {
         if(p.name == p_name)
             return true;
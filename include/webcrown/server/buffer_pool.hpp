@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace webcrown {
+namespace server {
+
+/// Size-classed pool of receive buffers shared by the sessions of an I/O thread.
+/// Sessions borrow a buffer only while they are reading or holding an
+/// incomplete request, and give it back as soon as they go idle, so idle
+/// persistent connections do not pin any receive memory.
+/// The pool is meant to be used by one thread.
+class buffer_pool
+{
+public:
+    /// 4 KB, 16 KB, 64 KB, 256 KB and 1 MB
+    static constexpr std::size_t size_classes = 5;
+
+    static constexpr std::size_t class_size(std::size_t size_class) noexcept
+    {
+        return std::size_t(4096) << (2 * size_class);
+    }
+
+    static constexpr std::size_t max_buffer_size = std::size_t(4096) << (2 * (size_classes - 1));
+
+    /// Move-only handle of a borrowed buffer
+    class buffer
+    {
+        friend class buffer_pool;
+
+        std::unique_ptr<char[]> data_;
+        std::size_t capacity_{0};
+        std::uint8_t size_class_{0};
+    public:
+        buffer() = default;
+
+        char* data() noexcept { return data_.get(); }
+        char const* data() const noexcept { return data_.get(); }
+        std::size_t capacity() const noexcept { return capacity_; }
+
+        explicit operator bool() const noexcept { return data_ != nullptr; }
+    };
+
+    /// \param max_cached_bytes memory kept in the free lists, buffers released
+    ///        above this amount are freed
+    explicit buffer_pool(std::size_t max_cached_bytes = 32 * 1024 * 1024)
+        : max_cached_bytes_(max_cached_bytes)
+    {}
+
+    buffer_pool(buffer_pool const&) = delete;
+    buffer_pool& operator=(buffer_pool const&) = delete;
+
+    /// Borrows the smallest buffer of at least min_size bytes.
+    /// Returns an empty handle when min_size is above max_buffer_size.
+    buffer acquire(std::size_t min_size = 0)
+    {
+        std::size_t size_class = 0;
+        while (size_class < size_classes && class_size(size_class) < min_size)
+            ++size_class;
+
+        buffer result;
+        if (size_class == size_classes)
+            return result;
+
+        auto& free = free_[size_class];
+        if (!free.empty())
+        {
+            result.data_ = std::move(free.back());
+            free.pop_back();
+            cached_bytes_ -= class_size(size_class);
+        }
+        else
+        {
+            // Not value initialized, the bytes are always written by a read first
+            result.data_.reset(new char[class_size(size_class)]);
+        }
+
+        result.capacity_ = class_size(size_class);
+        result.size_class_ = static_cast<std::uint8_t>(size_class);
+        return result;
+    }
+
+    /// Gives the buffer back, the handle is left empty
+    void release(buffer& b)
+    {
+        if (!b)
+            return;
+
+        if (cached_bytes_ + b.capacity_ <= max_cached_bytes_)
+        {
+            cached_bytes_ += b.capacity_;
+            free_[b.size_class_].push_back(std::move(b.data_));
+        }
+
+        b.data_.reset();
+        b.capacity_ = 0;
+    }
+
+    /// Memory held by the free lists
+    std::size_t cached_bytes() const noexcept { return cached_bytes_; }
+
+private:
+    std::array<std::vector<std::unique_ptr<char[]>>, size_classes> free_;
+    std::size_t cached_bytes_{0};
+    std::size_t max_cached_bytes_;
+};
+
+} // server
+} // webcrown
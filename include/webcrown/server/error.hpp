@@ -26,7 +26,9 @@ enum class session_error : uint8_t
     unknown = 0,
     sent_bytes_is_zero,
     sent_buffer_is_nullptr,
-    not_connected
+    not_connected,
+    deadline_expired,
+    receive_buffer_full
 };
 
 class server_error_category : public std::error_category
@@ -87,6 +89,10 @@ public:
         {
             case session_error::sent_bytes_is_zero:
                 return "You are sending zero bytes";
+            case session_error::deadline_expired:
+                return "Session deadline expired";
+            case session_error::receive_buffer_full:
+                return "Incomplete request larger than the receive buffer";
             default:
                 return "Unknown error";
         }
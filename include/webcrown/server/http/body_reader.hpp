@@ -0,0 +1,42 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+struct http_form_upload;
+
+/// Receives the body of a request while it arrives, instead of a buffered copy.
+/// Returned by a middleware once the headers are parsed: the body of that
+/// request is then decoded (Content-Length or chunked) and handed out piece
+/// by piece, and http_request::body() stays empty.
+class body_reader
+{
+public:
+    virtual ~body_reader() = default;
+
+    /// A decoded piece of the body, only valid during the call.
+    /// Setting ec fails the request.
+    virtual void on_body_data(std::string_view data, std::error_code& ec) = 0;
+
+    /// The whole body was received, the request is handled next
+    virtual void on_body_end(std::error_code& /*ec*/) {}
+
+    /// Holds back the body while the reader is busy with what it was given,
+    /// like writes to a disk. Returns false when it is not busy. Otherwise
+    /// the parser takes no more of the body, nor ends it, until the reader
+    /// calls resume: once, from any thread.
+    /// \param complete whether the whole body was received
+    virtual bool pause(bool /*complete*/, std::function<void()> const& /*resume*/) { return false; }
+
+    /// Parts of a multipart body split by the reader, http_request::uploads
+    /// returns them instead of the parser's
+    virtual std::vector<http_form_upload> const* uploads() const noexcept { return nullptr; }
+};
+
+}}}
@@ -0,0 +1,280 @@
+#ifndef WEBCROWN_SIMD_SCAN_HPP
+#define WEBCROWN_SIMD_SCAN_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define WEBCROWN_SIMD_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace webcrown {
+namespace server {
+namespace http {
+namespace detail {
+
+// Vectorized search of the first byte that ends a token, in the style of
+// picohttpparser: the stop bytes are given as inclusive ranges and the
+// buffer is tested 16 (SSE4.2) or 32 (AVX2) bytes at a time. The kernel is
+// chosen once from the CPU features, the scalar table is the fallback and
+// handles the tails.
+
+/// Set of stop bytes: up to 8 inclusive [lo, hi] ranges and their table
+struct scan_set
+{
+    alignas(16) char ranges[16];
+    int size;
+    std::array<bool, 256> stop;
+
+    constexpr scan_set(std::initializer_list<unsigned char> pairs)
+        : ranges{}
+        , size(0)
+        , stop{}
+    {
+        for (auto c : pairs)
+            ranges[size++] = static_cast<char>(c);
+
+        for (int i = 0; i < size; i += 2)
+        {
+            for (int c = static_cast<unsigned char>(ranges[i]); c <= static_cast<unsigned char>(ranges[i + 1]); ++c)
+                stop[c] = true;
+        }
+    }
+};
+
+// field-name = token, ends at ':' or at a byte that is not a tchar
+// (RFC 7230 3.2.6). The separators need more than 8 ranges: '|' and '~' are
+// tchar but inside the last range, the caller steps over them.
+constexpr scan_set header_name_stop{
+    0x00, 0x20, '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', 0xff};
+
+// field-value = *( HTAB / SP / VCHAR / obs-text ), ends at CR
+constexpr scan_set header_value_stop{0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f};
+
+// request-target, ends at SP
+constexpr scan_set target_stop{0x00, 0x20, 0x7f, 0x7f};
+
+enum class scan_kernel
+{
+    scalar,
+    sse42,
+    avx2
+};
+
+inline
+char const* scan_scalar(char const* it, char const* last, scan_set const& set) noexcept
+{
+    for (; it < last; ++it)
+    {
+        if (set.stop[static_cast<unsigned char>(*it)])
+            return it;
+    }
+
+    return last;
+}
+
+#if defined(WEBCROWN_SIMD_SCAN_X86)
+
+__attribute__((target("sse4.2")))
+inline
+char const* scan_sse42(char const* it, char const* last, scan_set const& set) noexcept
+{
+    auto const ranges = _mm_load_si128(reinterpret_cast<__m128i const*>(set.ranges));
+
+    for (; last - it >= 16; it += 16)
+    {
+        auto const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(it));
+        auto const index = _mm_cmpestri(ranges, set.size, bytes, 16,
+            _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+        if (index != 16)
+            return it + index;
+    }
+
+    return scan_scalar(it, last, set);
+}
+
+__attribute__((target("avx2")))
+inline
+char const* scan_avx2(char const* it, char const* last, scan_set const& set) noexcept
+{
+    for (; last - it >= 32; it += 32)
+    {
+        auto const bytes = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(it));
+        auto hits = _mm256_setzero_si256();
+
+        // c in [lo, hi] <=> (c - lo) <= (hi - lo), unsigned and wrapping
+        for (int i = 0; i < set.size; i += 2)
+        {
+            auto const lo = static_cast<unsigned char>(set.ranges[i]);
+            auto const width = static_cast<unsigned char>(static_cast<unsigned char>(set.ranges[i + 1]) - lo);
+
+            auto const offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8(static_cast<char>(lo)));
+            auto const inside = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(static_cast<char>(width))), offset);
+            hits = _mm256_or_si256(hits, inside);
+        }
+
+        auto const mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask != 0)
+            return it + __builtin_ctz(mask);
+    }
+
+    return scan_sse42(it, last, set);
+}
+
+inline
+scan_kernel detect_scan_kernel() noexcept
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return scan_kernel::avx2;
+
+    if (__builtin_cpu_supports("sse4.2"))
+        return scan_kernel::sse42;
+
+    return scan_kernel::scalar;
+}
+
+#else
+
+inline
+scan_kernel detect_scan_kernel() noexcept
+{
+    return scan_kernel::scalar;
+}
+
+#endif
+
+/// Kernel used by scan, detected once per process
+inline scan_kernel const active_scan_kernel = detect_scan_kernel();
+
+/// First byte of [it, last) in the stop set, or last
+inline
+char const* scan(char const* it, char const* last, scan_set const& set) noexcept
+{
+#if defined(WEBCROWN_SIMD_SCAN_X86)
+    switch (active_scan_kernel)
+    {
+        case scan_kernel::avx2:
+            return scan_avx2(it, last, set);
+        case scan_kernel::sse42:
+            return scan_sse42(it, last, set);
+        default:
+            break;
+    }
+#endif
+
+    return scan_scalar(it, last, set);
+}
+
+/// Search of a fixed pattern, the multipart delimiter.
+/// Boyer-Moore-Horspool on the bad character of the window's last byte.
+/// With AVX2, 32 windows are first filtered on their first and last bytes
+/// and only the candidates are compared, which skips most of a payload
+/// without looking at the skip table.
+class pattern_searcher
+{
+    std::string pattern_;
+    std::array<std::uint8_t, 256> skip_{};
+public:
+    /// Longest pattern, the skip distances are stored in a byte
+    static constexpr std::size_t max_size = 255;
+
+    pattern_searcher() = default;
+
+    explicit pattern_searcher(std::string_view pattern) { assign(pattern); }
+
+    void assign(std::string_view pattern)
+    {
+        pattern_.assign(pattern.substr(0, max_size));
+
+        auto const m = pattern_.size();
+        skip_.fill(static_cast<std::uint8_t>(m));
+        for (std::size_t i = 0; i + 1 < m; ++i)
+            skip_[static_cast<unsigned char>(pattern_[i])] = static_cast<std::uint8_t>(m - 1 - i);
+    }
+
+    std::size_t size() const noexcept { return pattern_.size(); }
+
+    std::string_view pattern() const noexcept { return pattern_; }
+
+    /// First occurrence in [first, last), or last
+    char const* find(char const* first, char const* last) const noexcept
+    {
+        if (pattern_.empty() || static_cast<std::size_t>(last - first) < pattern_.size())
+            return last;
+
+#if defined(WEBCROWN_SIMD_SCAN_X86)
+        if (active_scan_kernel == scan_kernel::avx2)
+            return find_avx2(first, last);
+#endif
+
+        return find_horspool(first, last);
+    }
+
+    /// Offset of the first occurrence in text, or npos
+    std::size_t find(std::string_view text) const noexcept
+    {
+        auto const last = text.data() + text.size();
+        auto const p = find(text.data(), last);
+        return p == last ? std::string_view::npos : static_cast<std::size_t>(p - text.data());
+    }
+
+private:
+    char const* find_horspool(char const* first, char const* last) const noexcept
+    {
+        auto const m = pattern_.size();
+        auto const tail = static_cast<unsigned char>(pattern_[m - 1]);
+
+        for (auto it = first; static_cast<std::size_t>(last - it) >= m;)
+        {
+            auto const c = static_cast<unsigned char>(it[m - 1]);
+            if (c == tail && std::memcmp(it, pattern_.data(), m - 1) == 0)
+                return it;
+
+            it += skip_[c];
+        }
+
+        return last;
+    }
+
+#if defined(WEBCROWN_SIMD_SCAN_X86)
+    __attribute__((target("avx2")))
+    char const* find_avx2(char const* first, char const* last) const noexcept
+    {
+        auto const m = pattern_.size();
+        auto const head = _mm256_set1_epi8(pattern_[0]);
+        auto const tail = _mm256_set1_epi8(pattern_[m - 1]);
+
+        auto it = first;
+        for (; static_cast<std::size_t>(last - it) >= m - 1 + 32; it += 32)
+        {
+            auto const firsts = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(it));
+            auto const lasts = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(it + m - 1));
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(firsts, head), _mm256_cmpeq_epi8(lasts, tail))));
+
+            while (mask != 0)
+            {
+                auto const candidate = it + __builtin_ctz(mask);
+                // First and last bytes already match
+                if (m <= 2 || std::memcmp(candidate + 1, pattern_.data() + 1, m - 2) == 0)
+                    return candidate;
+
+                mask &= mask - 1;
+            }
+        }
+
+        return find_horspool(it, last);
+    }
+#endif
+};
+
+}}}}
+
+#endif //WEBCROWN_SIMD_SCAN_HPP
@@ -33,9 +33,6 @@ enum class parse_phase : std::uint8_t
     parse_headers_finished,
     parse_content_type,
     parse_content_type_finished,
-    parse_media_type,
-    parse_media_type_need_more,
-    parse_media_type_finished,
     parse_body,
     parse_body_finished,
     parse_body_pending,
@@ -34,7 +34,27 @@ enum class http_error : std::uint8_t
 
     no_boundary_header_for_multipart,
 
-    need_more
+    need_more,
+
+    bad_content_length,
+
+    bad_transfer_encoding,
+
+    bad_chunk,
+
+    body_too_large,
+
+    bad_multipart,
+
+    /// Limits of parser_limits
+    start_line_too_long,
+
+    header_too_large,
+
+    too_many_header_fields,
+
+    /// A middleware refused the head, the body is not read
+    request_rejected
 };
 
 class http_error_category : public std::error_category
@@ -71,6 +91,24 @@ public:
                 return "http content-type unsupported";
             case http_error::no_boundary_header_for_multipart:
                 return "no_boundary_header_for_multipart";
+            case http_error::bad_content_length:
+                return "http bad content-length";
+            case http_error::bad_transfer_encoding:
+                return "http unsupported transfer-encoding";
+            case http_error::bad_chunk:
+                return "http bad chunk";
+            case http_error::body_too_large:
+                return "http body too large";
+            case http_error::bad_multipart:
+                return "http bad multipart body";
+            case http_error::start_line_too_long:
+                return "http request line too long";
+            case http_error::header_too_large:
+                return "http header block too large";
+            case http_error::too_many_header_fields:
+                return "http too many header fields";
+            case http_error::request_rejected:
+                return "http request rejected before its body";
             default:
                 return "unknown webcrown_http http error";
         }
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "webcrown/common/string/string_common.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+/// Well-known header fields, resolved once by the parser so that the
+/// middlewares look them up by index instead of by name.
+enum class http_field : std::uint8_t
+{
+    unknown = 0,
+
+    accept,
+    accept_encoding,
+    accept_language,
+    access_control_request_headers,
+    access_control_request_method,
+    authorization,
+    cache_control,
+    connection,
+    content_disposition,
+    content_encoding,
+    content_length,
+    content_type,
+    cookie,
+    expect,
+    host,
+    if_modified_since,
+    if_none_match,
+    origin,
+    range,
+    referer,
+    transfer_encoding,
+    upgrade,
+    user_agent,
+    x_forwarded_for,
+    x_real_ip,
+
+    count
+};
+
+namespace detail {
+
+constexpr std::array<std::string_view, static_cast<std::size_t>(http_field::count)> field_names
+{
+    "",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "access-control-request-headers",
+    "access-control-request-method",
+    "authorization",
+    "cache-control",
+    "connection",
+    "content-disposition",
+    "content-encoding",
+    "content-length",
+    "content-type",
+    "cookie",
+    "expect",
+    "host",
+    "if-modified-since",
+    "if-none-match",
+    "origin",
+    "range",
+    "referer",
+    "transfer-encoding",
+    "upgrade",
+    "user-agent",
+    "x-forwarded-for",
+    "x-real-ip"
+};
+
+constexpr std::size_t field_table_size = 64;
+
+/// Perfect hash of the well-known names: length, first, middle and last
+/// characters. Setting 0x20 lowers the letters and keeps '-' and digits.
+constexpr std::size_t field_hash(std::string_view name) noexcept
+{
+    auto ch = [&name](std::size_t i) -> std::size_t
+    {
+        return static_cast<unsigned char>(name[i]) | 0x20;
+    };
+
+    return (name.size() + ch(0) + 3 * ch(name.size() - 1) + 17 * ch(name.size() / 2)) &
+        (field_table_size - 1);
+}
+
+constexpr std::array<http_field, field_table_size> make_field_table()
+{
+    std::array<http_field, field_table_size> table{};
+    for (std::size_t i = 1; i < field_names.size(); ++i)
+        table[field_hash(field_names[i])] = static_cast<http_field>(i);
+
+    return table;
+}
+
+constexpr auto field_table = make_field_table();
+
+constexpr bool field_table_is_perfect()
+{
+    for (std::size_t i = 1; i < field_names.size(); ++i)
+    {
+        if (field_table[field_hash(field_names[i])] != static_cast<http_field>(i))
+            return false;
+    }
+
+    return true;
+}
+
+static_assert(field_table_is_perfect(), "well-known header names collide in the field table");
+
+}
+
+/// Lowercase name of a well-known field
+constexpr std::string_view field_name(http_field field) noexcept
+{
+    return detail::field_names[static_cast<std::size_t>(field)];
+}
+
+/// Resolves a header name, whatever its case, to its well-known field
+inline http_field to_field(std::string_view name) noexcept
+{
+    if (name.empty())
+        return http_field::unknown;
+
+    auto field = detail::field_table[detail::field_hash(name)];
+    if (field == http_field::unknown || !common::string_utils::iequals(name, field_name(field)))
+        return http_field::unknown;
+
+    return field;
+}
+
+}}}
@@ -7,13 +7,18 @@
 #include <cstring>
 #include <string>
 #include <optional>
+#include <charconv>
+#include <algorithm>
+#include <functional>
 
 #include "webcrown/server/http/http_method.hpp"
 #include "enums.hpp"
 #include "webcrown/server/http/error.hpp"
 #include "webcrown/server/http/detail/parser.hpp"
+#include "webcrown/server/http/detail/simd_scan.hpp"
 #include "webcrown/server/http/http_request.hpp"
 #include "webcrown/server/http/http_response.hpp"
+#include "webcrown/server/http/multipart_parser.hpp"
 #include "webcrown/server/http/http_method.hpp"
 #include <fstream>
 
@@ -44,12 +49,25 @@ enum class content_type
     application_form_urlencoded
 };
 
-//
-// TODO: If a malicious individual sends a very large buffer,
-// shouldn't this buffer be handled directly in the socket instead of waiting
-// for it to reach the HTTP protocol to truncate the request?
-//
-//
+/// Sizes of a request. Crossing one fails the parse as soon as the bytes
+/// are seen, the rest of the request is neither buffered nor parsed.
+struct parser_limits
+{
+    /// Request line, with the empty lines allowed before it
+    std::size_t start_line{8192};
+
+    /// Number of header fields
+    std::size_t header_fields{100};
+
+    /// Header block, from the end of the request line to the empty line
+    std::size_t header_bytes{16 * 1024};
+
+    /// Content-Length, or decoded chunked body
+    std::size_t body{64 * 1024 * 1024};
+
+    /// Chunk size line with its extensions, or trailer field line
+    std::size_t chunk_line{1024};
+};
 
 // Structure of the http REQUEST message HTTP/1.1
 //  Request       = Request-Line              ; Section 5.1
@@ -62,34 +80,144 @@ enum class content_type
 /// At the moment, this parser is only for the HTTP ***REQUEST***
 class parser
 {
+public:
+    /// Called with the head of a request that has a body, may return a
+    /// reader to stream the body to. Setting ec rejects the request before
+    /// its body is read.
+    using head_callback = std::function<std::shared_ptr<body_reader>(http_request const& head, std::error_code& ec)>;
+private:
+    // Position of a token relative to the first byte of the request,
+    // the receive buffer may move between two reads
+    struct span
+    {
+        std::uint32_t offset{0};
+        std::uint32_t length{0};
+    };
+
+    struct field_span
+    {
+        span name;
+        span value;
+    };
+
+    // Position in a chunked body
+    enum class chunk_state : std::uint8_t
+    {
+        size_line,
+        data,
+        data_crlf,
+        trailers
+    };
+
     parse_phase parse_phase_;
+    parser_limits limits_;
 
-    // max header size
-    std::uint32_t header_limit_ = 8192;
-    std::string method_;
-    std::string target_;
+    http_method method_;
+    span target_;
     int protocol_version_;
-    std::unordered_map<std::string, std::string> headers_;
-    std::string body_;
+    std::vector<field_span> header_spans_;
+    // Views of header_spans_ into the current buffer
+    http_headers headers_;
+    std::size_t content_length_;
+    // First byte of the request in the buffer of the current call
+    char const* base_;
+    // Start line and headers, they stay in the buffer until the request is handled.
+    // While the head is parsed: the complete lines.
+    std::size_t head_size_;
+    // Bytes of the incomplete line already searched for its LF
+    std::size_t line_scan_;
+    // End of the request line, start of the header block
+    std::size_t header_start_;
     std::vector<http_form_upload> uploads_;
     content_type header_content_type_;
-    std::size_t buffer_size_readed_;
-    std::shared_ptr<std::vector<std::byte>> multipart_buffer_;
-    std::size_t boundary_value_length_;
-    std::string boundary_value_;
-    std::unordered_map<std::string, std::string> upload_body_headers_;
+    multipart_parser multipart_;
+    std::size_t consumed_;
+    std::size_t retained_;
+
+    // Body
+    bool chunked_;
+    chunk_state chunk_state_;
+    std::size_t chunk_remaining_;
+    // Body gathered across reads: grown as the bytes arrive, never past
+    // Content-Length
+    static constexpr std::size_t initial_body_capacity = 16 * 1024;
+    std::string body_buffer_;
+    std::size_t body_received_;
+    std::shared_ptr<body_reader> body_reader_;
+    head_callback on_head_;
+    // The reader holds back the body, see body_reader::pause
+    std::function<void()> on_resume_;
+    bool paused_{false};
+    // Per-request memory handed to the requests
+    std::pmr::memory_resource* arena_;
 public:
     explicit parser()
         : parse_phase_(parse_phase::not_started)
+        , method_(http_method::unknown)
         , protocol_version_(0)
-        , buffer_size_readed_(0)
-        , boundary_value_length_(0)
+        , content_length_(0)
+        , base_(nullptr)
+        , head_size_(0)
+        , line_scan_(0)
+        , header_start_(0)
+        , header_content_type_(content_type::not_specified)
+        , consumed_(0)
+        , retained_(0)
+        , chunked_(false)
+        , chunk_state_(chunk_state::size_line)
+        , chunk_remaining_(0)
+        , body_received_(0)
+        , arena_(std::pmr::get_default_resource())
     {
-        multipart_buffer_ = std::make_shared<std::vector<std::byte>>();
     }
 
+    /// Parses the bytes of the current request.
+    /// The buffer starts with the retained() bytes of the previous call,
+    /// followed by the bytes that were not consumed and the new ones.
+    /// The returned request borrows from the buffer and from the parser.
     std::optional<http_request> parse(const char* buffer, size_t size, std::error_code& ec);
 
+    std::optional<http_request> parse_request(const char*& it, size_t size, std::error_code& ec);
+
+    /// Number of bytes of the buffer used by the last call to parse.
+    /// When a request is finished, the bytes after it belong to the next
+    /// (pipelined) request.
+    std::size_t consumed() const noexcept { return consumed_; }
+
+    /// Bytes at the beginning of the buffer that must be passed again to the
+    /// next call: the head of an unfinished request, the request views it.
+    std::size_t retained() const noexcept { return retained_; }
+
+    /// Bytes of the body gathered across reads, a streamed body or a body
+    /// viewed in the buffer are not counted
+    std::size_t body_buffered() const noexcept { return body_buffer_.size(); }
+
+    /// Clears the state of the previous request, so the parser
+    /// can be reused by the next request of a persistent connection.
+    void reset();
+
+    void on_head(head_callback cb) { on_head_ = std::move(cb); }
+
+    /// Called by a busy body reader when it takes the body again, from any
+    /// thread. Without it the readers are never waited for.
+    void on_resume(std::function<void()> cb) { on_resume_ = std::move(cb); }
+
+    /// The body reader is busy: parse takes no byte until resume() is called,
+    /// the owner stops reading meanwhile
+    bool paused() const noexcept { return paused_; }
+
+    /// Called by the owner once on_resume was called, the next parse
+    /// continues the body, or ends it when it was complete
+    void resume() noexcept { paused_ = false; }
+
+    /// Reader of the body of the current request, null when it is buffered
+    body_reader* reader() const noexcept { return body_reader_.get(); }
+
+    void limits(parser_limits const& limits) noexcept { limits_ = limits; }
+
+    /// Memory resource of the requests, released by the owner between requests
+    void arena(std::pmr::memory_resource* arena) noexcept { arena_ = arena; }
+
     /// startline is the first line of the http request buffer.
     /// The basic buffer of the request http is:
     ///     generic-message = start-line
@@ -99,7 +227,19 @@ public:
     //      start-line      = Request-Line | Status-Line  (Status-line is for the response http message)
     void parse_start_line(char const*& it, char const* last, std::error_code& ec);
 
-    void parse_message_header(char const*& it, char const* last, std::unordered_map<std::string, std::string>& headers, std::error_code& ec);
+    /// Parses the complete lines of the start line and headers block.
+    /// Stops at any byte: the parsed lines stay in head_size_ and the scan
+    /// position of the incomplete line is kept, nothing is scanned twice.
+    void parse_head(char const*& it, char const* last, std::error_code& ec);
+
+    /// Fails when the head up to end crosses the limit of the line being parsed
+    void check_head_size(char const* end, std::error_code& ec) const;
+
+    /// One "name: value" line, last is past its CRLF
+    void parse_header_line(char const* it, char const* last, std::error_code& ec);
+
+    /// Content-Length and Content-Type, once the empty line is reached
+    void parse_head_finished(std::error_code& ec);
 
     void parse_message_header_name(char const*& it, char const* last, std::string_view& header_name, std::error_code& ec);
 
@@ -107,6 +247,9 @@ public:
 
     std::optional<http_request> parse_body(const char*& it, char const* last, std::string_view& body, std::error_code& ec);
 
+    /// Decodes a chunked body, stops at any byte and continues on the next call
+    std::optional<http_request> parse_chunked_body(const char*& it, char const* last, std::error_code& ec);
+
     /// Extract the HTTP get_method in the buffer
     /// \param it pointer to the first position on the buffer
     /// \param last end of the buffer
@@ -128,97 +271,250 @@ public:
     /// \param ec error result
     void parse_protocol(char const*& it, char const* last, int& protocol_version, std::error_code& ec);
 
-    void parse_content_type(content_type& content_type,
-                            std::unordered_map<std::string, std::string> const& headers);
+    void parse_content_type(content_type& content_type, http_headers const& headers);
 
-    // TODO: We need block the high buffers on server socket layer
-    // https://stackoverflow.com/questions/49169538/curl-doesnt-send-entire-form-data-in-http-post-request
-    void parse_media_type(char const*& it, char const* last,
-            std::unordered_map<std::string,
-            std::string> const& headers,
-            std::vector<http_form_upload>& uploads,
-            std::error_code& ec);
+    /// Splits a complete multipart/form-data body into uploads_
+    void parse_form(std::string_view body, std::error_code& ec);
 
     /// Returns the http parse phase
     /// \return parsephase enum
     parse_phase parsephase() const noexcept { return parse_phase_; }
-};
 
-inline
-std::optional<http_request>
-parser::parse(const char* buffer, size_t size, std::error_code& ec)
-{
-    // Current position of the buffer in the parser
-    char const*& it = buffer;
+private:
+    span to_span(std::string_view v) const noexcept
+    {
+        return {static_cast<std::uint32_t>(v.data() - base_), static_cast<std::uint32_t>(v.size())};
+    }
 
-    // last character in the buffer
-    char const* last = buffer + size;
+    std::string_view view(span s) const noexcept { return {base_ + s.offset, s.length}; }
 
-    // We assume that the initial buffer always has the complete http start line
-   if(parse_phase_ == parse_phase::not_started)
-   {
-        if (size == 0)
+    /// Points the header views to the buffer of the current call
+    void rebase(char const* base);
+
+    http_request make_request(std::string_view body) const
+    {
+        // A reader that split a multipart body holds its parts
+        auto uploads = body_reader_ ? body_reader_->uploads() : nullptr;
+
+        return http_request(method_, protocol_version_, view(target_), headers_, body,
+            uploads ? *uploads : uploads_, body_reader_.get(), arena_);
+    }
+
+    /// Hands a decoded piece of the body to the reader or to the body buffer
+    void append_body(char const* data, std::size_t size, std::error_code& ec)
+    {
+        if (body_reader_)
         {
-            ec = make_error(http_error::need_more);
-            return std::nullopt;
+            body_reader_->on_body_data(std::string_view(data, size), ec);
+            return;
         }
-        parse_phase_ = parse_phase::parse_start_line;
-        parse_start_line(it, last, ec);
-   }
 
-    // corner case that we need refactor later
-    // TODO: For media types, we need handle to ?
-    if(parse_phase_ == parse_phase::parse_content_type_finished)
-    {
-        auto content_length_h = headers_.find("content-length");
-        if (content_length_h != headers_.end())
+        // A Content-Length is a claim, the memory follows the bytes received
+        auto const needed = body_buffer_.size() + size;
+        if (needed > body_buffer_.capacity())
         {
-            auto content_length = std::atoi(content_length_h->second.c_str());
-            auto no_body = it + 4 >= last;
-            if (content_length > 0 && no_body)
-            {
-                parse_phase_ = parse_phase::parse_body_pending;
+            auto grown = std::max({needed, body_buffer_.capacity() * 2, initial_body_capacity});
+            if (content_length_ > 0)
+                grown = std::min(grown, content_length_);
 
-                return std::nullopt;
-            }
+            body_buffer_.reserve(grown);
         }
+
+        body_buffer_.append(data, size);
     }
 
-   if(parse_phase_ == parse_phase::parse_content_type_finished || parse_phase_ == parse_phase::parse_body_pending)
-   {
-        if (header_content_type_ == content_type::text ||
-                header_content_type_ == content_type::application_json ||
-                header_content_type_ == content_type::application_form_urlencoded ||
-                header_content_type_ == content_type::not_specified)
-        {
-            std::string_view body;
-            auto res = parse_body(it, last, body, ec);
-            parse_phase_ = parse_phase::finished;
+    /// Whether the reader holds back the body, see body_reader::pause
+    bool pause_reader(bool complete)
+    {
+        paused_ = body_reader_ && on_resume_ && body_reader_->pause(complete, on_resume_);
+        return paused_;
+    }
 
-            return res;
+    std::optional<http_request> finish_body(std::error_code& ec)
+    {
+        // Ended once the reader caught up with the body
+        if (pause_reader(true))
+        {
+            parse_phase_ = parse_phase::parse_body_finished;
+            return std::nullopt;
         }
-        else if(header_content_type_ == content_type::image ||
-                header_content_type_ == content_type::image_jpeg ||
-                header_content_type_ == content_type::multipart_formdata)
+
+        parse_phase_ = parse_phase::finished;
+
+        if (body_reader_)
         {
-            parse_media_type(it, last, headers_, uploads_, ec);
+            body_reader_->on_body_end(ec);
+            if (ec)
+                return std::nullopt;
+
+            return make_request({});
         }
+
+        return make_request(body_buffer_);
     }
+};
+
+inline
+std::optional<http_request>
+parser::parse(const char* buffer, size_t size, std::error_code& ec)
+{
+    auto const first = buffer;
+    rebase(first);
+
+    // The retained head was parsed by a previous call
+    buffer += retained_;
+    auto result = parse_request(buffer, size - retained_, ec);
+    consumed_ = static_cast<std::size_t>(buffer - first);
+
+    retained_ = parse_phase_ == parse_phase::finished ? 0 : head_size_;
+
+    return result;
+}
 
-    if(parse_phase_ == parse_phase::parse_media_type_need_more)
+inline
+void
+parser::rebase(char const* base)
+{
+    if (base == base_)
+        return;
+
+    base_ = base;
+    if (head_size_ == 0)
+        return;
+
+    headers_.clear();
+    for (auto const& f : header_spans_)
+        headers_.add(view(f.name), view(f.value));
+}
+
+inline
+std::optional<http_request>
+parser::parse_request(const char*& it, size_t size, std::error_code& ec)
+{
+    // The reader holds back the body, the bytes stay in the buffer
+    if (paused_)
+        return std::nullopt;
+
+    // last character in the buffer
+    char const* last = it + size;
+
+   if(parse_phase_ == parse_phase::not_started || parse_phase_ == parse_phase::parse_headers)
+   {
+        // Line by line, an incomplete line is continued by the next call
+        parse_head(it, last, ec);
+        if (ec || parse_phase_ == parse_phase::not_started || parse_phase_ == parse_phase::parse_headers)
+            return std::nullopt;
+   }
+
+    // The head is complete, the body may be streamed instead of buffered
+    if(parse_phase_ == parse_phase::parse_content_type_finished &&
+       (content_length_ > 0 || chunked_) && on_head_)
     {
-        parse_media_type(it, last, headers_, uploads_, ec);
+        body_reader_ = on_head_(make_request({}), ec);
+        if (ec)
+            return std::nullopt;
     }
 
-    if (parse_phase_ == parse_phase::parse_media_type_finished)
+    // The whole body was received while the reader was busy
+    if(parse_phase_ == parse_phase::parse_body_finished)
+        return finish_body(ec);
+
+    if(parse_phase_ != parse_phase::parse_content_type_finished && parse_phase_ != parse_phase::parse_body_pending)
+        return std::nullopt;
+
+    std::string_view body;
+    auto request = chunked_ ? parse_chunked_body(it, last, ec) : parse_body(it, last, body, ec);
+
+    // The next bytes of the body wait for a busy reader
+    if (!request && !ec && parse_phase_ == parse_phase::parse_body_pending)
+        pause_reader(false);
+
+    // The parts are views into the complete body, a streamed body is the
+    // reader's to split
+    if (request && !body_reader_ && header_content_type_ == content_type::multipart_formdata)
     {
-        parse_phase_ = parse_phase::finished;
-        http_request request(to_method(method_), protocol_version_, target_, headers_, uploads_);
-        return request;
+        parse_form(request->body(), ec);
+        if (ec)
+            return std::nullopt;
     }
 
+    return request;
+}
 
-    return std::nullopt;
+inline
+void
+parser::parse_form(std::string_view body, std::error_code& ec)
+{
+    // Collects every part of the body, fed at once
+    struct form_parts : multipart_handler
+    {
+        std::vector<http_form_upload>& uploads;
+
+        explicit form_parts(std::vector<http_form_upload>& uploads) : uploads(uploads) {}
+
+        void on_part_begin(http_headers const& headers) override
+        {
+            // The header values are views into the body
+            auto& part = uploads.emplace_back();
+
+            auto content_type = headers.find(http_field::content_type);
+            if (content_type != headers.end())
+                part.content_type = content_type->second;
+
+            auto disposition = headers.find(http_field::content_disposition);
+            if (disposition != headers.end())
+            {
+                part.disposition = disposition->second;
+                part.name = multipart_parser::disposition_parameter(part.disposition, "name");
+                part.filename = multipart_parser::disposition_parameter(part.disposition, "filename");
+            }
+        }
+
+        void on_part_data(std::string_view data) override
+        {
+            // The body is one contiguous piece, so are the slices of a part
+            auto& bytes = uploads.back().bytes;
+            bytes = bytes.empty() ? data : std::string_view(bytes.data(), bytes.size() + data.size());
+            uploads.back().size = bytes.size();
+        }
+    };
+
+    form_parts parts(uploads_);
+    multipart_.parse(body, parts, ec);
+    if (!ec && !multipart_.finished())
+        ec = make_error(http_error::bad_multipart);
+}
+
+inline
+void
+parser::reset()
+{
+    parse_phase_ = parse_phase::not_started;
+    method_ = http_method::unknown;
+    target_ = {};
+    protocol_version_ = 0;
+    header_spans_.clear();
+    headers_.clear();
+    content_length_ = 0;
+    base_ = nullptr;
+    head_size_ = 0;
+    line_scan_ = 0;
+    header_start_ = 0;
+    chunked_ = false;
+    chunk_state_ = chunk_state::size_line;
+    chunk_remaining_ = 0;
+    body_received_ = 0;
+    body_reader_.reset();
+    paused_ = false;
+
+    // Keep a moderate capacity for the next body, give large ones back
+    body_buffer_.clear();
+    if (body_buffer_.capacity() > 64 * 1024)
+        std::string().swap(body_buffer_);
+    uploads_.clear();
+    header_content_type_ = content_type::not_specified;
+    consumed_ = 0;
+    retained_ = 0;
 }
 
 inline
@@ -235,469 +531,386 @@ parser::parse_start_line(char const*& it, char const* last, std::error_code& ec)
     parse_method(it, last, method, ec);
     if (ec)
         return;
-    method_ = std::move(method);
+    method_ = to_method(method);
 
     std::string_view target;
     parse_target(it, last, target, ec);
     if (ec)
         return;
-    target_ = std::move(target);
+    target_ = to_span(target);
 
     parse_protocol(it, last, protocol_version_, ec);
     if (ec)
         return;
 
-    // we will only support http 1.1 at the moment
-    if (protocol_version_ < 11 || protocol_version_ > 11)
+    // HTTP/1.0 and HTTP/1.1, the response is always sent as HTTP/1.1
+    if (protocol_version_ != 10 && protocol_version_ != 11)
     {
         ec = make_error(http_error::bad_version);
         return;
     }
 
-    if(it + 2 > last)
-    {
-        ec = make_error(http_error::incomplete_start_line);
-        return;
-    }
-
-    if(it[0] != '\r' && it[1] != '\n')
+    // The line ends at its CRLF
+    if(it + 2 > last || it[0] != '\r' || it[1] != '\n')
     {
         ec = make_error(http_error::invalid_request_line);
         return;
     }
 
-    // Skip the CRLR
     it += 2;
+}
 
-    parse_message_header(it, last, headers_, ec);
+inline
+void
+parser::parse_head(char const*& it, char const* last, std::error_code& ec)
+{
+    for (;;)
+    {
+        auto const line = it;
 
-    // Parse Content Type
-    parse_content_type(header_content_type_, headers_);
+        // Resume the search where the previous call stopped
+        auto from = std::max(line, base_ + line_scan_);
+        auto lf = static_cast<char const*>(std::memchr(from, '\n', static_cast<std::size_t>(last - from)));
 
-    // TODO: At the moment, we will reject all unsuported content types
-    // Supported: multipart and json
-    if (header_content_type_ != content_type::application_json &&
-        header_content_type_ != content_type::multipart_formdata &&
-        header_content_type_ != content_type::not_specified &&
-        header_content_type_ != content_type::application_form_urlencoded &&
-        header_content_type_ != content_type::image_jpeg)
-    {
-        ec = make_error(http_error::content_type_not_implemented);
-        return;
-    }
+        // Checked on every read, an incomplete line is not waited for past a limit
+        check_head_size(lf ? lf + 1 : last, ec);
+        if (ec)
+            return;
 
-//    if(header_content_type == content_type::multipart_formdata)
-//    {
-//        // Parse body
-//
+        if (!lf)
+        {
+            line_scan_ = static_cast<std::size_t>(last - base_);
+            return;
+        }
 
-//        //http_request request(to_method(method), protocol_version, target, headers, uploads);
-//        return;
-//    }
+        auto const next = lf + 1;
+        if (lf == line || lf[-1] != '\r')
+        {
+            ec = make_error(parse_phase_ == parse_phase::not_started
+                ? http_error::invalid_request_line
+                : http_error::invalid_message_header_crlf);
+            return;
+        }
 
+        if (parse_phase_ == parse_phase::not_started)
+        {
+            // Empty lines before the request line are ignored (RFC 7230 3.5)
+            if (next - line > 2)
+            {
+                auto first = line;
+                parse_start_line(first, next, ec);
+                if (ec)
+                    return;
 
-//    parse_body(it, last, body, ec);
+                parse_phase_ = parse_phase::parse_headers;
+                header_start_ = static_cast<std::size_t>(next - base_);
+            }
+        }
+        else if (next - line == 2)
+        {
+            // Empty line, end of the head
+            it = next;
+            head_size_ = static_cast<std::size_t>(it - base_);
+            line_scan_ = head_size_;
+
+            parse_phase_ = parse_phase::parse_headers_finished;
+            parse_head_finished(ec);
+            return;
+        }
+        else
+        {
+            parse_header_line(line, next, ec);
+            if (ec)
+                return;
+        }
 
-//    http_request request(to_method(method), protocol_version, target, headers, body);
-//    return;
+        it = next;
+        head_size_ = static_cast<std::size_t>(it - base_);
+        line_scan_ = head_size_;
+    }
 }
 
 inline
-std::optional<http_request>
-parser::parse_body(const char*& it, const char* last, std::string_view& body, std::error_code& ec)
+void
+parser::check_head_size(char const* end, std::error_code& ec) const
 {
-    auto first = it;
-
-    // check limit of length
-
-    body = make_string(first, last);
+    auto const size = static_cast<std::size_t>(end - base_);
 
-    http_request request(to_method(method_), protocol_version_, target_, headers_, body);
-    return request;
+    if (parse_phase_ == parse_phase::not_started)
+    {
+        if (size > limits_.start_line)
+            ec = make_error(http_error::start_line_too_long);
+    }
+    else if (size - header_start_ > limits_.header_bytes)
+    {
+        ec = make_error(http_error::header_too_large);
+    }
 }
 
 inline
 void
-parser::parse_content_type(content_type& content_type,
-                   std::unordered_map<std::string, std::string> const& headers)
+parser::parse_header_line(char const* it, char const* last, std::error_code& ec)
 {
-    parse_phase_ = parse_phase::parse_content_type;
-
-    auto content_type_h = headers.find("content-type");
-    if (content_type_h == headers.end())
+    if (header_spans_.size() >= limits_.header_fields)
     {
-        content_type = content_type::not_specified;
-        parse_phase_ = parse_phase::parse_content_type_finished;
+        ec = make_error(http_error::too_many_header_fields);
         return;
     }
 
-    auto tokens = common::string_utils::split(content_type_h->second, ';');
-    auto type = tokens.size() > 0 ? tokens[0] : content_type_h->second;
+    std::string_view header_name{};
+    std::string_view header_value{};
 
-    // TODO: form-data is a subtype
-    if (type == "multipart/form-data")
-        content_type = content_type::multipart_formdata;
-    else if(type == "application/json")
-        content_type = content_type::application_json;
-    else if(type == "image/jpeg")
-        content_type = content_type::image_jpeg;
-    else if(type == "application/x-www-form-urlencoded")
-        content_type = content_type::application_form_urlencoded;
-    else
-        content_type = content_type::unknown;
+    parse_message_header_name(it, last, header_name, ec);
+    if (ec)
+        return;
 
+    parse_message_header_value(it, last, header_value, ec);
+    if (ec)
+        return;
 
-    parse_phase_ = parse_phase::parse_content_type_finished;
+    // Views into the buffer, names keep their case. The spans rebuild them
+    // when the buffer moves.
+    headers_.add(header_name, header_value);
+    header_spans_.push_back({to_span(header_name), to_span(header_value)});
 }
 
 inline
 void
-parser::parse_media_type(
-        char const*& it,
-        char const* last,
-        std::unordered_map<std::string, std::string> const& headers,
-        std::vector<http_form_upload>& uploads,
-        std::error_code& ec)
+parser::parse_head_finished(std::error_code& ec)
 {
-    auto verify_boundary_value = [&it, &last](std::size_t boundary_value_length, std::string const& bound_value) -> bool
+    // Without Content-Length the request has no body
+    auto content_length_h = headers_.find(http_field::content_length);
+    if (content_length_h != headers_.end())
     {
-        // TODO: POOR
-        for(; it < last; ++it)
-        {
-            auto match_count = 0;
-            for(auto c = 0; c < boundary_value_length; ++c)
-            {
-                // linear scan for boundary value
-                if (it[c] != bound_value[c])
-                {
-                    match_count = 0;
-                    continue;
-                }
-
-                if (*it == '-')
-                    continue;
-
-                match_count++;
-            }
-
-            if (match_count == boundary_value_length)
-            {
-                return true;
-            }
-
-            //printf("%c", *it);
-        }
-        return false;
-    };
-
-    auto parse_media_type_begin = [this, &headers, &ec, &verify_boundary_value]
-            (char const*& it, char const* last) -> void
-    {
-        parse_phase_ = parse_phase::parse_media_type;
-
-        auto content_type_h = headers.find("content-type");
-        if (content_type_h == headers.end())
+        auto value = content_length_h->second;
+        auto [p, error] = std::from_chars(value.data(), value.data() + value.size(), content_length_);
+        if (error != std::errc() || p != value.data() + value.size())
         {
+            ec = make_error(http_error::bad_content_length);
             return;
         }
 
-        // parses a media type value and any optional
-        // parameters, per RFC 1521. Media types are the values in
-        // Content-Type and Content-Disposition headers (RFC 2183).
-        // On success, parse_media_type returns the media type converted
-        // to lowercase and trimmed of white space
-
-        // text
-        // image
-        // audio
-        // video
-        // application
-        // multipart
-        // message
-
-        // The only header fields that have defined meaning for body parts are
-        // those the namesof which begin with "Content-"
-
-        // get boundary parameter
-        auto boundary_pos = content_type_h->second.find("boundary=");
-        if (boundary_pos == std::string::npos)
+        if (content_length_ > limits_.body)
         {
-            ec = make_error(http_error::no_boundary_header_for_multipart);
+            ec = make_error(http_error::body_too_large);
             return;
         }
+    }
 
-        boundary_value_ = content_type_h->second.substr(
-                    boundary_pos, content_type_h->second.size());
-
-        auto boundary_v_it = boundary_value_.begin();
-
-        if (*boundary_v_it++ != 'b')
-        {
-            return;
-        }
-        if (*boundary_v_it++ != 'o')
-        {
-            return;
-        }
-        if (*boundary_v_it++ != 'u')
-        {
-            return;
-        }
-        if (*boundary_v_it++ != 'n')
-        {
-            return;
-        }
-        if (*boundary_v_it++ != 'd')
-        {
-            return;
-        }
-        if (*boundary_v_it++ != 'a')
-        {
-            return;
-        }
-        if (*boundary_v_it++ != 'r')
-        {
-            return;
-        }
-        if (*boundary_v_it++ != 'y')
+    // Only the chunked coding is decoded. Both framings in one request are
+    // rejected, they are a request smuggling vector (RFC 7230 3.3.3).
+    auto transfer_encoding_h = headers_.find(http_field::transfer_encoding);
+    if (transfer_encoding_h != headers_.end())
+    {
+        // HTTP/1.0 has no transfer codings, its framing cannot be trusted
+        if (!common::string_utils::iequals(transfer_encoding_h->second, "chunked") ||
+            content_length_h != headers_.end() || protocol_version_ < 11)
         {
+            ec = make_error(http_error::bad_transfer_encoding);
             return;
         }
 
-        for(; boundary_v_it < boundary_value_.end(); ++boundary_v_it)
-        {
-            if (*boundary_v_it == '=' || *boundary_v_it == '-')
-                continue;
-
-            break;
-        }
+        chunked_ = true;
+    }
 
-        boundary_value_ = std::string(make_string(&*boundary_v_it, &*boundary_value_.end()));
+    // Parse Content Type
+    parse_content_type(header_content_type_, headers_);
 
-        // Consume CRLF
-        if (it + 4 > last)
+    if (header_content_type_ == content_type::multipart_formdata)
+    {
+        auto boundary = multipart_parser::boundary_parameter(headers_.find(http_field::content_type)->second);
+        if (boundary.empty())
         {
+            ec = make_error(http_error::no_boundary_header_for_multipart);
             return;
         }
 
-        if (it[0] == '\r' &&
-            it[1] == '\n' &&
-            it[2] == '\r' &&
-            it[3] == '\n')
-        {
-            it += 4;
-        }
-
-        // TODO: Loop to get multiple files
-
-        boundary_value_length_ = boundary_value_.length();
-
-        auto first = it;
-
-        for(; it < last; ++it)
-        {
-            // find delimiter line
-            if (*it == '-')
-                continue;
-
-            break;
-        }
-
-        verify_boundary_value(boundary_value_length_, boundary_value_);
-
-        first = it;
-
-        for(; it < last; ++it)
-        {
-            // At the end of the last boundary value has two --
-
-            if(it[0] == '-' &&
-               it[1] == '-' &&
-               it[2] == '\r' &&
-               it[3] == '\n')
-            {
-                return;
-            }
-
-            if(it[0] == '\r' &&
-               it[1] == '\n')
-            {
-                break;
-            }
-        }
-
-        auto boundary_value_at_line = std::string(make_string(first, it));
+        multipart_.reset(boundary);
+    }
 
-        if (boundary_value_at_line != boundary_value_)
-        {
-            return;
-        }
+    // TODO: At the moment, we will reject all unsuported content types
+    // Supported: multipart and json
+    if (header_content_type_ != content_type::application_json &&
+        header_content_type_ != content_type::multipart_formdata &&
+        header_content_type_ != content_type::not_specified &&
+        header_content_type_ != content_type::application_form_urlencoded &&
+        header_content_type_ != content_type::image_jpeg)
+    {
+        ec = make_error(http_error::content_type_not_implemented);
+        return;
+    }
+}
 
-        // CRLF
-        it += 2;
+inline
+std::optional<http_request>
+parser::parse_body(const char*& it, const char* last, std::string_view& body, std::error_code& ec)
+{
+    // The body ends at Content-Length, the bytes after it are the next request
+    auto const available = static_cast<std::size_t>(last - it);
 
-        // Parse headers
-        std::unordered_map<std::string, std::string> body_headers;
-        parse_message_header(it, last, body_headers, ec);
+    if (body_received_ == 0 && !body_reader_ && available >= content_length_)
+    {
+        // Arrived with the head, viewed in place
+        body = std::string_view(it, content_length_);
+        it += content_length_;
 
-        // parse headers body
-        auto content_type_h_body = body_headers.find("content-type");
-        if (content_type_h_body == body_headers.end())
-        {
-            return;
-        }
+        parse_phase_ = parse_phase::finished;
+        return make_request(body);
+    }
 
-        upload_body_headers_ = body_headers;
-        //img_type_ = content_type_h_body->second;
+    // Spans several reads: gathered in the body buffer, the receive buffer
+    // only keeps the head
+    auto const size = std::min(available, content_length_ - body_received_);
+    append_body(it, size, ec);
+    if (ec)
+        return std::nullopt;
 
-        // Consume Two CRLF
-        it += 4;
-    };
+    it += size;
+    body_received_ += size;
 
-    auto parse_media_type_more = [this, &verify_boundary_value, &headers, &uploads]
-            (char const*& it, char const* last) -> void
+    if (body_received_ < content_length_)
     {
-        auto buffer_start = it;
-        const char* buffer_end = last;
-
-        auto content_length_h = headers.find("content-length");
-        if (content_length_h == headers.end())
-        {
-            return;
-        }
+        parse_phase_ = parse_phase::parse_body_pending;
+        return std::nullopt;
+    }
 
-        if (buffer_start == buffer_end)
-        {
-            // need more
-            parse_phase_ = parse_phase::parse_media_type_need_more;
-            return;
-        }
+    body = body_buffer_;
+    return finish_body(ec);
+}
 
-        bool endbuffer_was_reached = false;
+inline
+std::optional<http_request>
+parser::parse_chunked_body(const char*& it, const char* last, std::error_code& ec)
+{
+    //  chunked-body = *chunk last-chunk trailer-part CRLF
+    //  chunk        = chunk-size [ chunk-ext ] CRLF chunk-data CRLF
+    parse_phase_ = parse_phase::parse_body_pending;
 
-        auto first = it;
-        if(verify_boundary_value(boundary_value_length_, boundary_value_))
+    while (it < last)
+    {
+        switch (chunk_state_)
         {
-            for(;it < last; ++it)
+            case chunk_state::size_line:
+            case chunk_state::trailers:
             {
-                if (*it == '-')
-                    continue;
-
-                if (it + 2 > last)
+                // A line is parsed once complete, the partial line stays unconsumed
+                auto const available = static_cast<std::size_t>(last - it);
+                auto lf = static_cast<char const*>(std::memchr(it, '\n', std::min(available, limits_.chunk_line)));
+                if (!lf)
                 {
-                    continue;
+                    if (available >= limits_.chunk_line)
+                        ec = make_error(http_error::bad_chunk);
+                    return std::nullopt;
                 }
 
-                //printf("%c - %c\n", it[0], it[1]);
+                if (lf == it || lf[-1] != '\r')
+                {
+                    ec = make_error(http_error::bad_chunk);
+                    return std::nullopt;
+                }
 
-                if(it[0] == '\r' && it[1] == '\n')
+                if (chunk_state_ == chunk_state::trailers)
                 {
-                    // consume \r and point to the end byte of the image
-                    it += 2;
-                    endbuffer_was_reached = true;
+                    auto const empty = lf - it == 1;
+                    it = lf + 1;
+
+                    // Trailer fields are ignored, the empty line ends the body
+                    if (empty)
+                        return finish_body(ec);
+
                     break;
                 }
-            }
 
-            buffer_end = &*it;
-        }
-        else
-            buffer_end = &*last;
+                auto const line_last = lf - 1;
+                auto [p, error] = std::from_chars(it, line_last, chunk_remaining_, 16);
+                if (error != std::errc() || (p != line_last && *p != ';'))
+                {
+                    ec = make_error(error == std::errc::result_out_of_range
+                        ? http_error::body_too_large
+                        : http_error::bad_chunk);
+                    return std::nullopt;
+                }
 
-        auto buffer_delta = buffer_end - buffer_start;
-        buffer_size_readed_ += buffer_delta;
+                if (chunk_remaining_ > limits_.body - body_received_)
+                {
+                    ec = make_error(http_error::body_too_large);
+                    return std::nullopt;
+                }
 
-        // TODO: Optimize this
-        multipart_buffer_->reserve(buffer_size_readed_);
+                // Chunk extensions are ignored
+                it = lf + 1;
+                chunk_state_ = chunk_remaining_ == 0 ? chunk_state::trailers : chunk_state::data;
+                break;
+            }
 
-        for(auto it = buffer_start; it < buffer_end; ++it)
-        {
-            auto x = (unsigned char*)it;
-            unsigned char xx = *x;
-            multipart_buffer_->push_back(std::byte{xx});
-        }
+            case chunk_state::data:
+            {
+                auto const size = std::min(static_cast<std::size_t>(last - it), chunk_remaining_);
+                append_body(it, size, ec);
+                if (ec)
+                    return std::nullopt;
 
-        auto content_length = std::atoi(content_length_h->second.c_str());
-        if (!endbuffer_was_reached && buffer_size_readed_ < content_length)
-        {
-            parse_phase_ = parse_phase::parse_media_type_need_more;
-            return;
-        }
+                it += size;
+                body_received_ += size;
+                chunk_remaining_ -= size;
 
-        http_form_upload item;
-        item.headers = upload_body_headers_;
-        item.bytes = multipart_buffer_;
-        uploads.push_back(std::move(item));
+                if (chunk_remaining_ == 0)
+                    chunk_state_ = chunk_state::data_crlf;
+                break;
+            }
 
-        parse_phase_ = parse_phase::parse_media_type_finished;
-    };
+            case chunk_state::data_crlf:
+            {
+                if (last - it < 2)
+                    return std::nullopt;
 
-    if (parse_phase_ == parse_phase::parse_content_type_finished)
-    {
-        parse_media_type_begin(it, last);
+                if (it[0] != '\r' || it[1] != '\n')
+                {
+                    ec = make_error(http_error::bad_chunk);
+                    return std::nullopt;
+                }
 
-        // try read more
-        parse_media_type_more(it, last);
-    }
-    else if (parse_phase_ == parse_phase::parse_media_type_need_more)
-    {
-        parse_media_type_more(it, last);
+                it += 2;
+                chunk_state_ = chunk_state::size_line;
+                break;
+            }
+        }
     }
+
+    return std::nullopt;
 }
 
 inline
 void
-parser::parse_message_header(const char*& it, const char* last, std::unordered_map<std::string, std::string>& headers, std::error_code& ec)
+parser::parse_content_type(content_type& content_type, http_headers const& headers)
 {
-    parse_phase_ = parse_phase::parse_headers;
-    // Muito curta ?
-    if(it + 2 > last)
+    parse_phase_ = parse_phase::parse_content_type;
+
+    auto content_type_h = headers.find(http_field::content_type);
+    if (content_type_h == headers.end())
     {
-        ec = make_error(http_error::incomplete_message_header);
+        content_type = content_type::not_specified;
+        parse_phase_ = parse_phase::parse_content_type_finished;
         return;
     }
 
-    auto first = it;
-
-    // Structure
-    // message-header = field-name ":" [ field-value ]
-    //       field-name     = token
-    //       field-value    = *( field-content | LWS )
-    //       field-content  = <the OCTETs making up the field-value
-    //                        and consisting of either *TEXT or combinations
-    //                        of token, separators, and quoted-string>
-
-    // Parse fields
-    for(;it < last; ++it)
-    {
-        std::string_view header_name{};
-        std::string_view header_value{};
-
-        parse_message_header_name(it, last, header_name, ec);
-
-        parse_message_header_value(it, last, header_value, ec);
-
-        // TODO: Optimize me, please
-        std::string hn = common::string_utils::to_lower(header_name);
-        std::string hv = std::string(header_value);
-        headers.insert({hn, hv});
+    auto tokens = common::string_utils::split(content_type_h->second, ';');
+    auto type = tokens.size() > 0 ? tokens[0] : content_type_h->second;
 
-        // Final do header_name: header_value
-        if(it[0] == '\r')
-        {
-            if(it[1] != '\n')
-                ec = make_error(http_error::invalid_message_header_crlf);
+    // TODO: form-data is a subtype
+    if (type == "multipart/form-data")
+        content_type = content_type::multipart_formdata;
+    else if(type == "application/json")
+        content_type = content_type::application_json;
+    else if(type == "image/jpeg")
+        content_type = content_type::image_jpeg;
+    else if(type == "application/x-www-form-urlencoded")
+        content_type = content_type::application_form_urlencoded;
+    else
+        content_type = content_type::unknown;
 
-            // end headers
-            if (it[2] == '\r' && it[3] == '\n')
-                break;
 
-            // This will Skip crlf for complete, because the main for is already skip the \r
-            ++it;
-        }
-    }
-
-    parse_phase_ = parse_phase::parse_headers_finished;
+    parse_phase_ = parse_phase::parse_content_type_finished;
 }
 
 inline
@@ -707,16 +920,20 @@ parser::parse_message_header_name(const char*& it, const char* last, std::string
 {
     auto first = it;
 
-    for(;it < last; ++it)
+    // Token characters up to ':', the scan also stops at '|' and '~'
+    it = detail::scan(it, last, detail::header_name_stop);
+    while (it != last && detail::is_token_char(*it))
+        it = detail::scan(it + 1, last, detail::header_name_stop);
+    if (it == last)
     {
-        if (*it == ':')
-            break;
+        ec = make_error(http_error::incomplete_message_header);
+        return;
+    }
 
-        if (!detail::is_valid_token(*it))
-        {
-            ec = make_error(http_error::bad_field);
-            return;
-        }
+    if (*it != ':' || it == first)
+    {
+        ec = make_error(http_error::bad_field);
+        return;
     }
 
     header_name = make_string(first, it++);
@@ -744,19 +961,18 @@ parser::parse_message_header_value(const char*& it, const char* last, std::strin
 
     auto first = it;
 
-    // Field value
-    for(; it < last; ++it)
+    // Field value, visible characters, SP, HTAB and obs-text up to CRLF
+    it = detail::scan(it, last, detail::header_value_stop);
+    if (it + 2 > last)
     {
-        if(it[0] == '\r' && it[1] == '\n')
-            break;
+        ec = make_error(http_error::incomplete_message_header);
+        return;
+    }
 
-        // TODO: Can be undefined behavior
-        // TODO: Refactor this part
-        if (!std::isprint(*it))
-        {
-            ec = make_error(http_error::bad_field_value);
-            return;
-        }
+    if (it[0] != '\r' || it[1] != '\n')
+    {
+        ec = make_error(http_error::bad_field_value);
+        return;
     }
 
     header_value = make_string(first, it);
@@ -833,12 +1049,7 @@ parser::parse_target(const char*& it, const char* last, std::string_view& target
     //Request line
     //method_token request- protocol_version CLRF
     // Procura pela uri
-    for(; it < last; ++it)
-    {
-        //
-        if(!detail::is_pathchar(*it))
-            break;
-    }
+    it = detail::scan(it, last, detail::target_stop);
 
     // Muito curto a string ?
     if (it + 1 >= last)
@@ -1,9 +1,19 @@
 #pragma once
 #include "webcrown/server/http/http_method.hpp"
-#include <any>
-#include <unordered_map>
+#include "webcrown/server/http/http_field.hpp"
+#include "webcrown/server/http/body_reader.hpp"
+#include "webcrown/common/string/string_common.hpp"
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <memory>
 
 namespace webcrown {
@@ -11,76 +21,380 @@ namespace server {
 namespace http {
 
 using std::vector;
-using std::unordered_map;
 
-struct http_form_upload
+struct route_match;
+
+/// Key of an http_context value, declared once by the application:
+///
+///     struct current_user : http::context_key<user_info, 0> {};
+///
+/// Each key has its own slot, from 0 to http_context::slots - 1.
+template <typename T, std::size_t Slot>
+struct context_key
 {
-    std::shared_ptr<std::vector<std::byte>> bytes;
-    unordered_map<std::string, std::string> headers;
+    using value_type = T;
+    static constexpr std::size_t slot = Slot;
 };
 
+/// Values handed by the middlewares to the handler of one request, like the
+/// user decoded by the auth middleware. A key is a fixed slot with inline
+/// storage: no hashing and no type erasure on lookup, and the context itself
+/// never allocates (a value may, like a std::string).
+/// The server keeps one per session for the request being read, from its
+/// head to its response. The values are destroyed when the request is
+/// handled, before the memory of http_request::arena() is released.
 class http_context
 {
-    using context_name = std::string;
-    using context_value = std::any;
-    unordered_map<context_name, context_value> _values;
 public:
+    static constexpr std::size_t slots = 8;
+
+    /// Largest value of a slot
+    static constexpr std::size_t slot_size = 64;
+private:
+    struct slot
+    {
+        alignas(std::max_align_t) std::byte storage[slot_size];
+        // Key of the value, null when the slot is empty
+        void const* key{nullptr};
+        void (*destroy)(void*) noexcept{nullptr};
+    };
 
-    void add_value(std::pair<context_name, context_value> const& v)
+    template <typename Key>
+    struct key_id
     {
-        if(_values.empty())
-            _values.insert(v);
-        else
-            _values[v.first] = v.second;
+        static constexpr char id{};
+    };
+
+    std::array<slot, slots> slots_;
+public:
+    http_context() = default;
+
+    http_context(http_context const&) = delete;
+    http_context& operator=(http_context const&) = delete;
+
+    ~http_context() { clear(); }
+
+    /// Stores the value of Key, replacing the previous one
+    template <typename Key, typename... Args>
+    typename Key::value_type& emplace(Args&&... args);
+
+    /// Value of Key, null when it was not stored
+    template <typename Key>
+    typename Key::value_type* get() noexcept;
+
+    template <typename Key>
+    typename Key::value_type const* get() const noexcept
+    { return const_cast<http_context*>(this)->get<Key>(); }
+
+    template <typename Key>
+    void erase() noexcept;
+
+    void clear() noexcept;
+
+private:
+    template <typename Key>
+    slot& slot_of() noexcept;
+};
+
+template <typename Key>
+http_context::slot&
+http_context::slot_of() noexcept
+{
+    using T = typename Key::value_type;
+    static_assert(Key::slot < slots, "Context key slot out of range");
+    static_assert(sizeof(T) <= slot_size, "Context value does not fit its slot, store a pointer");
+    static_assert(alignof(T) <= alignof(std::max_align_t), "Context value is over-aligned");
+    static_assert(std::is_nothrow_destructible_v<T>, "Context value must be nothrow destructible");
+
+    auto& s = slots_[Key::slot];
+    // Two keys declared with the same slot
+    assert((s.key == nullptr || s.key == &key_id<Key>::id) && "Context slot used by another key");
+
+    return s;
+}
+
+template <typename Key, typename... Args>
+typename Key::value_type&
+http_context::emplace(Args&&... args)
+{
+    using T = typename Key::value_type;
+
+    erase<Key>();
+
+    auto& s = slot_of<Key>();
+    auto value = ::new (static_cast<void*>(s.storage)) T(std::forward<Args>(args)...);
+    s.key = &key_id<Key>::id;
+    s.destroy = [](void* p) noexcept { static_cast<T*>(p)->~T(); };
+
+    return *value;
+}
+
+template <typename Key>
+typename Key::value_type*
+http_context::get() noexcept
+{
+    auto& s = slot_of<Key>();
+    if (s.key == nullptr)
+        return nullptr;
+
+    return std::launder(reinterpret_cast<typename Key::value_type*>(s.storage));
+}
+
+template <typename Key>
+void
+http_context::erase() noexcept
+{
+    auto& s = slot_of<Key>();
+    if (s.key == nullptr)
+        return;
+
+    s.destroy(s.storage);
+    s.key = nullptr;
+}
+
+inline
+void
+http_context::clear() noexcept
+{
+    for (auto& s : slots_)
+    {
+        if (s.key == nullptr)
+            continue;
+
+        s.destroy(s.storage);
+        s.key = nullptr;
     }
+}
+
+/// Header fields of a request, borrowed from the receive buffer.
+/// Names keep the case sent by the client, lookups ignore it. Well-known
+/// fields are indexed by their http_field id when they are added, so
+/// finding them does not compare any name.
+class http_headers
+{
+public:
+    using value_type = std::pair<std::string_view, std::string_view>;
+    using const_iterator = value_type const*;
+
+    /// Fields stored without allocation, most requests have fewer
+    static constexpr std::size_t inline_fields = 16;
+private:
+    std::array<value_type, inline_fields> inline_;
+    std::vector<value_type> overflow_;
+    std::size_t size_{0};
+
+    // Position + 1 of the first field of every well-known id, 0 when absent
+    std::array<std::uint16_t, static_cast<std::size_t>(http_field::count)> index_{};
+public:
+    const_iterator begin() const noexcept { return data(); }
+    const_iterator end() const noexcept { return data() + size_; }
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    /// First field with the well-known id
+    const_iterator find(http_field field) const noexcept
+    {
+        auto position = index_[static_cast<std::size_t>(field)];
+        return position == 0 ? end() : data() + position - 1;
+    }
+
+    /// First field named name, case-insensitive
+    const_iterator find(std::string_view name) const noexcept
+    {
+        auto field = to_field(name);
+        if (field != http_field::unknown)
+            return find(field);
+
+        for (auto it = begin(); it != end(); ++it)
+        {
+            if (common::string_utils::iequals(it->first, name))
+                return it;
+        }
 
-    decltype(_values) values() const noexcept { return _values; }
+        return end();
+    }
+
+    void add(std::string_view name, std::string_view value)
+    {
+        auto field = to_field(name);
+        auto& position = index_[static_cast<std::size_t>(field)];
+        if (field != http_field::unknown && position == 0 && size_ < UINT16_MAX)
+            position = static_cast<std::uint16_t>(size_ + 1);
+
+        if (size_ < inline_fields)
+        {
+            inline_[size_++] = value_type(name, value);
+            return;
+        }
+
+        // Spill to the heap, the inline fields move along
+        if (size_ == inline_fields)
+            overflow_.assign(inline_.begin(), inline_.end());
+
+        overflow_.emplace_back(name, value);
+        ++size_;
+    }
+
+    /// Keeps the overflow capacity for the next request
+    void clear() noexcept
+    {
+        size_ = 0;
+        overflow_.clear();
+        index_.fill(0);
+    }
+
+private:
+    value_type const* data() const noexcept
+    {
+        return size_ <= inline_fields ? inline_.data() : overflow_.data();
+    }
+};
+
+/// Part of a multipart/form-data body, a file or a form field.
+/// Views into the body of the request, like its headers.
+struct http_form_upload
+{
+    /// Content-Disposition and Content-Type of the part, empty when absent.
+    /// Its other header fields are not kept.
+    std::string_view disposition;
+    std::string_view content_type;
+    /// Parameters of its Content-Disposition
+    std::string_view name;
+    std::string_view filename;
+    /// Payload, empty when it was spooled to a file
+    std::string_view bytes;
+    /// Temporary file of a spooled payload, removed once the request is
+    /// handled unless it is renamed
+    std::string_view path;
+    /// Payload size, in memory or on disk
+    std::size_t size{0};
+
+    bool spooled() const noexcept { return !path.empty(); }
 };
 
+/// Request handed to the middlewares.
+/// Target, headers and body are views into the receive buffer of the
+/// session and the storage of its parser: they are valid while the request
+/// is handled, copy what must outlive it.
 class http_request
 {
     http_method method_;
     int protocol_version;
-    std::string target_;
-    std::unordered_map<std::string, std::string> headers_;
-    std::string body_;
-    std::vector<http_form_upload> uploads_;
+    std::string_view target_;
+    http_headers const* headers_;
+    std::string_view body_;
+    std::vector<http_form_upload> const* uploads_;
+    body_reader* reader_;
+    std::pmr::memory_resource* arena_;
+    route_match const* match_{nullptr};
+    http_context* context_{nullptr};
+    bool head_accepted_{false};
 public:
     explicit http_request(
         http_method method,
         int protocol_version,
         std::string_view target,
-        std::unordered_map<std::string, std::string> const& headers,
-        std::string_view body = std::string{})
+        http_headers const& headers,
+        std::string_view body,
+        std::vector<http_form_upload> const& uploads,
+        body_reader* reader = nullptr,
+        std::pmr::memory_resource* arena = std::pmr::get_default_resource())
         : method_(method)
         , protocol_version(protocol_version)
         , target_(target)
-        , headers_(headers)
+        , headers_(&headers)
         , body_(body)
-    {}
-    
-    explicit http_request(
-                          http_method method,
-                          int protocol_version,
-                          std::string_view target,
-                          std::unordered_map<std::string, std::string> const& headers,
-                          std::vector<http_form_upload> form_upload)
-        : method_(method)
-        , protocol_version(protocol_version)
-        , target_(target)
-        , headers_(headers)
-        , uploads_(std::move(form_upload))
+        , uploads_(&uploads)
+        , reader_(reader)
+        , arena_(arena)
     {}
 
     http_method method() const noexcept { return method_; }
 
-    std::string target() const noexcept { return target_; }
+    int version() const noexcept { return protocol_version; }
+
+    /// Whether the client wants to keep the connection open after this request.
+    /// HTTP/1.1 connections are persistent unless "Connection: close" is sent.
+    bool keep_alive() const noexcept
+    {
+        auto connection = headers_->find(http_field::connection);
+        if (connection == headers_->end())
+            return protocol_version >= 11;
+
+        // Comma separated options, compared in place: close wins
+        bool keep_alive = protocol_version >= 11;
+        std::string_view options = connection->second;
+        while (!options.empty())
+        {
+            auto const comma = options.find(',');
+            auto option = options.substr(0, comma);
+            options.remove_prefix(comma == std::string_view::npos ? options.size() : comma + 1);
+
+            auto const first = option.find_first_not_of(" \t");
+            if (first == std::string_view::npos)
+                continue;
+
+            option = option.substr(first, option.find_last_not_of(" \t") - first + 1);
+            if (common::string_utils::iequals(option, "close"))
+                return false;
+
+            if (common::string_utils::iequals(option, "keep-alive"))
+                keep_alive = true;
+        }
+
+        return keep_alive;
+    }
+
+    std::string_view target() const noexcept { return target_; }
+
+    http_headers const& headers() const noexcept { return *headers_; }
+
+    std::string_view body() const noexcept { return body_; }
+
+    /// Parts of a multipart/form-data body, in order
+    std::vector<http_form_upload> const& uploads() const noexcept { return *uploads_; }
+
+    /// First part of the form named name, null when absent
+    http_form_upload const* form_part(std::string_view name) const noexcept
+    {
+        for (auto const& part : *uploads_)
+        {
+            if (part.name == name)
+                return &part;
+        }
+
+        return nullptr;
+    }
+
+    /// Reader that received the body when it was streamed, null otherwise
+    body_reader* reader() const noexcept { return reader_; }
+
+    /// Memory of the transient state of the middlewares, released when the
+    /// request is handled: nothing allocated from it may outlive the
+    /// response (see request_arena)
+    std::pmr::memory_resource* arena() const noexcept { return arena_; }
+
+    void arena(std::pmr::memory_resource* a) noexcept { arena_ = a; }
+
+    /// Route resolved once for the request, before the middlewares run.
+    /// Null when no middleware routes the requests, the route of the match
+    /// is null when none matches.
+    route_match const* match() const noexcept { return match_; }
+
+    void match(route_match const* m) noexcept { match_ = m; }
+
+    /// Values of the request shared by the middlewares and the handler,
+    /// null outside of the server
+    http_context* context() const noexcept { return context_; }
+
+    void context(http_context* c) noexcept { context_ = c; }
 
-    std::unordered_map<std::string, std::string> headers() const noexcept { return headers_; }
+    /// The middlewares accepted the head before the body was read, see
+    /// middleware::accept_head. What they checked then is not checked again.
+    bool head_accepted() const noexcept { return head_accepted_; }
 
-    std::string body() const noexcept { return body_; }
-    
-    std::vector<http_form_upload> uploads() const noexcept { return uploads_; }
+    void head_accepted(bool accepted) noexcept { head_accepted_ = accepted; }
 };
 
 }}}
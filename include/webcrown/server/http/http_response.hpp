@@ -1,8 +1,12 @@
 #pragma once
 
 #include "status.hpp"
+#include <charconv>
+#include <memory_resource>
 #include <string>
-#include <unordered_map>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include "webcrown/common/string/string_common.hpp"
 
 namespace webcrown {
@@ -25,17 +29,32 @@ class http_response
     /// TODO: At the moment, we not check if the sent headers are valids.
     /// The developer can be send anything
     /// Parse it on rules 
-    std::unordered_map<std::string, std::string> headers_;
+    /// Allocated from the arena of the request, in the order they are added
+    std::pmr::vector<std::pair<std::pmr::string, std::pmr::string>> headers_;
 public:
-    http_response();
+    /// \param arena memory of the request, the built header and the body
+    /// are not allocated from it since they outlive the request
+    explicit http_response(std::pmr::memory_resource* arena = std::pmr::get_default_resource());
 
     void set_status(http_status status) noexcept { status_ = status; }
 
     void add_header(std::string_view key, std::string_view value);
 
+    /// Replaces the value of the header, or adds it
+    void set_header(std::string_view key, std::string_view value);
+
+    /// Value of the header, empty when it was not added
+    [[nodiscard]] std::string_view header(std::string_view key) const noexcept;
+
     void set_body(std::string_view body);
+    void set_body(std::string&& body) noexcept { body_ = std::move(body); }
+    void set_body(char const* body) { set_body(std::string_view(body)); }
 
     [[nodiscard]] std::string body() const noexcept { return body_; }
+
+    /// Moves the body out of the response, used by the send path
+    /// so that large bodies are not copied.
+    [[nodiscard]] std::string release_body() noexcept { return std::move(body_); }
     [[nodiscard]] http_status status() const noexcept { return status_; }
 
     static http_response ok();
@@ -44,20 +63,40 @@ public:
     /// Status-Line
     ///     Status-Line = HTTP-Version SP Status-Code SP Reason-Phrase CRLF
     std::string build();
+
+    /// Builds the Status-Line and the headers, up to the empty line.
+    /// The body is sent separately, see release_body().
+    std::string build_header();
 };
 
 /// Constructor
 inline
-http_response::http_response()
+http_response::http_response(std::pmr::memory_resource* arena)
     : status_(http_status::internal_server_error) // The developer don't setted the status on response
+    , headers_(arena)
 {}
 
 inline
 std::string
 http_response::build()
+{
+    auto message = build_header();
+
+    // Body
+    message.append(body_);
+
+    return message;
+}
+
+inline
+std::string
+http_response::build_header()
 {
     // This will be the first step, so clean buffer
     buffer_.clear();
+    buffer_.reserve(128 + headers_.size() * 64);
+
+    char number[24];
 
     // TODO: add checking if the status, etc are filled
 
@@ -68,7 +107,8 @@ http_response::build()
     // SP
     buffer_.append(" ");
     // Status Code
-    buffer_.append(std::to_string(status_reason.first));
+    auto status_end = std::to_chars(number, number + sizeof(number), status_reason.first).ptr;
+    buffer_.append(number, status_end);
     // SP
     buffer_.append(" ");
     // Reason-Phrase
@@ -77,9 +117,13 @@ http_response::build()
     buffer_.append("\r\n");
 
     // Content-Length
-    if (!body_.empty())
+    // Persistent connections need it to find the end of the message,
+    // even when the body is empty. It replaces a value set by the handler,
+    // which would frame the body wrongly.
+    if (status_ != http_status::no_content && status_ != http_status::not_modified)
     {
-        add_header("Content-Length", std::to_string(body_.size()));
+        auto length_end = std::to_chars(number, number + sizeof(number), body_.size()).ptr;
+        set_header("Content-Length", std::string_view(number, static_cast<std::size_t>(length_end - number)));
     }
 
     // Headers
@@ -94,22 +138,54 @@ http_response::build()
     // CRLF
     buffer_.append("\r\n");
 
-    // CRLF
-    // this is wrong ?
-    //buffer_.append("\r\n");
-
-    // Body
-    buffer_.append(body_);
+    return std::move(buffer_);
+}
 
+inline
+void
+http_response::add_header(std::string_view key, std::string_view value)
+{
+    // The first value of a header is kept
+    for (auto const& header : headers_)
+    {
+        if (common::string_utils::iequals(header.first, key))
+            return;
+    }
 
-    return buffer_;
+    headers_.emplace_back(std::piecewise_construct,
+        std::forward_as_tuple(key),
+        std::forward_as_tuple(value));
 }
 
 inline
 void
-http_response::add_header(std::string_view key, std::string_view value)
+http_response::set_header(std::string_view key, std::string_view value)
 {
-    headers_.emplace(key, value);
+    for (auto& header : headers_)
+    {
+        if (common::string_utils::iequals(header.first, key))
+        {
+            header.second.assign(value);
+            return;
+        }
+    }
+
+    headers_.emplace_back(std::piecewise_construct,
+        std::forward_as_tuple(key),
+        std::forward_as_tuple(value));
+}
+
+inline
+std::string_view
+http_response::header(std::string_view key) const noexcept
+{
+    for (auto const& header : headers_)
+    {
+        if (common::string_utils::iequals(header.first, key))
+            return header.second;
+    }
+
+    return {};
 }
 
 inline
@@ -10,14 +10,6 @@ namespace webcrown {
 namespace server {
 namespace http {
 
-enum auth_authorization_level
-{
-    none,
-    guest,
-    owner,
-    admin
-};
-
 struct auth_result
 {
     explicit auth_result(bool success, std::string const& reason)
@@ -43,6 +35,15 @@ public:
             std::shared_ptr<route> route,
             auth_authorization_level level)>;
 
+    /// Same, the callback also stores what it decoded from the token, like
+    /// the user, in the context of the request for the handler
+    using auth_context_callback = std::function<
+    auth_result(
+            std::string const& token,
+            std::shared_ptr<route> route,
+            auth_authorization_level level,
+            http_context& context)>;
+
     explicit auth_middleware()
     {}
 
@@ -54,13 +55,15 @@ public:
 
     bool execute(http_request const &request, http_response &response) override
     {
-        auto forbidden_error = [&response, this]()
-        {
-            response.set_status(http_status::forbidden);
-        };
-
         try
         {
+            // Authorized by accept_head, before the body was read
+            if (request.head_accepted())
+                return true;
+
+            // Every authorized pattern is checked, even with a resolved
+            // route: the router may have resolved another route object for
+            // the path, or a more specific route than the authorized one
             for(auto const& r : routes_)
             {
                 auto&& route = r.first;
@@ -69,43 +72,8 @@ public:
                     continue;
                 }
 
-                // Verify if header Authorization exists
-                auto headers = request.headers();
-                auto auth_header = headers.find("Authorization");
-                if (auth_header == headers.end())
-                {
-                    auth_header = headers.find("authorization");
-                    if (auth_header == headers.end())
-                    {
-                        forbidden_error();
-                        return false;
-                    }
-                }
-
-                // extract the token
-                auto token = extract_token(auth_header->second);
-
-                if (token.empty())
-                {
-                    //logger_->error("Token is empty");
-                    forbidden_error();
-                    return false;
-                }
-
-                assert(cb_ != nullptr);
-                // Verify token
-                auto result = cb_(token, route, r.second);
-                if(!result.success)
-                {
-                    std::string body_res = R"({"error": ")";
-                    body_res.append(result.reason);
-                    body_res.append(R"("})");
-
-                    response.set_body(body_res);
-                    response.set_status(http_status::unauthorized);
-
+                if(!authorize(request, response, route, r.second))
                     return false;
-                }
             }
 
             return true;
@@ -118,8 +86,32 @@ public:
         }
     }
 
+    // Only the target and the Authorization header are checked, the
+    // callback runs once: execute skips the requests accepted here
+    bool accept_head(http_request const& request, http_response& response) override
+    {
+        return execute(request, response);
+    }
+
+    /// Only the routes that share a target with an authorized route are
+    /// checked, see pipeline
+    bool applies_to(route const& r) const noexcept
+    {
+        if (r.authorization())
+            return true;
+
+        for (auto const& authorized : routes_)
+        {
+            if (authorized.first->overlaps(r))
+                return true;
+        }
+
+        return false;
+    }
+
     void authorize_route(std::shared_ptr<route>& route, auth_authorization_level level)
     {
+        route->authorization(level);
         routes_.emplace_back(std::make_pair(route, level));
     }
 
@@ -128,20 +120,81 @@ public:
     auth_callback callback() const { return cb_; }
     void callback(auth_callback cb) { cb_ = cb; }
 
+    /// Used instead of callback() for the requests handled by the server
+    void context_callback(auth_context_callback cb) { context_cb_ = std::move(cb); }
+
 private:
-    std::string extract_token(std::string const& header_value)
+    bool authorize(http_request const& request, http_response& response,
+                   std::shared_ptr<route> const& route, auth_authorization_level level)
+    {
+        auto forbidden_error = [&response]()
+        {
+            response.set_status(http_status::forbidden);
+        };
+
+        // Verify if header Authorization exists
+        auto const& headers = request.headers();
+        auto auth_header = headers.find(http_field::authorization);
+        if (auth_header == headers.end())
+        {
+            forbidden_error();
+            return false;
+        }
+
+        // extract the token
+        auto token = extract_token(auth_header->second);
+
+        if (token.empty())
+        {
+            //logger_->error("Token is empty");
+            forbidden_error();
+            return false;
+        }
+
+        assert(cb_ != nullptr || context_cb_ != nullptr);
+        // Verify token
+        auto result = verify(token, route, level, request.context());
+        if(!result.success)
+        {
+            std::string body_res = R"({"error": ")";
+            body_res.append(result.reason);
+            body_res.append(R"("})");
+
+            response.set_body(body_res);
+            response.set_status(http_status::unauthorized);
+
+            return false;
+        }
+
+        return true;
+    }
+
+    auth_result verify(std::string const& token, std::shared_ptr<route> const& route,
+                       auth_authorization_level level, http_context* context)
+    {
+        if (context && context_cb_)
+            return context_cb_(token, route, level, *context);
+
+        if (cb_)
+            return cb_(token, route, level);
+
+        // Outside of the server the values of the callback are dropped
+        http_context dropped;
+        return context_cb_(token, route, level, dropped);
+    }
+
+    std::string extract_token(std::string_view header_value)
     {
         auto index = header_value.find("Bearer ");
-        if (index == std::string::npos)
+        if (index == std::string_view::npos)
             return "";
 
-        auto result = header_value.substr(index + 7);
-
-        return result;
+        return std::string(header_value.substr(index + 7));
     }
 private:
     RoutesAuthContainerT routes_;
     auth_callback cb_;
+    auth_context_callback context_cb_;
 };
 
 } // namespace http
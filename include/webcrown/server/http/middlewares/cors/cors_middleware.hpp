@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string_view>
 
 #include "webcrown/server/http/middlewares/http_middleware.hpp"
 
@@ -16,22 +17,29 @@ public:
 
     bool execute(http_request const& request, http_response& response) override
     {
-        auto&& headers = request.headers();
-        auto origin = headers.find("origin");
+        // Routes can opt out, the browser then blocks the cross-origin request
+        auto match = request.match();
+        if (match && match->route && !match->route->cors())
+        {
+            return true;
+        }
+
+        auto const& headers = request.headers();
+        auto origin = headers.find(http_field::origin);
 
         if (origin == headers.end())
         {
             return true;
         }
 
-        auto host = headers.find("host");
+        auto host = headers.find(http_field::host);
         if (host == headers.end())
         {
             // not found required header
             return false;
         }
 
-        if(origin->second == ("http://"+ host->second) || origin->second == ("https://"+host->second))
+        if(is_same_origin(origin->second, host->second))
         {
             // request is not a CORS request but have origin header.
             // for example, use fetch api
@@ -53,6 +61,24 @@ public:
 
         return true;
     }
+
+    /// Only the routes open to cross-origin requests, see pipeline
+    bool applies_to(route const& r) const noexcept { return r.cors(); }
+
+private:
+    /// Origin is http://host or https://host
+    static bool is_same_origin(std::string_view origin, std::string_view host)
+    {
+        for (std::string_view scheme : {"http://", "https://"})
+        {
+            if (origin.size() == scheme.size() + host.size() &&
+                origin.substr(0, scheme.size()) == scheme &&
+                origin.substr(scheme.size()) == host)
+                return true;
+        }
+
+        return false;
+    }
 };
 
 
@@ -2,6 +2,9 @@
 #include <deque>
 #include "webcrown/server/http/http_request.hpp"
 #include "webcrown/server/http/http_response.hpp"
+#include "webcrown/server/http/body_reader.hpp"
+#include "webcrown/server/http/middlewares/route.hpp"
+#include <memory>
 
 namespace webcrown {
 namespace server {
@@ -19,6 +22,25 @@ public:
     virtual ~middleware() = default;
 
     virtual bool execute(http_request const& request, http_response& response) = 0;
+
+    /// Called before the middlewares execute the request. The middleware
+    /// that routes the requests finds the route of the request into match
+    /// and returns true, the others read it from http_request::match().
+    virtual bool resolve(http_request const& /*request*/, route_match& /*match*/) const { return false; }
+
+    /// Called when the headers of a request with a body are parsed, the body
+    /// of the request is empty and its route is already resolved, the same
+    /// match is used by execute. Returning a reader streams the body to it.
+    virtual std::shared_ptr<body_reader> accept_body(http_request const& /*request*/) { return nullptr; }
+
+    /// Called before the body of a request sent with "Expect: 100-continue"
+    /// is read, the body of the request is empty. Returning false answers
+    /// response right away: the client does not send the body.
+    virtual bool accept_head(http_request const& /*request*/, http_response& /*response*/) { return true; }
+
+    /// Called once by WebServer::start, before the first request. The
+    /// routes and the settings of the middleware do not change afterwards.
+    virtual void prepare() {}
 };
 
 }}}
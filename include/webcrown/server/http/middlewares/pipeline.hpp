@@ -0,0 +1,176 @@
+#pragma once
+
+#include "webcrown/server/http/middlewares/http_middleware.hpp"
+#include "webcrown/server/http/middlewares/route.hpp"
+#include "webcrown/server/http/middlewares/routing_middleware.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+namespace detail {
+
+/// A middleware declares the routes it runs for with
+/// bool applies_to(route const&) const, else it runs for all of them
+template <typename M, typename = void>
+struct has_applies_to : std::false_type {};
+
+template <typename M>
+struct has_applies_to<M, std::void_t<decltype(std::declval<M const&>().applies_to(std::declval<route const&>()))>>
+    : std::true_type {};
+
+template <typename M, typename... Ms>
+constexpr std::size_t index_of() noexcept
+{
+    std::size_t index = 0;
+    ((std::is_same_v<M, Ms> ? false : (++index, true)) && ...);
+    return index;
+}
+
+}
+
+/// Chain of middlewares fixed at compile time, for example
+///
+///     auto chain = std::make_shared<http::pipeline<http::cors_middleware, http::auth_middleware, http::routing_middleware>>();
+///     chain->get<http::routing_middleware>().add_router(...);
+///     server->add_middleware(chain);
+///
+/// The server makes one virtual call for the whole chain, the middlewares
+/// are called through their type and can be inlined.
+/// With a routing_middleware in the chain the route is resolved once, before
+/// the first middleware, and only the middlewares that apply to it run. They
+/// read the route from http_request::match(). The
+/// set of each route is computed by prepare(), when the server starts. A
+/// request without a route runs the whole chain.
+template <typename... Middlewares>
+class pipeline final : public middleware
+{
+    static_assert(sizeof...(Middlewares) > 0, "A pipeline has at least one middleware");
+    static_assert(sizeof...(Middlewares) <= 64, "route::middleware_mask has a bit per middleware");
+
+    static constexpr std::size_t router_index = detail::index_of<routing_middleware, Middlewares...>();
+    static constexpr bool has_router = router_index < sizeof...(Middlewares);
+
+    std::tuple<Middlewares...> middlewares_;
+public:
+    pipeline() = default;
+
+    pipeline(pipeline const&) = delete;
+    pipeline& operator=(pipeline const&) = delete;
+
+    template <typename M>
+    M& get() noexcept { return std::get<M>(middlewares_); }
+
+    template <typename M>
+    M const& get() const noexcept { return std::get<M>(middlewares_); }
+
+    bool execute(http_request const& request, http_response& response) override
+    {
+        // Usually resolved by the server, through resolve()
+        route_match resolved;
+        auto match = request.match();
+        if (match == nullptr)
+        {
+            if constexpr (has_router)
+                resolve(request, resolved);
+
+            match = &resolved;
+        }
+
+        auto const mask = match->route ? match->route->middleware_mask() : ~std::uint64_t(0);
+
+        return execute(request, response, mask, match->route, match->values, std::index_sequence_for<Middlewares...>());
+    }
+
+    bool resolve(http_request const& request, route_match& match) const override
+    {
+        if constexpr (has_router)
+            return std::get<router_index>(middlewares_).resolve(request, match);
+        else
+            return false;
+    }
+
+    std::shared_ptr<body_reader> accept_body(http_request const& request) override
+    {
+        // The first middleware that streams the body wins
+        std::shared_ptr<body_reader> reader;
+        std::apply([&](auto&... m)
+        {
+            ((reader = m.accept_body(request)) || ...);
+        }, middlewares_);
+
+        return reader;
+    }
+
+    bool accept_head(http_request const& request, http_response& response) override
+    {
+        return std::apply([&](auto&... m)
+        {
+            return (m.accept_head(request, response) && ...);
+        }, middlewares_);
+    }
+
+    void prepare() override
+    {
+        std::apply([](auto&... m) { (m.prepare(), ...); }, middlewares_);
+
+        if constexpr (has_router)
+        {
+            std::get<router_index>(middlewares_).routes().for_each([this](route& r)
+            {
+                r.middleware_mask(mask_of(r, std::index_sequence_for<Middlewares...>()));
+            });
+        }
+    }
+
+private:
+    template <std::size_t... I>
+    bool execute(http_request const& request, http_response& response, std::uint64_t mask,
+                 route* r, path_values const& values, std::index_sequence<I...>)
+    {
+        bool next = true;
+        ((next = (mask & (std::uint64_t(1) << I)) == 0 || step<I>(request, response, r, values)) && ...);
+        return next;
+    }
+
+    template <std::size_t I>
+    bool step(http_request const& request, http_response& response, route* r, path_values const& values)
+    {
+        using M = std::tuple_element_t<I, std::tuple<Middlewares...>>;
+        auto& m = std::get<I>(middlewares_);
+
+        // The route is already resolved
+        if constexpr (I == router_index)
+            return m.dispatch(r, values, request, response);
+        else
+            return m.M::execute(request, response);
+    }
+
+    template <std::size_t... I>
+    std::uint64_t mask_of(route const& r, std::index_sequence<I...>) const
+    {
+        std::uint64_t mask = 0;
+        ((mask |= applies_to<I>(r) ? std::uint64_t(1) << I : 0), ...);
+        return mask;
+    }
+
+    template <std::size_t I>
+    bool applies_to(route const& r) const
+    {
+        using M = std::tuple_element_t<I, std::tuple<Middlewares...>>;
+
+        if constexpr (detail::has_applies_to<M>::value)
+            return std::get<I>(middlewares_).applies_to(r);
+        else
+            return true;
+    }
+};
+
+}}}
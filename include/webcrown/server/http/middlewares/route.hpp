@@ -3,9 +3,16 @@
 #include "webcrown/server/http/http_method.hpp"
 #include "webcrown/server/http/http_request.hpp"
 #include "webcrown/server/http/http_response.hpp"
+#include "webcrown/server/http/body_reader.hpp"
 #include "webcrown/common/string/string_common.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <cassert>
 #include <utility>
@@ -18,28 +25,83 @@ namespace webcrown {
 namespace server {
 namespace http {
 
+enum auth_authorization_level
+{
+    none,
+    guest,
+    owner,
+    admin
+};
+
+/// Path parameter of a route, ":name" in its path, and its value in the target.
+/// Allocator-aware: in a path_parameters_type the strings come from the
+/// memory resource of the vector, the arena of the request.
 struct route_parameters_t
 {
-    std::string name;
-    std::string value;
-    int bind_pos;
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    std::pmr::string name;
+    std::pmr::string value;
+    int bind_pos{0};
+
+    route_parameters_t() = default;
+
+    explicit route_parameters_t(allocator_type alloc)
+        : name(alloc)
+        , value(alloc)
+    {}
+
+    route_parameters_t(route_parameters_t const& other, allocator_type alloc = {})
+        : name(other.name, alloc)
+        , value(other.value, alloc)
+        , bind_pos(other.bind_pos)
+    {}
+
+    route_parameters_t(route_parameters_t&& other) = default;
+
+    route_parameters_t(route_parameters_t&& other, allocator_type alloc)
+        : name(std::move(other.name), alloc)
+        , value(std::move(other.value), alloc)
+        , bind_pos(other.bind_pos)
+    {}
+
+    route_parameters_t& operator=(route_parameters_t const&) = default;
+    route_parameters_t& operator=(route_parameters_t&&) = default;
 };
 
-using path_parameters_type = std::vector<route_parameters_t>;
+using path_parameters_type = std::pmr::vector<route_parameters_t>;
+
+/// Path parameters of a route
+constexpr std::size_t max_path_parameters = 16;
+
+/// Values of the path parameters of a matched target, in the order of the
+/// route path. They view the target of the request.
+struct path_values
+{
+    std::array<std::string_view, max_path_parameters> values;
+    std::size_t size{0};
+};
 
 // https://tools.ietf.org/html/rfc3986
-class route
+class route : public std::enable_shared_from_this<route>
 {
     using route_callback =
         std::function<void(http_request const &request, http_response &response, path_parameters_type const& path_parameters, http_context const& context)>;
 
-    // TODO: Parse at compile time ?
+    using values_callback =
+        std::function<void(http_request const& request, http_response& response, path_values const& values)>;
+
+    using reader_factory = std::function<std::shared_ptr<body_reader>(http_request const& request)>;
+
     std::string path_;
-    std::string uri_target_;
     http_method method_;
     path_parameters_type path_parameters_;
     route_callback cb_;
-    http_context _http_context;
+    values_callback values_cb_;
+    reader_factory body_reader_factory_;
+    std::uint64_t middleware_mask_{~std::uint64_t(0)};
+    std::optional<auth_authorization_level> authorization_;
+    bool cors_{true};
 public:
     explicit route(http_method method, std::string_view path, route_callback cb)
         : path_(path)
@@ -56,251 +118,208 @@ public:
         parse();
     }
 
-    [[nodiscard]] std::string uri_target() const noexcept { return uri_target_; }
+    [[nodiscard]] std::string const& path() const noexcept { return path_; }
+
+    /// Matches the path of the target like route_tree::find, the query is
+    /// ignored. The values of the path parameters view the target.
+    bool match(std::string_view target, http_method method, path_values& values) const;
+
+    /// Same, the path parameters and their values are appended to
+    /// parameters, allocated from its memory resource
+    bool match(std::string_view target, http_method method, path_parameters_type& parameters) const;
+
+    bool is_match_with_target_request(std::string_view target, http_method method) const;
 
-    bool is_match_with_target_request(std::string_view target, http_method method);
+    /// Whether a target can match both routes: same method and same
+    /// segments, a parameter matches any non-empty segment
+    bool overlaps(route const& other) const noexcept;
 
     http_method method() const noexcept { return method_; }
 
-    [[nodiscard]] path_parameters_type path_parameters() const noexcept { return path_parameters_; }
+    /// Path parameters declared by the route, without values
+    [[nodiscard]] path_parameters_type const& path_parameters() const noexcept { return path_parameters_; }
 
-    [[nodiscard]] route_callback callback() const { return cb_; }
+    [[nodiscard]] route_callback const& callback() const noexcept { return cb_; }
 
     void callback(route_callback cb) { cb_ = cb; }
 
-    // TODO: the caller can modify, fix me
-    http_context& context() { return _http_context; }
+    /// Callback of the typed routes, see make_route. It receives the values
+    /// of the path parameters as they are in the target and is called
+    /// instead of callback() when it is set.
+    [[nodiscard]] values_callback const& typed_callback() const noexcept { return values_cb_; }
+
+    void typed_callback(values_callback cb) { values_cb_ = std::move(cb); }
+
+    /// Appends the path parameters of the route and their values to
+    /// parameters, allocated from its memory resource
+    void bind(path_values const& values, path_parameters_type& parameters) const;
+
+    /// Opts the route into streamed bodies: the factory creates the reader of
+    /// every request, the callback finds it in http_request::reader()
+    void stream_body(reader_factory factory) { body_reader_factory_ = std::move(factory); }
+
+    [[nodiscard]] reader_factory const& body_reader_factory() const noexcept { return body_reader_factory_; }
+
+    /// Middlewares of a static pipeline that run for the route, bit i for
+    /// the i-th middleware. Set by pipeline::prepare, all by default.
+    [[nodiscard]] std::uint64_t middleware_mask() const noexcept { return middleware_mask_; }
+
+    void middleware_mask(std::uint64_t mask) noexcept { middleware_mask_ = mask; }
+
+    /// Level the auth middleware checks, empty when the route is public.
+    /// Set by auth_middleware::authorize_route.
+    [[nodiscard]] std::optional<auth_authorization_level> authorization() const noexcept { return authorization_; }
+
+    void authorization(auth_authorization_level level) noexcept { authorization_ = level; }
+
+    /// Whether the CORS middleware answers cross-origin requests of the route
+    [[nodiscard]] bool cors() const noexcept { return cors_; }
+
+    void cors(bool enabled) noexcept { cors_ = enabled; }
 private:
     void parse();
-    std::string extract_next_bind_key(std::string::const_iterator& it, std::string::const_iterator& last);
+};
 
-    template <typename T>
-    T build_var(std::string v)
-    { return (T)v; }
+/// Route resolved for a request and the values of its path parameters
+struct route_match
+{
+    http::route* route{nullptr};
+    path_values values;
 };
 
 inline
-bool
-route::is_match_with_target_request(std::string_view target, http_method method)
+void
+route::bind(path_values const& values, path_parameters_type& parameters) const
 {
-    auto full_path_binded = path_;
+    auto const count = std::min(values.size, path_parameters_.size());
 
-    if(!common::string_utils::starts_with(target, "/"))
-    {
-        // Error
-        return false;
-    }
+    parameters.reserve(parameters.size() + count);
+    for (std::size_t i = 0; i < count; ++i)
+        parameters.emplace_back(path_parameters_[i]).value.assign(values.values[i]);
+}
 
-    if (target.empty())
-    {
-        // Error
-        return false;
-    }
+inline
+bool
+route::is_match_with_target_request(std::string_view target, http_method method) const
+{
+    path_values values;
+    return match(target, method, values);
+}
 
+inline
+bool
+route::match(std::string_view target, http_method method, path_values& values) const
+{
     if (method != method_)
-    {
         return false;
-    }
 
-    auto begin = target.cbegin();
-    auto end = target.cend();
-    auto it = begin;
+    // The walk of route_tree for a single route: the static bytes up to the
+    // next "/:" are compared, a parameter takes the segment up to the next '/'
+    auto path = target.substr(0, target.find('?'));
+    std::string_view pattern = path_;
+    std::size_t count = 0;
 
-    auto full_target = std::string(begin, end);
-    if (full_target == uri_target_)
+    while (!pattern.empty())
     {
-        // we don't have any binding value next, so return
-        return true;
-    }
-
-    // Ok, not equal.
-    // Maybe is a binding uri ?
-    // To check if it is a binding, we need find slash by the begin
-    bool match_binding_target{false};
-    for(; it < end; ++it)
-    {
-        // Found slash, check if match if the uri_target from the route
-        if (*it == '/')
-        {
-            auto real_target = std::string(begin, it++);
-            if (real_target == uri_target_)
-            {
-                match_binding_target = true;
-                break;
-            }
-        }
-    }
+        auto const colon = pattern.find("/:");
+        auto const fixed = pattern.substr(0, colon == std::string_view::npos ? colon : colon + 1);
+        if (path.substr(0, fixed.size()) != fixed)
+            return false;
 
-    if (!match_binding_target)
-    {
-        // Not ? So this will be a 404 response
-        return false;
-    }
+        path.remove_prefix(fixed.size());
+        pattern.remove_prefix(fixed.size());
+        if (colon == std::string_view::npos)
+            break;
 
-    // Ok, the request is the our route
-    // Now, we will parse the parameters
+        pattern.remove_prefix(std::min(pattern.find('/'), pattern.size()));
 
-    // TODO: adjust to catch the query parameters with ?
+        auto const value = path.substr(0, path.find('/'));
+        if (value.empty())
+            return false;
 
-    auto find_next_path_parameter_value = [](const char*& first, const char* last) -> std::optional<std::string>
-    {
-        auto begin_on_current_buffer = first;
-        auto& current_it = first;
-        // find the end slash delimiter, that indicates end of the path parameter value
-        for(; current_it < last; ++current_it)
-        {
-            // Have a next path parameter value ? If yes, we already have our parameter value
-            if (*current_it == '/')
-            {
-                return std::string(begin_on_current_buffer, current_it);
-            }
-        }
-
-        // Ok, we have only one parameter value
-        return std::string(begin_on_current_buffer, current_it);
-    };
-
-    // Expected path parameters
-    for(auto first = path_parameters_.begin(); first < path_parameters_.end(); ++first)
-    {
-        auto path_parameter_value = find_next_path_parameter_value(it, end);
-        if (path_parameter_value)
-        {
-            first->value.swap(*path_parameter_value);   
-
-            // TODO: Corner case
-            // When the route has ambiguous parameter string, it will fail, example:
-            // This route contains ":user" in "users" /admin/users/edit/:user
-            // Another case "/admin/models/:model_name", index_model_admin_detail
-            // "/admin/models/:model_name/:model_item_id", get_model_item_admin));
-            // "/admin/models/:model_name_p/add", index_admin_model_add));
-            auto key_pos = full_path_binded.find(first->name);
-            if(key_pos != std::string::npos)
-            {
-                full_path_binded = full_path_binded.replace(key_pos - 1, first->name.length() + 1, first->value);
-            }
-        }
-
-        // End of the uri or separator to a next value, we need eat it, because will break the lambda above
-        if(*it == '/')
-        {
-            ++it;
-        }
-    }
-
-    if(target != full_path_binded)
-    {
-        return false;
+        values.values[count++] = value;
+        path.remove_prefix(value.size());
     }
 
-    return true;
+    values.size = count;
+    return path.empty();
 }
 
 inline
-void
-route::parse()
+bool
+route::overlaps(route const& other) const noexcept
 {
-    // E melhor deixar para o dev converter os parametros no tipo, todos os parametros vao ser string
+    if (method_ != other.method_)
+        return false;
 
-    if (!common::string_utils::starts_with(path_, "/"))
-    {
-        // TODO: MOVE TO COMPILATION TIME ERROR
-        throw std::runtime_error("Route not started with slash '/'");
-    }
+    auto const is_parameter = [](std::string_view segment) { return !segment.empty() && segment[0] == ':'; };
 
-    if (path_.empty())
+    std::string_view a = path_;
+    std::string_view b = other.path_;
+    while (!a.empty() && !b.empty())
     {
-        // TODO: MOVE TO COMPILATION TIME ERROR
-        throw std::runtime_error("Route is empty");
-    }
-
-    auto begin = path_.cbegin();
-    auto end = path_.cend();
-    auto it = begin;
+        // Both paths start with '/'
+        a.remove_prefix(1);
+        b.remove_prefix(1);
 
-    // OK, we have an assert if the path doest not starts with '/',
-    // so we can assume that it+1 will skip the first slash
-    it++; // eat the '/'
+        auto const sa = a.substr(0, a.find('/'));
+        auto const sb = b.substr(0, b.find('/'));
+        if (is_parameter(sa) ? sb.empty() : is_parameter(sb) ? sa.empty() : sa != sb)
+            return false;
 
-    // find last occurence of the '/'
-    for(; it < end; ++it)
-    {
-        // Find occurence
-        if (*it == '/')
-        {
-            // Is the last ?
-            if (*(it + 1) == ':')
-            {
-                uri_target_ = std::string(begin, it++);
-                break;
-            }
-        }
+        a.remove_prefix(sa.size());
+        b.remove_prefix(sb.size());
     }
 
-    // Ok, we have no path parameter bind
-    if (uri_target_.empty())
-    {
-        uri_target_ = std::string(begin, it);
-        return;
-    }
+    return a.empty() && b.empty();
+}
 
-    // try find bind values
-    for(; it < end; ++it)
-    {
-        if (*it == ':')
-        {
-            route_parameters_t params;
-            params.bind_pos = it - begin;
-            auto key = extract_next_bind_key(it, end);
-            params.name = key;
-
-            path_parameters_.push_back(params);
-        }
-    }
+inline
+bool
+route::match(std::string_view target, http_method method, path_parameters_type& parameters) const
+{
+    path_values values;
+    if (!match(target, method, values))
+        return false;
 
+    bind(values, parameters);
+    return true;
 }
 
 inline
-std::string
-route::extract_next_bind_key(std::string::const_iterator& it, std::string::const_iterator& last)
+void
+route::parse()
 {
-    std::string result{};
-
-    // eat the :
-    auto const begin = ++it;
+    // E melhor deixar para o dev converter os parametros no tipo, todos os parametros vao ser string
 
-    for(; it < last; ++it)
+    if (path_.empty())
     {
-        // Have a next key ?
-        if (*it == '/' && *(it + 1) == ':')
-        {
-            result = std::string(begin, it);
-            return result;
-        }
+        // make_route checks the path at compile time
+        throw std::runtime_error("Route is empty");
     }
 
-    // Have an '/' at end ?
-    if (*(last -1) == '/')
+    if (!common::string_utils::starts_with(path_, "/"))
     {
-        result = std::string(begin, last-1);
-        return result;
+        throw std::runtime_error("Route not started with slash '/'");
     }
 
-    // if is not any option above, so is simple an /:bindvalue/something
-    it = begin;
-    for(; it < last; ++it)
+    // Every segment starting with ':' is a parameter, up to the next slash
+    for (auto pos = path_.find("/:"); pos != std::string::npos; pos = path_.find("/:", pos))
     {
-        if (*it == '/')
-        {
-            result = std::string(begin, it);
-            return result;
-        }
-    }
+        auto const name_begin = pos + 2;
+        auto const name_end = std::min(path_.find('/', name_begin), path_.size());
+        if (name_end == name_begin)
+            throw std::runtime_error("Route has a parameter without name");
+
+        if (path_parameters_.size() == max_path_parameters)
+            throw std::runtime_error("Route has too many parameters");
 
-    // Ok, no has a next key
-    result = std::string(begin, last);
+        auto& parameter = path_parameters_.emplace_back();
+        parameter.bind_pos = static_cast<int>(pos + 1);
+        parameter.name = path_.substr(name_begin, name_end - name_begin);
 
-    return result;
+        pos = name_end;
+    }
 }
 
 } // namespace http
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "webcrown/server/http/http_method.hpp"
+#include "webcrown/server/http/middlewares/route.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+/// Compressed radix tree of the routes, one per method.
+/// Static bytes are shared by the routes as edge prefixes, a ":name" segment
+/// is a parameter child that captures up to the next '/'. A lookup walks the
+/// target once, trying the static child before the parameter one and going
+/// back only when the static branch does not lead to a route.
+/// The tree is built before the server starts and is read-only afterwards,
+/// the lookups of the io threads share it without locking.
+class route_tree
+{
+    struct node
+    {
+        // Static bytes of the edge leading to the node
+        std::string prefix;
+        // First byte of the prefix of each static child
+        std::string indices;
+        std::vector<std::unique_ptr<node>> children;
+        // ":name" segment, the name is kept by the routes
+        std::unique_ptr<node> parameter;
+
+        // Route ending at the node
+        std::shared_ptr<http::route> route;
+    };
+
+    std::vector<std::pair<http_method, std::unique_ptr<node>>> roots_;
+public:
+    route_tree() = default;
+
+    route_tree(route_tree const&) = delete;
+    route_tree& operator=(route_tree const&) = delete;
+
+    /// Adds a route, throws when its path is invalid or already registered
+    /// for its method
+    void insert(std::shared_ptr<http::route> r);
+
+    /// Route matching the path of the target, the query is ignored
+    http::route* find(http_method method, std::string_view target) const;
+
+    /// Same, and gives the values of the path parameters of the route
+    http::route* find(http_method method, std::string_view target, path_values& values) const;
+
+    /// Same, and appends the path parameters of the route and their values
+    /// to parameters, allocated from its memory resource
+    http::route* find(http_method method, std::string_view target, path_parameters_type& parameters) const;
+
+    /// Calls fn with every route
+    template <typename Fn>
+    void for_each(Fn&& fn) const;
+
+private:
+    template <typename Fn>
+    static void for_each(node const& n, Fn& fn);
+
+    node const* root(http_method method) const noexcept;
+
+    static node* insert_static(node* n, std::string_view bytes);
+
+    static node const* match(node const* n, std::string_view path, path_values& values, std::size_t count);
+};
+
+inline
+void
+route_tree::insert(std::shared_ptr<http::route> r)
+{
+    std::string_view path = r->path();
+    if (path.empty() || path.front() != '/')
+        throw std::runtime_error("Route not started with slash '/'");
+
+    node* n = nullptr;
+    for (auto& [method, root] : roots_)
+    {
+        if (method == r->method())
+            n = root.get();
+    }
+
+    if (n == nullptr)
+        n = roots_.emplace_back(r->method(), std::make_unique<node>()).second.get();
+
+    // The parameters were checked by the route
+    while (!path.empty())
+    {
+        // Static bytes up to the next "/:", the slash included
+        auto colon = path.find("/:");
+        n = insert_static(n, path.substr(0, colon == std::string_view::npos ? colon : colon + 1));
+        if (colon == std::string_view::npos)
+            break;
+
+        path.remove_prefix(colon + 2);
+        path.remove_prefix(std::min(path.find('/'), path.size()));
+
+        if (!n->parameter)
+            n->parameter = std::make_unique<node>();
+
+        n = n->parameter.get();
+    }
+
+    if (n->route)
+        throw std::runtime_error("Route already registered");
+
+    n->route = std::move(r);
+}
+
+template <typename Fn>
+void
+route_tree::for_each(Fn&& fn) const
+{
+    for (auto const& [method, root] : roots_)
+        for_each(*root, fn);
+}
+
+template <typename Fn>
+void
+route_tree::for_each(node const& n, Fn& fn)
+{
+    if (n.route)
+        fn(*n.route);
+
+    for (auto const& child : n.children)
+        for_each(*child, fn);
+
+    if (n.parameter)
+        for_each(*n.parameter, fn);
+}
+
+inline
+route_tree::node*
+route_tree::insert_static(node* n, std::string_view bytes)
+{
+    while (!bytes.empty())
+    {
+        auto const index = n->indices.find(bytes.front());
+        if (index == std::string::npos)
+        {
+            auto& child = n->children.emplace_back(std::make_unique<node>());
+            child->prefix = bytes;
+            n->indices.push_back(bytes.front());
+            return child.get();
+        }
+
+        auto& child = n->children[index];
+        auto const& prefix = child->prefix;
+
+        std::size_t common = 0;
+        while (common < prefix.size() && common < bytes.size() && prefix[common] == bytes[common])
+            ++common;
+
+        if (common < prefix.size())
+        {
+            // Split the edge, the common bytes become a node of their own
+            auto split = std::make_unique<node>();
+            split->prefix = prefix.substr(0, common);
+            child->prefix.erase(0, common);
+            split->indices.push_back(child->prefix.front());
+            split->children.push_back(std::move(child));
+            child = std::move(split);
+        }
+
+        n = child.get();
+        bytes.remove_prefix(common);
+    }
+
+    return n;
+}
+
+inline
+route_tree::node const*
+route_tree::root(http_method method) const noexcept
+{
+    for (auto const& [m, root] : roots_)
+    {
+        if (m == method)
+            return root.get();
+    }
+
+    return nullptr;
+}
+
+inline
+route_tree::node const*
+route_tree::match(node const* n, std::string_view path, path_values& values, std::size_t count)
+{
+    if (path.empty())
+    {
+        values.size = count;
+        return n->route ? n : nullptr;
+    }
+
+    auto const index = n->indices.find(path.front());
+    if (index != std::string::npos)
+    {
+        auto const& child = n->children[index];
+        if (path.compare(0, child->prefix.size(), child->prefix) == 0)
+        {
+            if (auto found = match(child.get(), path.substr(child->prefix.size()), values, count))
+                return found;
+        }
+    }
+
+    if (n->parameter)
+    {
+        auto const value = path.substr(0, path.find('/'));
+        if (!value.empty())
+        {
+            values.values[count] = value;
+            return match(n->parameter.get(), path.substr(value.size()), values, count + 1);
+        }
+    }
+
+    return nullptr;
+}
+
+inline
+http::route*
+route_tree::find(http_method method, std::string_view target) const
+{
+    path_values values;
+    return find(method, target, values);
+}
+
+inline
+http::route*
+route_tree::find(http_method method, std::string_view target, path_values& values) const
+{
+    auto const r = root(method);
+    if (r == nullptr)
+        return nullptr;
+
+    auto const found = match(r, target.substr(0, target.find('?')), values, 0);
+    return found ? found->route.get() : nullptr;
+}
+
+inline
+http::route*
+route_tree::find(http_method method, std::string_view target, path_parameters_type& parameters) const
+{
+    path_values values;
+    auto const r = find(method, target, values);
+    if (r != nullptr)
+        r->bind(values, parameters);
+
+    return r;
+}
+
+}}}
@@ -1,8 +1,8 @@
 #pragma once
 #include "webcrown/server/http/middlewares/http_middleware.hpp"
 #include "webcrown/server/http/middlewares/route.hpp"
+#include "webcrown/server/http/middlewares/route_tree.hpp"
 #include <functional>
-#include <unordered_map>
 #include <memory>
 
 
@@ -12,7 +12,7 @@ namespace http {
 
 class routing_middleware : public middleware {
 
-    std::vector<std::shared_ptr<route>> routers_;
+    route_tree routes_;
 public:
     explicit routing_middleware()
     {}
@@ -25,42 +25,96 @@ public:
 
     bool execute(http_request const &request, http_response &response) override
     {
-        bool route_found{false};
-	    // find route
-	    for (auto const &r : routers_)
-	    {
-		    if (r->is_match_with_target_request(request.target(), request.method()))
-		    {
-		        auto&& cb = r->callback();
-
-		        try
-                {
-		            cb(request, response, r->path_parameters(), r->context());
-                }
-		        catch(std::exception const& ex)
-                {
-		            response.set_status(http_status::internal_server_error);
-		            break;
-                }
-
-			    route_found = true;
-			    break;
-		  }
-	    }
-	
-	    // if not found
-	    // return http response 404
-	    if (!route_found)
-	    {
-	        response.set_status(http_status::not_found);
-	    }
+        if (auto match = request.match())
+            return dispatch(match->route, match->values, request, response);
 
+        // Outside of the server
+        path_values values;
+        auto r = routes_.find(request.method(), request.target(), values);
+
+        return dispatch(r, values, request, response);
+    }
+
+    bool resolve(http_request const& request, route_match& match) const override
+    {
+        match.route = routes_.find(request.method(), request.target(), match.values);
+        return true;
+    }
+
+    /// Calls the route found for the request, answers 404 Not Found when
+    /// there is none
+    bool dispatch(route* r, path_values const& values, http_request const& request, http_response& response)
+    {
+        // if not found
+        // return http response 404
+        if (r == nullptr)
+        {
+            response.set_status(http_status::not_found);
+            return false;
+        }
+
+        try
+        {
+            if (auto const& typed = r->typed_callback())
+            {
+                typed(request, response, values);
+                return false;
+            }
+
+            // The named values live in the arena of the request
+            path_parameters_type parameters(request.arena());
+            r->bind(values, parameters);
+
+            // Values of the middlewares, empty outside of the server
+            static http_context const no_context{};
+            auto context = request.context();
+
+            r->callback()(request, response, parameters, context ? *context : no_context);
+        }
+        catch(std::exception const& ex)
+        {
+            response.set_status(http_status::internal_server_error);
+        }
+
+        return false;
+    }
+
+    std::shared_ptr<body_reader> accept_body(http_request const& request) override
+    {
+        auto r = route_of(request);
+        if (r == nullptr)
+            return nullptr;
+
+        auto const& factory = r->body_reader_factory();
+        return factory ? factory(request) : nullptr;
+    }
+
+    bool accept_head(http_request const& request, http_response& response) override
+    {
+        if (route_of(request) != nullptr)
+            return true;
+
+        response.set_status(http_status::not_found);
         return false;
     }
 
+    /// Routes are added before the server starts, throws when the path of
+    /// the route is invalid or already registered
     void add_router(std::shared_ptr<route> const route)
     {
-        routers_.push_back(route);
+        routes_.insert(route);
+    }
+
+    route_tree const& routes() const noexcept { return routes_; }
+
+private:
+    /// Route resolved for the request, found again outside of the server
+    route* route_of(http_request const& request) const
+    {
+        if (auto match = request.match())
+            return match->route;
+
+        return routes_.find(request.method(), request.target());
     }
 };
 
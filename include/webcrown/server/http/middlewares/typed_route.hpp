@@ -0,0 +1,180 @@
+#pragma once
+
+#include "webcrown/server/http/http_method.hpp"
+#include "webcrown/server/http/http_request.hpp"
+#include "webcrown/server/http/http_response.hpp"
+#include "webcrown/server/http/middlewares/route.hpp"
+
+#include <charconv>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+/// Path of a route, checked at compile time by make_route: it starts with
+/// '/' and every parameter is a whole ":name" segment, the name made of
+/// letters, digits and '_'
+class route_pattern
+{
+    std::string_view path_;
+public:
+    constexpr explicit route_pattern(std::string_view path) noexcept
+        : path_(path)
+    {}
+
+    constexpr std::string_view path() const noexcept { return path_; }
+
+    constexpr bool valid() const noexcept;
+
+    /// Number of ":name" segments
+    constexpr std::size_t parameters() const noexcept;
+};
+
+constexpr
+bool
+route_pattern::valid() const noexcept
+{
+    if (path_.empty() || path_.front() != '/')
+        return false;
+
+    for (std::size_t i = 0; i < path_.size(); ++i)
+    {
+        if (path_[i] != ':')
+            continue;
+
+        if (path_[i - 1] != '/')
+            return false;
+
+        auto const name = i + 1;
+        while (++i < path_.size() && path_[i] != '/')
+        {
+            auto const c = path_[i];
+            if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'))
+                return false;
+        }
+
+        if (i == name)
+            return false;
+    }
+
+    return parameters() <= max_path_parameters;
+}
+
+constexpr
+std::size_t
+route_pattern::parameters() const noexcept
+{
+    std::size_t count = 0;
+    for (std::size_t i = 1; i < path_.size(); ++i)
+    {
+        if (path_[i] == ':' && path_[i - 1] == '/')
+            ++count;
+    }
+
+    return count;
+}
+
+namespace detail {
+
+/// Arguments of a function, a function pointer or a lambda
+template <typename F>
+struct handler_traits : handler_traits<decltype(&F::operator())> {};
+
+template <typename R, typename... Args>
+struct handler_traits<R(Args...)>
+{
+    using arguments = std::tuple<Args...>;
+};
+
+template <typename R, typename... Args>
+struct handler_traits<R(*)(Args...)> : handler_traits<R(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct handler_traits<R(C::*)(Args...)> : handler_traits<R(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct handler_traits<R(C::*)(Args...) const> : handler_traits<R(Args...)> {};
+
+/// Converts the value of a path parameter, false when it is not a T
+template <typename T>
+bool parse_path_value(std::string_view value, T& result)
+{
+    if constexpr (std::is_same_v<T, std::string_view>)
+    {
+        result = value;
+        return true;
+    }
+    else if constexpr (std::is_same_v<T, std::string>)
+    {
+        result.assign(value);
+        return true;
+    }
+    else
+    {
+        static_assert(std::is_integral_v<T> && !std::is_same_v<T, bool>,
+            "A path parameter is an integer, a std::string_view or a std::string");
+
+        auto const last = value.data() + value.size();
+        auto const [end, ec] = std::from_chars(value.data(), last, result);
+        return ec == std::errc() && end == last;
+    }
+}
+
+template <typename Arguments, typename Handler, std::size_t... I>
+auto typed_callback(Handler handler, std::index_sequence<I...>)
+{
+    return [handler = std::move(handler)](http_request const& request, http_response& response, path_values const& values) mutable
+    {
+        // The request and the response come first
+        std::tuple<std::decay_t<std::tuple_element_t<I + 2, Arguments>>...> parsed;
+
+        if (!(parse_path_value(values.values[I], std::get<I>(parsed)) && ...))
+        {
+            response.set_status(http_status::not_found);
+            return;
+        }
+
+        handler(request, response, std::move(std::get<I>(parsed))...);
+    };
+}
+
+}
+
+/// Route whose handler takes the path parameters as arguments, in the
+/// order of the path:
+///
+///     static constexpr char user_order[] = "/users/:id/orders/:oid";
+///
+///     router->add_router(http::make_route<user_order>(http::http_method::get,
+///         [](http_request const& request, http_response& response, std::int64_t id, std::int64_t oid) { ... }));
+///
+/// The path and the number of arguments are checked at compile time.
+/// Integers are parsed from the target with std::from_chars, a
+/// std::string_view views it. A value that does not parse answers
+/// 404 Not Found, the handler is not called.
+template <char const* Path, typename Handler>
+std::shared_ptr<route>
+make_route(http_method method, Handler handler)
+{
+    constexpr route_pattern pattern{Path};
+    static_assert(pattern.valid(), "Route path must start with '/' and name each ':parameter' segment");
+
+    using arguments = typename detail::handler_traits<Handler>::arguments;
+    static_assert(std::tuple_size_v<arguments> == pattern.parameters() + 2,
+        "Route handler takes the request, the response and one argument per path parameter");
+
+    auto r = std::make_shared<route>(method, pattern.path());
+    r->typed_callback(detail::typed_callback<arguments>(std::move(handler), std::make_index_sequence<pattern.parameters()>()));
+
+    return r;
+}
+
+}}}
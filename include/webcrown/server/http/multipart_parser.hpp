@@ -0,0 +1,435 @@
+#pragma once
+
+#include "webcrown/server/http/error.hpp"
+#include "webcrown/server/http/http_request.hpp"
+#include "webcrown/server/http/detail/simd_scan.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+// multipart/form-data body (RFC 7578, RFC 2046 5.1)
+//  multipart-body = [preamble CRLF]
+//                   dash-boundary CRLF body-part
+//                   *( CRLF dash-boundary CRLF body-part )
+//                   CRLF dash-boundary "--" [CRLF epilogue]
+//  body-part      = *( header CRLF ) CRLF *OCTET
+
+/// Receives the parts of a multipart body while it is parsed
+class multipart_handler
+{
+public:
+    virtual ~multipart_handler() = default;
+
+    /// A part starts, its headers are only valid during the call
+    virtual void on_part_begin(http_headers const& headers) = 0;
+
+    /// A piece of the payload of the current part. A slice of the data given
+    /// to multipart_parser::parse, except for the few bytes held back at the
+    /// end of a call because they may start a delimiter.
+    virtual void on_part_data(std::string_view data) = 0;
+
+    /// The delimiter that ends the current part was found
+    virtual void on_part_end() {}
+};
+
+/// Incremental multipart parser: the body may be fed in any number of
+/// pieces. Payloads are never copied, delimiters are found with
+/// detail::pattern_searcher.
+class multipart_parser
+{
+    enum class state : std::uint8_t
+    {
+        preamble,
+        delimiter_end,
+        headers,
+        data,
+        epilogue
+    };
+
+    state state_;
+    // Trailing bytes of the delimiter line, '-' or CR once the first is seen
+    char delimiter_end_;
+    // CRLF "--" boundary
+    detail::pattern_searcher delimiter_;
+    // End of the previous piece that may be the start of a delimiter
+    std::string carry_;
+    // Part headers split between two pieces
+    std::string head_;
+    http_headers headers_;
+public:
+    /// Longest boundary, RFC 2046
+    static constexpr std::size_t max_boundary = 70;
+
+    /// Largest header block of a part
+    static constexpr std::size_t header_limit = 8192;
+
+    multipart_parser()
+        : state_(state::preamble)
+        , delimiter_end_(0)
+    {}
+
+    /// Starts a new body delimited by boundary
+    void reset(std::string_view boundary);
+
+    /// Parses the next piece of the body, every byte is consumed
+    void parse(std::string_view data, multipart_handler& handler, std::error_code& ec);
+
+    /// The close delimiter was found
+    bool finished() const noexcept { return state_ == state::epilogue; }
+
+    /// boundary parameter of a multipart Content-Type, empty when missing or invalid
+    static std::string_view boundary_parameter(std::string_view content_type) noexcept;
+
+    /// Parameter of a Content-Disposition value, like name or filename, unquoted
+    static std::string_view disposition_parameter(std::string_view disposition, std::string_view name) noexcept;
+
+private:
+    void parse_delimited(char const*& it, char const* last, multipart_handler& handler);
+
+    void parse_delimiter_end(char const*& it, char const* last, std::error_code& ec);
+
+    void parse_headers(char const*& it, char const* last, multipart_handler& handler, std::error_code& ec);
+
+    /// The header lines of a part, block ends with the CRLF of its last line
+    void parse_header_block(std::string_view block, std::error_code& ec);
+
+    void delimiter_found(multipart_handler& handler);
+};
+
+namespace detail {
+
+constexpr bool is_ows(char c) noexcept { return c == ' ' || c == '\t'; }
+
+constexpr std::string_view trim_ows(std::string_view v) noexcept
+{
+    while (!v.empty() && is_ows(v.front()))
+        v.remove_prefix(1);
+    while (!v.empty() && is_ows(v.back()))
+        v.remove_suffix(1);
+
+    return v;
+}
+
+/// Value of the parameter name in "type; a=1; b=\"2\"", unquoted
+inline
+std::string_view header_parameter(std::string_view value, std::string_view name) noexcept
+{
+    for (auto pos = value.find(';'); pos != std::string_view::npos;)
+    {
+        auto next = value.find(';', pos + 1);
+        auto parameter = trim_ows(value.substr(pos + 1, next == std::string_view::npos ? std::string_view::npos : next - pos - 1));
+        pos = next;
+
+        auto equal = parameter.find('=');
+        if (equal == std::string_view::npos ||
+            !common::string_utils::iequals(trim_ows(parameter.substr(0, equal)), name))
+            continue;
+
+        auto result = trim_ows(parameter.substr(equal + 1));
+        if (result.size() >= 2 && result.front() == '"')
+        {
+            // A quoted value may contain ';', take it up to its closing quote
+            auto const start = result.data() - value.data() + 1;
+            auto const close = value.find('"', start);
+            if (close == std::string_view::npos)
+                return {};
+
+            return value.substr(start, close - start);
+        }
+
+        return result;
+    }
+
+    return {};
+}
+
+}
+
+inline
+void
+multipart_parser::reset(std::string_view boundary)
+{
+    state_ = state::preamble;
+    delimiter_end_ = 0;
+
+    std::string delimiter("\r\n--");
+    delimiter.append(boundary);
+    delimiter_.assign(delimiter);
+
+    // The first delimiter has no CRLF before it when there is no preamble,
+    // start as if the body followed one
+    carry_.assign("\r\n");
+    head_.clear();
+    headers_.clear();
+}
+
+inline
+std::string_view
+multipart_parser::boundary_parameter(std::string_view content_type) noexcept
+{
+    auto boundary = detail::header_parameter(content_type, "boundary");
+    if (boundary.size() > max_boundary || (!boundary.empty() && boundary.back() == ' '))
+        return {};
+
+    return boundary;
+}
+
+inline
+std::string_view
+multipart_parser::disposition_parameter(std::string_view disposition, std::string_view name) noexcept
+{
+    return detail::header_parameter(disposition, name);
+}
+
+inline
+void
+multipart_parser::parse(std::string_view data, multipart_handler& handler, std::error_code& ec)
+{
+    // reset was not called with a boundary
+    if (delimiter_.size() == 0)
+    {
+        ec = make_error(http_error::bad_multipart);
+        return;
+    }
+
+    auto it = data.data();
+    auto const last = it + data.size();
+
+    while (it < last && !ec)
+    {
+        switch (state_)
+        {
+            case state::preamble:
+            case state::data:
+                parse_delimited(it, last, handler);
+                break;
+
+            case state::delimiter_end:
+                parse_delimiter_end(it, last, ec);
+                break;
+
+            case state::headers:
+                parse_headers(it, last, handler, ec);
+                break;
+
+            case state::epilogue:
+                // Ignored, like the preamble
+                it = last;
+                break;
+        }
+    }
+}
+
+inline
+void
+multipart_parser::parse_delimited(char const*& it, char const* last, multipart_handler& handler)
+{
+    // The preamble is searched like a payload, its bytes are dropped
+    auto emit = [this, &handler](char const* p, std::size_t n)
+    {
+        if (state_ == state::data && n > 0)
+            handler.on_part_data(std::string_view(p, n));
+    };
+
+    auto const m = delimiter_.size();
+
+    // Bytes that cannot be the start of a delimiter continued by the next
+    // piece: all but the last m - 1, and only from a CR
+    auto held_from = [m](char const* first, char const* end) -> char const*
+    {
+        auto from = end - first > static_cast<std::ptrdiff_t>(m - 1) ? end - (m - 1) : first;
+        auto cr = static_cast<char const*>(std::memchr(from, '\r', static_cast<std::size_t>(end - from)));
+        return cr ? cr : end;
+    };
+
+    if (!carry_.empty())
+    {
+        // A delimiter starting in the carry ends in the first m - 1 new bytes
+        auto const carried = carry_.size();
+        auto const n = std::min(m - 1, static_cast<std::size_t>(last - it));
+        carry_.append(it, n);
+
+        auto const pos = delimiter_.find(carry_);
+        if (pos != std::string_view::npos)
+        {
+            emit(carry_.data(), pos);
+            it += pos + m - carried;
+            carry_.clear();
+            delimiter_found(handler);
+            return;
+        }
+
+        if (n < m - 1)
+        {
+            // Still undecided, the piece was too short
+            it = last;
+            auto const from = held_from(carry_.data(), carry_.data() + carry_.size());
+            emit(carry_.data(), static_cast<std::size_t>(from - carry_.data()));
+            carry_.erase(0, static_cast<std::size_t>(from - carry_.data()));
+            return;
+        }
+
+        carry_.resize(carried);
+        emit(carry_.data(), carried);
+        carry_.clear();
+    }
+
+    auto const found = delimiter_.find(it, last);
+    if (found != last)
+    {
+        emit(it, static_cast<std::size_t>(found - it));
+        it = found + m;
+        delimiter_found(handler);
+        return;
+    }
+
+    auto const from = held_from(it, last);
+    emit(it, static_cast<std::size_t>(from - it));
+    carry_.assign(from, last);
+    it = last;
+}
+
+inline
+void
+multipart_parser::delimiter_found(multipart_handler& handler)
+{
+    if (state_ == state::data)
+        handler.on_part_end();
+
+    state_ = state::delimiter_end;
+    delimiter_end_ = 0;
+}
+
+inline
+void
+multipart_parser::parse_delimiter_end(char const*& it, char const* last, std::error_code& ec)
+{
+    // "--" closes the body, CRLF starts a part, linear white space may come before
+    for (; it < last; ++it)
+    {
+        auto const c = *it;
+
+        if (delimiter_end_ == 0)
+        {
+            if (c == '-' || c == '\r')
+                delimiter_end_ = c;
+            else if (!detail::is_ows(c))
+                break;
+
+            continue;
+        }
+
+        if (delimiter_end_ == '-' && c == '-')
+        {
+            ++it;
+            state_ = state::epilogue;
+            return;
+        }
+
+        if (delimiter_end_ == '\r' && c == '\n')
+        {
+            ++it;
+            state_ = state::headers;
+            return;
+        }
+
+        break;
+    }
+
+    if (it < last)
+        ec = make_error(http_error::bad_multipart);
+}
+
+inline
+void
+multipart_parser::parse_headers(char const*& it, char const* last, multipart_handler& handler, std::error_code& ec)
+{
+    auto const data = std::string_view(it, static_cast<std::size_t>(last - it));
+    std::string_view block;
+    std::size_t used = 0;
+
+    if (head_.empty())
+    {
+        // Usually the whole block is in the piece and is parsed in place
+        auto const end = data.substr(0, 2) == "\r\n" ? 0 : data.find("\r\n\r\n");
+        if (end == std::string_view::npos)
+        {
+            if (data.size() > header_limit)
+            {
+                ec = make_error(http_error::bad_multipart);
+                return;
+            }
+
+            // The CRLF of the delimiter line, an empty block is found the same way
+            head_.assign("\r\n");
+            head_.append(data);
+            it = last;
+            return;
+        }
+
+        block = end == 0 ? std::string_view() : data.substr(0, end + 2);
+        used = end == 0 ? 2 : end + 4;
+    }
+    else
+    {
+        auto const held = head_.size();
+        head_.append(data.substr(0, header_limit + 4 - std::min(held, header_limit + 4)));
+
+        auto const end = head_.find("\r\n\r\n", held > 3 ? held - 3 : 0);
+        if (end == std::string::npos)
+        {
+            if (head_.size() > header_limit)
+            {
+                ec = make_error(http_error::bad_multipart);
+                return;
+            }
+
+            it = last;
+            return;
+        }
+
+        block = std::string_view(head_).substr(2, end);
+        used = end + 4 - held;
+    }
+
+    parse_header_block(block, ec);
+    if (ec)
+        return;
+
+    it += used;
+    state_ = state::data;
+    handler.on_part_begin(headers_);
+    head_.clear();
+}
+
+inline
+void
+multipart_parser::parse_header_block(std::string_view block, std::error_code& ec)
+{
+    headers_.clear();
+
+    while (!block.empty())
+    {
+        auto const eol = block.find("\r\n");
+        auto const line = block.substr(0, eol);
+        block.remove_prefix(eol + 2);
+
+        // Folded lines are obsolete (RFC 7230 3.2.4)
+        auto const colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos || detail::is_ows(line.front()))
+        {
+            ec = make_error(http_error::bad_multipart);
+            return;
+        }
+
+        headers_.add(line.substr(0, colon), detail::trim_ows(line.substr(colon + 1)));
+    }
+}
+
+}}}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+/// Memory of the transient state of one request: response headers, path
+/// parameters, scratch strings of the middlewares. Allocations are bumped
+/// from an inline block, then from chunks of the upstream resource, and
+/// nothing is freed until reset() drops everything at once when the
+/// request completes.
+/// Whatever outlives the request (the queued response, a streamed body
+/// reader) must not come from the arena.
+class request_arena
+{
+public:
+    /// Enough for the state of a typical request without any allocation
+    static constexpr std::size_t inline_size = 8 * 1024;
+
+    request_arena()
+        : resource_(block_.data(), block_.size(), std::pmr::new_delete_resource())
+    {}
+
+    request_arena(request_arena const&) = delete;
+    request_arena& operator=(request_arena const&) = delete;
+
+    std::pmr::memory_resource* resource() noexcept { return &resource_; }
+
+    /// Frees the state of the completed request, the next one starts at the
+    /// beginning of the inline block again
+    void reset() noexcept { resource_.release(); }
+
+private:
+    alignas(std::max_align_t) std::array<std::byte, inline_size> block_;
+    std::pmr::monotonic_buffer_resource resource_;
+};
+
+}}}
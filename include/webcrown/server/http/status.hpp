@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
@@ -44,6 +45,7 @@ enum class http_status : std::uint16_t
     unsupported_media_type = 415,
     requested_range_not_satisfiable = 416,
     expectation_failed = 417,
+    request_header_fields_too_large = 431,
     internal_server_error = 500,
     not_implemented = 501,
     bad_gateway = 502,
@@ -54,9 +56,9 @@ enum class http_status : std::uint16_t
 
 /// Make a http status
 /// \param status - HTTP status code
-/// \return a pair with the status and reason-phrase
+/// \return a pair with the status and reason-phrase, a static string
 inline
-std::pair<std::uint16_t, std::string>
+std::pair<std::uint16_t, std::string_view>
 make_status(http_status status)
 {
     auto&& v = static_cast<std::uint16_t>(status);
@@ -131,6 +133,8 @@ make_status(http_status status)
 	        return std::make_pair(v, "Range Not Satisfiable");
         case http_status::expectation_failed:
 	        return std::make_pair(v, "Expectation Failed");
+        case http_status::request_header_fields_too_large:
+	        return std::make_pair(v, "Request Header Fields Too Large");
         case http_status::internal_server_error:
 	        return std::make_pair(v, "Internal Server Error");
         case http_status::not_implemented:
@@ -0,0 +1,501 @@
+#pragma once
+
+#include "webcrown/server/http/body_reader.hpp"
+#include "webcrown/server/http/http_request.hpp"
+#include "webcrown/server/http/multipart_parser.hpp"
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace webcrown {
+namespace server {
+namespace http {
+
+/// Threads that write the spooled parts, so the I/O threads do not wait
+/// on the disk. The jobs run in any order and on any thread.
+class spool_writer
+{
+    std::mutex lock_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> jobs_;
+    std::vector<std::thread> threads_;
+    bool stopping_{false};
+public:
+    explicit spool_writer(std::size_t threads);
+
+    /// Runs the queued jobs, then joins the threads
+    ~spool_writer();
+
+    spool_writer(spool_writer const&) = delete;
+    spool_writer& operator=(spool_writer const&) = delete;
+
+    void post(std::function<void()> job);
+
+    /// Writer of the spoolers without one of their own
+    static spool_writer& shared();
+
+private:
+    void run();
+};
+
+inline
+spool_writer::spool_writer(std::size_t threads)
+{
+    threads_.reserve(threads);
+    for (std::size_t i = 0; i < threads; ++i)
+        threads_.emplace_back([this] { run(); });
+}
+
+inline
+spool_writer::~spool_writer()
+{
+    {
+        std::scoped_lock locker(lock_);
+        stopping_ = true;
+    }
+
+    ready_.notify_all();
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+inline
+void
+spool_writer::post(std::function<void()> job)
+{
+    {
+        std::scoped_lock locker(lock_);
+        jobs_.push_back(std::move(job));
+    }
+
+    ready_.notify_one();
+}
+
+inline
+spool_writer&
+spool_writer::shared()
+{
+    static spool_writer writer{2};
+    return writer;
+}
+
+inline
+void
+spool_writer::run()
+{
+    for (;;)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock locker(lock_);
+            ready_.wait(locker, [this] { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty())
+                return;
+
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+
+        job();
+    }
+}
+
+struct upload_options
+{
+    /// Parts up to this size stay in memory, larger ones go to a temporary file
+    std::size_t memory_threshold{64 * 1024};
+
+    /// Bytes gathered before each write of a spooled part
+    std::size_t write_buffer{64 * 1024};
+
+    /// Directory of the temporary files, TMPDIR or /tmp when empty
+    std::string directory;
+
+    /// Bytes of a request handed to the writer and not written yet. Past
+    /// them the disk is slower than the network, and the session stops
+    /// reading the connection until the writes catch up.
+    std::size_t write_queue{1024 * 1024};
+
+    /// Threads of the writes, spool_writer::shared() when null. It outlives
+    /// the spoolers.
+    spool_writer* writer{nullptr};
+};
+
+/// Streams a multipart/form-data body to its parts while it arrives.
+/// Small parts are kept in memory, the others are written to temporary
+/// files by the spool_writer threads, a write_buffer at a time. Nothing
+/// waits for the disk: past write_queue bytes in flight the spooler pauses
+/// the body (see body_reader::pause), and a connection holds at most
+/// memory_threshold + write_buffer + write_queue bytes of a part, plus
+/// the last read, whatever its size.
+/// The parts are handed to the handler by http_request::uploads() once
+/// their writes are complete. Every write holds the spooler, the files are
+/// removed with it: after the request is handled, or by the last write of
+/// an abandoned request.
+class upload_spooler : public body_reader,
+                       public std::enable_shared_from_this<upload_spooler>,
+                       private multipart_handler
+{
+    struct part
+    {
+        // Owned copies of the header values the upload views
+        std::string disposition;
+        std::string content_type;
+        // The payload while it is in memory, the write buffer once spooled
+        std::string buffer;
+        std::string path;
+        int fd{-1};
+        std::size_t size{0};
+        // Bytes handed to the writer, the offset of the next write
+        std::size_t spooled{0};
+
+        // Guarded by write_lock_: the file is closed by the last write of
+        // an ended part
+        std::size_t writes{0};
+        bool ended{false};
+    };
+
+    upload_options options_;
+    spool_writer& writer_;
+    multipart_parser multipart_;
+    // Stable addresses, the uploads and the writes view the parts
+    std::deque<part> parts_;
+    std::vector<http_form_upload> uploads_;
+    std::error_code ec_;
+
+    // Writes in flight, shared with the writer threads
+    std::mutex write_lock_;
+    std::size_t bytes_queued_{0};
+    std::error_code write_ec_;
+    // The parser waits until the bytes in flight are below resume_below_
+    std::function<void()> resume_;
+    std::size_t resume_below_{0};
+public:
+    upload_spooler(std::string_view boundary, upload_options options)
+        : options_(std::move(options))
+        , writer_(options_.writer ? *options_.writer : spool_writer::shared())
+    {
+        multipart_.reset(boundary);
+    }
+
+    /// Closes and removes the files, the writes are done: they hold the spooler
+    ~upload_spooler() override;
+
+    upload_spooler(upload_spooler const&) = delete;
+    upload_spooler& operator=(upload_spooler const&) = delete;
+
+    /// A spooler for a multipart/form-data request, null for other bodies
+    static std::shared_ptr<upload_spooler> accept(http_request const& head, upload_options const& options = {});
+
+    void on_body_data(std::string_view data, std::error_code& ec) override;
+
+    /// Expects the writes to be done, which the parser waits for through pause
+    void on_body_end(std::error_code& ec) override;
+
+    /// Busy past write_queue bytes in flight, or with any write once the
+    /// body is complete
+    bool pause(bool complete, std::function<void()> const& resume) override;
+
+    std::vector<http_form_upload> const* uploads() const noexcept override { return &uploads_; }
+
+private:
+    void on_part_begin(http_headers const& headers) override;
+
+    void on_part_data(std::string_view data) override;
+
+    void on_part_end() override;
+
+    /// Moves the part from memory to a new temporary file
+    void spool(part& p);
+
+    /// Hands the buffer of the part to the writer
+    void write(part& p);
+
+    /// Called by the writer thread once a write of the part is done
+    void complete(part& p, std::size_t size, std::error_code ec);
+
+    static std::error_code write_at(int fd, std::string_view data, std::size_t offset);
+
+    void close(part& p);
+};
+
+/// Reader factory for route::stream_body that spools the uploads
+inline
+std::function<std::shared_ptr<body_reader>(http_request const&)>
+spool_uploads(upload_options options = {})
+{
+    return [options = std::move(options)](http_request const& head) -> std::shared_ptr<body_reader>
+    {
+        return upload_spooler::accept(head, options);
+    };
+}
+
+inline
+upload_spooler::~upload_spooler()
+{
+    for (auto& p : parts_)
+    {
+        close(p);
+        if (!p.path.empty())
+            ::unlink(p.path.c_str());
+    }
+}
+
+inline
+std::shared_ptr<upload_spooler>
+upload_spooler::accept(http_request const& head, upload_options const& options)
+{
+    auto content_type = head.headers().find(http_field::content_type);
+    if (content_type == head.headers().end())
+        return nullptr;
+
+    auto const value = content_type->second;
+    if (!common::string_utils::iequals(value.substr(0, value.find(';')), "multipart/form-data"))
+        return nullptr;
+
+    // The parser already rejected the request when the boundary is invalid
+    auto boundary = multipart_parser::boundary_parameter(value);
+    if (boundary.empty())
+        return nullptr;
+
+    return std::make_shared<upload_spooler>(boundary, options);
+}
+
+inline
+void
+upload_spooler::on_body_data(std::string_view data, std::error_code& ec)
+{
+    multipart_.parse(data, *this, ec);
+    if (!ec)
+        ec = ec_;
+
+    if (!ec)
+    {
+        std::scoped_lock locker(write_lock_);
+        ec = write_ec_;
+    }
+}
+
+inline
+void
+upload_spooler::on_body_end(std::error_code& ec)
+{
+    std::error_code write_ec;
+    {
+        std::scoped_lock locker(write_lock_);
+        write_ec = write_ec_;
+    }
+
+    if (ec_ || write_ec)
+    {
+        ec = ec_ ? ec_ : write_ec;
+        return;
+    }
+
+    if (!multipart_.finished())
+    {
+        ec = make_error(http_error::bad_multipart);
+        return;
+    }
+
+    uploads_.reserve(parts_.size());
+    for (auto& p : parts_)
+    {
+        auto& upload = uploads_.emplace_back();
+        upload.disposition = p.disposition;
+        upload.content_type = p.content_type;
+        upload.name = multipart_parser::disposition_parameter(upload.disposition, "name");
+        upload.filename = multipart_parser::disposition_parameter(upload.disposition, "filename");
+
+        upload.size = p.size;
+        if (p.path.empty())
+            upload.bytes = p.buffer;
+        else
+            upload.path = p.path;
+    }
+}
+
+inline
+void
+upload_spooler::on_part_begin(http_headers const& headers)
+{
+    auto& p = parts_.emplace_back();
+
+    auto disposition = headers.find(http_field::content_disposition);
+    if (disposition != headers.end())
+        p.disposition = disposition->second;
+
+    auto content_type = headers.find(http_field::content_type);
+    if (content_type != headers.end())
+        p.content_type = content_type->second;
+}
+
+inline
+void
+upload_spooler::on_part_data(std::string_view data)
+{
+    if (ec_)
+        return;
+
+    auto& p = parts_.back();
+    p.size += data.size();
+
+    if (p.fd < 0 && p.size > options_.memory_threshold)
+    {
+        spool(p);
+        if (ec_)
+            return;
+    }
+
+    // The receive buffer is reused, the writer gets a copy
+    p.buffer.append(data);
+    if (p.fd >= 0 && p.buffer.size() >= options_.write_buffer)
+        write(p);
+}
+
+inline
+void
+upload_spooler::on_part_end()
+{
+    auto& p = parts_.back();
+    if (p.fd < 0 || ec_)
+        return;
+
+    if (!p.buffer.empty())
+        write(p);
+
+    std::scoped_lock locker(write_lock_);
+    p.ended = true;
+    if (p.writes == 0)
+        close(p);
+}
+
+inline
+void
+upload_spooler::spool(part& p)
+{
+    std::string path = options_.directory;
+    if (path.empty())
+    {
+        auto tmpdir = std::getenv("TMPDIR");
+        path = tmpdir && *tmpdir ? tmpdir : "/tmp";
+    }
+    path += "/webcrown-upload-XXXXXX";
+
+    p.fd = ::mkostemp(path.data(), O_CLOEXEC);
+    if (p.fd < 0)
+    {
+        ec_ = std::error_code(errno, std::system_category());
+        return;
+    }
+
+    p.path = std::move(path);
+}
+
+inline
+void
+upload_spooler::write(part& p)
+{
+    // The buffer goes with the write, the next one is allocated again
+    std::string data;
+    data.swap(p.buffer);
+
+    auto const offset = p.spooled;
+    p.spooled += data.size();
+
+    {
+        std::scoped_lock locker(write_lock_);
+        bytes_queued_ += data.size();
+        ++p.writes;
+    }
+
+    // The parts have stable addresses, the spooler lives until the write is done
+    writer_.post([self = shared_from_this(), &p, fd = p.fd, offset, data = std::move(data)]
+    {
+        self->complete(p, data.size(), write_at(fd, data, offset));
+    });
+}
+
+inline
+bool
+upload_spooler::pause(bool complete, std::function<void()> const& resume)
+{
+    std::scoped_lock locker(write_lock_);
+    resume_below_ = complete ? 1 : options_.write_queue;
+    if (bytes_queued_ < resume_below_)
+        return false;
+
+    resume_ = resume;
+    return true;
+}
+
+inline
+void
+upload_spooler::complete(part& p, std::size_t size, std::error_code ec)
+{
+    std::function<void()> resume;
+    {
+        std::scoped_lock locker(write_lock_);
+        bytes_queued_ -= size;
+        if (ec && !write_ec_)
+            write_ec_ = ec;
+
+        if (--p.writes == 0 && p.ended)
+            close(p);
+
+        if (resume_ && bytes_queued_ < resume_below_)
+            resume.swap(resume_);
+    }
+
+    // Outside of the lock, the parser may take the body right away
+    if (resume)
+        resume();
+}
+
+inline
+std::error_code
+upload_spooler::write_at(int fd, std::string_view data, std::size_t offset)
+{
+    // The writes of a part may run concurrently, each one has its offset
+    while (!data.empty())
+    {
+        auto written = ::pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return std::error_code(errno, std::system_category());
+        }
+
+        data.remove_prefix(static_cast<std::size_t>(written));
+        offset += static_cast<std::size_t>(written);
+    }
+
+    return {};
+}
+
+inline
+void
+upload_spooler::close(part& p)
+{
+    if (p.fd < 0)
+        return;
+
+    ::close(p.fd);
+    p.fd = -1;
+}
+
+}}}
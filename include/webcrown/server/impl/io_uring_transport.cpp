@@ -0,0 +1,317 @@
+#include "webcrown/server/io_uring_transport.hpp"
+
+#if defined(WEBCROWN_HAS_IO_URING)
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+#endif
+
+namespace webcrown {
+namespace server {
+
+#if defined(WEBCROWN_HAS_IO_URING)
+
+namespace {
+
+// Submission and completion queue depth
+constexpr unsigned ring_entries = 4096;
+
+// Provided receive buffers, registered once in a buffer ring
+constexpr unsigned receive_buffers = 1024;
+constexpr unsigned receive_buffer_size = 16 * 1024;
+constexpr int receive_buffer_group = 0;
+
+// Completions handled per eventfd wake-up before re-arming the wait
+constexpr unsigned reap_batch = 256;
+
+}
+
+struct io_uring_transport::ring_state
+{
+    io_uring ring{};
+    bool ring_initialized{false};
+
+    io_uring_buf_ring* buffer_ring{nullptr};
+    std::vector<char> buffer_memory;
+    int buffer_mask{0};
+
+    int event_fd{-1};
+
+    ~ring_state()
+    {
+        if(buffer_ring)
+            io_uring_free_buf_ring(&ring, buffer_ring, receive_buffers, receive_buffer_group);
+
+        if(ring_initialized)
+            io_uring_queue_exit(&ring);
+    }
+
+    char* buffer(unsigned id) noexcept
+    {
+        return buffer_memory.data() + static_cast<std::size_t>(id) * receive_buffer_size;
+    }
+
+    void recycle_buffer(unsigned id) noexcept
+    {
+        io_uring_buf_ring_add(buffer_ring, buffer(id), receive_buffer_size,
+            static_cast<unsigned short>(id), buffer_mask, 0);
+        io_uring_buf_ring_advance(buffer_ring, 1);
+    }
+
+    io_uring_sqe* get_sqe()
+    {
+        auto sqe = io_uring_get_sqe(&ring);
+        if(!sqe)
+        {
+            // Submission queue full, push the batch to the kernel
+            io_uring_submit(&ring);
+            sqe = io_uring_get_sqe(&ring);
+        }
+
+        return sqe;
+    }
+};
+
+std::unique_ptr<io_uring_transport>
+io_uring_transport::create(asio::io_context& io_context, std::error_code& ec)
+{
+    auto transport = std::make_unique<io_uring_transport>(io_context);
+    auto& state = *transport->state_;
+
+    auto ret = io_uring_queue_init(ring_entries, &state.ring, 0);
+    if(ret < 0)
+    {
+        ec = std::error_code(-ret, std::system_category());
+        return nullptr;
+    }
+
+    state.ring_initialized = true;
+
+    // Saves the fd lookup on every io_uring_enter, best effort
+    io_uring_register_ring_fd(&state.ring);
+
+    state.buffer_memory.resize(static_cast<std::size_t>(receive_buffers) * receive_buffer_size);
+    state.buffer_ring = io_uring_setup_buf_ring(&state.ring, receive_buffers, receive_buffer_group, 0, &ret);
+    if(!state.buffer_ring)
+    {
+        ec = std::error_code(-ret, std::system_category());
+        return nullptr;
+    }
+
+    state.buffer_mask = io_uring_buf_ring_mask(receive_buffers);
+    for(unsigned id = 0; id < receive_buffers; ++id)
+    {
+        io_uring_buf_ring_add(state.buffer_ring, state.buffer(id), receive_buffer_size,
+            static_cast<unsigned short>(id), state.buffer_mask, static_cast<int>(id));
+    }
+    io_uring_buf_ring_advance(state.buffer_ring, receive_buffers);
+
+    state.event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(state.event_fd < 0)
+    {
+        ec = std::error_code(errno, std::system_category());
+        return nullptr;
+    }
+
+    // The descriptor owns the eventfd from now on
+    transport->completion_event_.assign(state.event_fd, ec);
+    if(ec)
+    {
+        ::close(state.event_fd);
+        return nullptr;
+    }
+
+    ret = io_uring_register_eventfd(&state.ring, state.event_fd);
+    if(ret < 0)
+    {
+        ec = std::error_code(-ret, std::system_category());
+        return nullptr;
+    }
+
+    transport->wait_completions();
+    return transport;
+}
+
+io_uring_transport::io_uring_transport(asio::io_context& io_context)
+    : io_context_(io_context)
+    , state_(std::make_unique<ring_state>())
+    , completion_event_(io_context)
+    , submit_scheduled_(false)
+{
+}
+
+io_uring_transport::~io_uring_transport()
+{
+    asio::error_code ec;
+    completion_event_.close(ec);
+}
+
+void
+io_uring_transport::accept_multishot(int listen_fd, uring_operation& op)
+{
+    auto sqe = state_->get_sqe();
+    io_uring_prep_multishot_accept(sqe, listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    io_uring_sqe_set_data(sqe, &op);
+
+    schedule_submit();
+}
+
+void
+io_uring_transport::receive_multishot(int fd, uring_operation& op)
+{
+    auto sqe = state_->get_sqe();
+    io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = receive_buffer_group;
+    io_uring_sqe_set_data(sqe, &op);
+
+    schedule_submit();
+}
+
+void
+io_uring_transport::send(int fd, msghdr const* msg, uring_operation& op)
+{
+    auto sqe = state_->get_sqe();
+    io_uring_prep_sendmsg(sqe, fd, msg, MSG_NOSIGNAL);
+    io_uring_sqe_set_data(sqe, &op);
+
+    schedule_submit();
+}
+
+void
+io_uring_transport::cancel(int fd)
+{
+    auto sqe = state_->get_sqe();
+    io_uring_prep_cancel_fd(sqe, fd, IORING_ASYNC_CANCEL_ALL);
+    // The completion of the cancel itself is ignored
+    io_uring_sqe_set_data(sqe, nullptr);
+
+    // The fd is closed right after, the cancel must reach the kernel first
+    io_uring_submit(&state_->ring);
+}
+
+void
+io_uring_transport::cancel(uring_operation& op)
+{
+    auto sqe = state_->get_sqe();
+    io_uring_prep_cancel(sqe, &op, 0);
+    io_uring_sqe_set_data(sqe, nullptr);
+
+    schedule_submit();
+}
+
+void
+io_uring_transport::schedule_submit()
+{
+    if(submit_scheduled_)
+        return;
+
+    submit_scheduled_ = true;
+
+    // Operations queued by the handlers of this turn share one io_uring_enter
+    auto submit_handler = [this]()
+    {
+        submit_scheduled_ = false;
+        io_uring_submit(&state_->ring);
+    };
+
+    asio::post(io_context_, submit_handler);
+}
+
+void
+io_uring_transport::wait_completions()
+{
+    auto wait_handler = [this](asio::error_code const& ec)
+    {
+        if(ec)
+            return;
+
+        reap();
+        wait_completions();
+    };
+
+    completion_event_.async_wait(asio::posix::stream_descriptor::wait_read, wait_handler);
+}
+
+void
+io_uring_transport::reap()
+{
+    // Reset the eventfd counter, completions arriving from now on wake us again
+    std::uint64_t count;
+    auto _ = ::read(state_->event_fd, &count, sizeof(count));
+    (void)_;
+
+    auto& ring = state_->ring;
+    io_uring_cqe* cqes[reap_batch];
+
+    unsigned n;
+    do
+    {
+        n = io_uring_peek_batch_cqe(&ring, cqes, reap_batch);
+        for(unsigned i = 0; i < n; ++i)
+        {
+            auto cqe = cqes[i];
+            auto op = static_cast<uring_operation*>(io_uring_cqe_get_data(cqe));
+            auto more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+            char const* data = nullptr;
+            auto has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+            auto buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            if(has_buffer && cqe->res > 0)
+                data = state_->buffer(buffer_id);
+
+            if(op && op->cb)
+                op->cb(*op, cqe->res, more, data);
+
+            // The bytes were parsed or copied by the handler
+            if(has_buffer)
+                state_->recycle_buffer(buffer_id);
+        }
+
+        io_uring_cq_advance(&ring, n);
+    }
+    while(n == reap_batch);
+
+    // Re-armed receives and sends queued by the handlers
+    if(!submit_scheduled_)
+        io_uring_submit(&ring);
+}
+
+#else
+
+struct io_uring_transport::ring_state
+{
+};
+
+std::unique_ptr<io_uring_transport>
+io_uring_transport::create(asio::io_context&, std::error_code& ec)
+{
+    ec = std::make_error_code(std::errc::function_not_supported);
+    return nullptr;
+}
+
+io_uring_transport::io_uring_transport(asio::io_context& io_context)
+    : io_context_(io_context)
+    , completion_event_(io_context)
+    , submit_scheduled_(false)
+{
+}
+
+io_uring_transport::~io_uring_transport() = default;
+
+void io_uring_transport::accept_multishot(int, uring_operation&) {}
+void io_uring_transport::receive_multishot(int, uring_operation&) {}
+void io_uring_transport::send(int, msghdr const*, uring_operation&) {}
+void io_uring_transport::cancel(int) {}
+void io_uring_transport::cancel(uring_operation&) {}
+void io_uring_transport::wait_completions() {}
+void io_uring_transport::reap() {}
+void io_uring_transport::schedule_submit() {}
+
+#endif
+
+} // server
+} // webcrown
@@ -5,18 +5,110 @@
 #include "asio/socket_base.hpp"
 #include "asio/steady_timer.hpp"
 #include "webcrown/server/error.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
 #include <thread>
+#include <unistd.h>
 
 namespace webcrown {
 namespace server {
 
-WebSession::WebSession(uint64_t session_id, shared_ptr<WebServer> server, OnCb& cb)
-    : session_id_(session_id)
+namespace {
+
+// Answer of the requests refused by the admission control, never copied
+constexpr std::string_view overloaded_response =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Length: 0\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Answers of the requests crossing a size limit
+constexpr std::string_view payload_too_large_response =
+    "HTTP/1.1 413 Payload Too Large\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+constexpr std::string_view uri_too_long_response =
+    "HTTP/1.1 414 URI Too Long\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+constexpr std::string_view header_fields_too_large_response =
+    "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Interim answer to "Expect: 100-continue" once the head is accepted
+constexpr std::string_view continue_response =
+    "HTTP/1.1 100 Continue\r\n"
+    "\r\n";
+
+/// Response of a parse error caused by a limit, empty for the other errors
+std::string_view limit_response(std::error_code const& ec)
+{
+    if (ec.category() != http::make_error(http::http_error::unknown).category())
+        return {};
+
+    switch (static_cast<http::http_error>(ec.value()))
+    {
+        case http::http_error::body_too_large:
+            return payload_too_large_response;
+        case http::http_error::start_line_too_long:
+            return uri_too_long_response;
+        case http::http_error::header_too_large:
+        case http::http_error::too_many_header_fields:
+            return header_fields_too_large_response;
+        default:
+            return {};
+    }
+}
+
+}
+
+WebSession::WebSession(WebServer* server, WebWorker& worker, OnCb& cb)
+    : io_context_(worker.io_context_)
+    , worker_(worker)
+    , timer_wheel_(worker.timer_wheel_)
     , server_(server)
-    , io_context_(server->io_context_)
-    , socket_(*server->io_context_)
+    , socket_(*io_context_)
+    , session_id_(0)
+    , read_deadline_(&WebSession::on_deadline, this)
+    , write_deadline_(&WebSession::on_deadline, this)
+    , receive_op_{&WebSession::on_uring_receive, this}
+    , send_op_{&WebSession::on_uring_send, this}
     , on_error_(cb)
 {
+    auto on_head_handler = [this](http::http_request const& head, std::error_code& ec)
+    {
+        return on_head(head, ec);
+    };
+
+    parser_.on_head(on_head_handler);
+
+    // Called by a body reader on its own thread, the session continues on its own
+    auto on_resume_handler = [this]()
+    {
+        asio::post(*io_context_, [this]() { resume_body(); });
+    };
+
+    parser_.on_resume(on_resume_handler);
+
+    parser_.arena(worker.request_arena_.resource());
+
+    auto const& options = server_->options_;
+    parser_.limits({
+        options.max_start_line,
+        options.max_header_fields,
+        options.max_header_bytes,
+        options.max_body_size,
+        options.max_chunk_line
+    });
 }
 
 WebSession::~WebSession()
@@ -24,6 +116,51 @@ WebSession::~WebSession()
     int brk = 0;
 }
 
+void
+WebSession::attach(uint64_t session_id, asio::ip::tcp::socket socket)
+{
+    session_id_ = session_id;
+    socket_ = std::move(socket);
+
+    pending_ops_ = 0;
+    release_scheduled_ = false;
+}
+
+void
+WebSession::try_release()
+{
+    if(connected_ || pending_ops_ > 0 || release_scheduled_)
+        return;
+
+    release_scheduled_ = true;
+
+    // Release once the current handler returns, it may still use the session
+    auto release_handler = [this]()
+    {
+        // A new operation was started in the meantime, its handler releases
+        if(connected_ || pending_ops_ > 0)
+        {
+            release_scheduled_ = false;
+            return;
+        }
+
+        read_deadline_.cancel();
+        write_deadline_.cancel();
+
+        // Keep the allocated capacity for the next connection
+        parser_.reset();
+        finish_request();
+        charge_body();
+        clear_buffers();
+        receive_pending_ = 0;
+        release_receive_buffer();
+
+        worker_.session_pool_.release(this);
+    };
+
+    asio::post(*io_context_, release_handler);
+}
+
 void
 WebSession::connect()
 {
@@ -32,11 +169,22 @@ WebSession::connect()
     bytes_received_ = 0;
     bytes_sent_ = 0;
 
-    receive_buffer_.resize(option_receive_buffer_size());
+    requests_served_ = 0;
+    receive_pending_ = 0;
+    close_after_send_ = false;
+    linger_on_close_ = false;
+    lingering_ = false;
+
     socket_.set_option(asio::ip::tcp::socket::keep_alive(true));
 
+    // Reads are performed when the socket is readable, they never block
+    socket_.non_blocking(true);
+
     connected_ = true;
 
+    // The first request is expected right away
+    update_read_deadline(false);
+
     try_receive();
 }
 
@@ -46,12 +194,20 @@ WebSession::clear_buffers()
     std::scoped_lock locker(send_lock_);
 
     // Clear send buffers
-    send_buffer_main_.clear();
-    send_buffer_flush_.clear();
+    send_chunks_main_.clear();
+    send_buffers_main_.clear();
+    send_chunks_flush_.clear();
+    send_buffers_flush_.clear();
+
+    // Give the admission budgets back
+    server_->buffered_bytes_ -= bytes_pending_ + bytes_sending_;
+    server_->inflight_requests_ -= responses_pending_ + responses_sending_;
 
     // Update statistic
     bytes_pending_ = 0;
     bytes_sending_ = 0;
+    responses_pending_ = 0;
+    responses_sending_ = 0;
 }
 
 bool
@@ -85,6 +241,11 @@ WebSession::disconnect(asio::error_code ec)
             return;
         }
 
+        // The ring holds its own reference to the socket, its operations
+        // must be cancelled or the connection would outlive the close
+        if(worker_.uring_)
+            worker_.uring_->cancel(socket_.native_handle());
+
         // Cancel the socket
         auto _ = socket_.close(ec);
         if(ec)
@@ -96,21 +257,29 @@ WebSession::disconnect(asio::error_code ec)
 
         connected_ = false;
 
+        read_deadline_.cancel();
+        write_deadline_.cancel();
+
         // Update sending/receive flag
         receiving_ = false;
         sending_ = false;
 
-        // clearbuffers
-        clear_buffers();
+        // clearbuffers, a send submitted to the ring still reads the flush
+        // queue until its completion, the release clears it then
+        if(!worker_.uring_)
+            clear_buffers();
 
         shutdown_session();
 
         auto unregister_session_handler = [this]()
         {
             server_->unregister_session(session_id_);
+
+            // Back to the pool once the aborted operations completed
+            try_release();
         };
 
-        server_->io_context_->dispatch(unregister_session_handler);
+        io_context_->dispatch(unregister_session_handler);
     };
 
     io_context_->dispatch(disconnect_handler);
@@ -122,7 +291,7 @@ void
 WebSession::try_receive()
 {
     asio::error_code ec;
-    if(receiving_)
+    if(receiving_ || body_paused_)
     {
         return;
     }
@@ -136,411 +305,1328 @@ WebSession::try_receive()
 
     receiving_ = true;
 
-    auto async_receive_handler = [this](asio::error_code const& ec, std::size_t bytes_size)
+    // The session is not recycled while the wait is pending
+    ++pending_ops_;
+
+    if(worker_.uring_)
+    {
+        // One multishot receive serves the connection until it ends
+        worker_.uring_->receive_multishot(socket_.native_handle(), receive_op_);
+        return;
+    }
+
+    auto async_wait_handler = [this](asio::error_code const& ec)
     {
         receiving_ = false;
+        --pending_ops_;
 
         if(ec)
         {
             disconnect(ec);
+            try_release();
             return;
         }
 
-        if(bytes_size == 0)
-        {
-            try_receive();
-            return;
-        }
-
-        bytes_received_ += bytes_size;
-
-        // Dispatch event
-        on_receive(receive_buffer_.data(), bytes_size);
-
-        // receive buffer is full
-        if(receive_buffer_.size() <= bytes_size)
-            receive_buffer_.resize(2 * bytes_size);
+        receive();
 
         if(!connected_)
         {
             // we manually disconnect the client, so return
+            try_release();
             return;
         }
 
-        // Receive next buffer
-        try_receive();
+        // Receive next buffer, unless the connection closes after its
+        // responses. A lingering close reads until the end of the input.
+        if(!close_after_send_ || lingering_)
+            try_receive();
     };
 
-    socket_.async_read_some(
-        asio::buffer(receive_buffer_.data(), receive_buffer_.size()),
-        async_receive_handler
-    );
+    // Wait for readability without a buffer: idle connections do not pin
+    // any receive memory, a buffer is borrowed only once data is there
+    socket_.async_wait(asio::ip::tcp::socket::wait_read, async_wait_handler);
 }
 
 void
-WebSession::on_receive(void const* buffer, std::size_t size)
+WebSession::receive()
 {
-    std::error_code ec;
+    auto& pool = worker_.buffer_pool_;
 
-    // parser
-    auto result = parser_.parse(static_cast<const char*>(buffer), size, ec);
-    if (ec)
+    if(!receive_buffer_)
     {
-        //logger_->error("[http_session][on_received] failed to parser start line {}", ec.message());
-        disconnect(ec);
-        return;
+        receive_buffer_ = pool.acquire();
+    }
+    else if(receive_pending_ == receive_buffer_.capacity())
+    {
+        // The incomplete request fills the buffer, move it to the next size class
+        auto larger = pool.acquire(receive_buffer_.capacity() + 1);
+        if(!larger)
+        {
+            disconnect(make_error(session_error::receive_buffer_full));
+            return;
+        }
+
+        std::memcpy(larger.data(), receive_buffer_.data(), receive_pending_);
+        pool.release(receive_buffer_);
+        receive_buffer_ = std::move(larger);
     }
 
-    if (parser_.parsephase() != http::parse_phase::finished)
+    // Keep the incomplete request at the beginning of the buffer
+    asio::error_code ec;
+    auto bytes_size = socket_.read_some(
+        asio::buffer(receive_buffer_.data() + receive_pending_, receive_buffer_.capacity() - receive_pending_),
+        ec
+    );
+
+    if(ec == asio::error::would_block || ec == asio::error::try_again)
     {
-        // need more
-        //logger_->info("[http_session][on_received] need more bytes...");
+        release_receive_buffer();
         return;
     }
 
-    if (!result)
+    if(ec)
     {
-        //logger_->error("[http_session][on_received] no http request");
         disconnect(ec);
         return;
     }
 
-    http::http_response response{};
-    // middlewares
-    for(auto& middleware : server_->middlewares_)
-    {
-        if(!middleware->execute(*result, response))
-        {
-            break;
-        }
-    }
+    bytes_received_ += bytes_size;
 
-    // send response
-    send_async(response.build());
-    //logger_->info("[http_session][on_received] Message sent to the client");
+    // Incomplete request kept from the previous read plus the new bytes
+    auto filled = receive_pending_ + bytes_size;
 
-    // disconnect 
-    if(!disconnect())
-    {
-        //logger_->error("[http_session][on_received] Failed to disconnect session.");
-    }
+    // Dispatch event
+    on_receive(receive_buffer_.data(), filled);
+
+    // Nothing left to parse, the buffer goes back to the pool until the next read
+    release_receive_buffer();
 }
 
-std::size_t 
-WebSession::option_receive_buffer_size() const
+void
+WebSession::release_receive_buffer()
 {
-    asio::socket_base::receive_buffer_size option;
-    socket_.get_option(option);
-
-    return option.value();
+    if(receive_buffer_ && receive_pending_ == 0)
+        worker_.buffer_pool_.release(receive_buffer_);
 }
 
-bool
-WebSession::send_async(void const* buffer, size_t size)
+void
+WebSession::receive_provided(char const* data, std::size_t size)
 {
-    asio::error_code ec;
+    bytes_received_ += size;
 
-    if(size == 0)
+    if(receive_pending_ == 0)
     {
-        ec = make_error(session_error::sent_bytes_is_zero);
-        disconnect();
-        return false;
+        // Parsed in place, only an incomplete request is copied
+        on_receive(data, size);
+        release_receive_buffer();
+        return;
     }
 
-    assert((buffer != nullptr) && "Pointer to the buffer should no be null!");
-    if(buffer == nullptr)
-    {
-        ec = make_error(session_error::sent_buffer_is_nullptr);
-        disconnect();
-        return 0;
-    }
+    auto& pool = worker_.buffer_pool_;
+    auto filled = receive_pending_ + size;
 
+    if(receive_buffer_.capacity() < filled)
     {
-        std::scoped_lock locker(send_lock_);
-
-        // Detect multiple send handlers
-        auto send_required = send_buffer_main_.empty() || send_buffer_flush_.empty();
-
-        // Fill the main send buffer
-        uint8_t const* bytes = (uint8_t const*)buffer;
-        send_buffer_main_.insert(send_buffer_main_.end(), bytes, bytes + size);
-
-        // Update Statistics
-        bytes_pending_ = send_buffer_main_.size();
+        auto larger = pool.acquire(filled);
+        if(!larger)
+        {
+            disconnect(make_error(session_error::receive_buffer_full));
+            return;
+        }
 
-        // Avoid multiple send handlers
-        if(!send_required)
-            return true;
+        std::memcpy(larger.data(), receive_buffer_.data(), receive_pending_);
+        pool.release(receive_buffer_);
+        receive_buffer_ = std::move(larger);
     }
 
-    auto send_handler = [this]()
-    {
-        try_send();
-    };
-
-    io_context_->dispatch(send_handler);
-    return true;
+    std::memcpy(receive_buffer_.data() + receive_pending_, data, size);
+    on_receive(receive_buffer_.data(), filled);
+    release_receive_buffer();
 }
 
 void
-WebSession::try_send()
+WebSession::on_uring_receive(uring_operation& op, int result, bool more, char const* data)
 {
-    if(sending_)
-        return;
-
-    // Swap send buffers
-    if(send_buffer_flush_.empty())
-    {
-        std::scoped_lock locker(send_lock_);
-
-        // Swap flush and main buffers
-        send_buffer_flush_.swap(send_buffer_main_);
-        send_buffer_flush_offset = 0;
-
-        // Update statistic
-        bytes_pending_ = 0;
-        bytes_sending_ += send_buffer_flush_.size();
-    }
+    auto session = static_cast<WebSession*>(op.owner);
 
-    // Check if the flush buffer is empty
-    // because buffer_main can be empty
-    if(send_buffer_flush_.empty())
+    if(!more)
     {
-        // Call the empty send buffer handler
-        // on empty();
-        return;
+        session->receiving_ = false;
+        --session->pending_ops_;
     }
 
-    // Async write with the write handler
-    sending_ = true;
-    auto self(this->shared_from_this());
-    auto async_write_handler = [this, self](std::error_code ec, size_t size)
+    if(session->connected_)
     {
-        sending_ = false;
-
-        if(size == 0)
+        if(result > 0)
         {
-            auto ec = make_error(session_error::sent_bytes_is_zero);
-            return;
+            session->receive_provided(data, static_cast<std::size_t>(result));
         }
-
-        // Update statistics
-        bytes_sending_ -= size;
-        bytes_sent_ += size;
-
-        // Increase the flush buffer offset
-        send_buffer_flush_offset += size;
-
-        // Successfully send the whole flush buffer
-        if (send_buffer_flush_offset == send_buffer_flush_.size())
+        else if(result == 0)
         {
-            // Clear the flush buffer
-            send_buffer_flush_.clear();
-            send_buffer_flush_offset = 0;
+            session->disconnect(asio::error::eof);
         }
-
-        // Try to send again if the session is valid
-        if(!ec)
-            try_send();
-        else
+        else if(result != -ENOBUFS && result != -ECANCELED)
         {
-            //send_error(ec);
-            disconnect(ec);
+            session->disconnect(asio::error_code(-result, asio::error::get_system_category()));
         }
-    };
 
-    socket_.async_write_some(
-        asio::buffer(send_buffer_flush_.data() + send_buffer_flush_offset,
-        send_buffer_flush_.size() - send_buffer_flush_offset),
-        async_write_handler
-    );
+        // Out of provided buffers, or the kernel ended the multishot receive
+        if(!more && session->connected_ && (!session->close_after_send_ || session->lingering_))
+            session->try_receive();
+    }
+
+    session->try_release();
 }
 
 void
-WebSession::send_error(asio::error_code ec)
+WebSession::keep_pending(char const* bytes, std::size_t size, std::size_t retained, std::size_t consumed)
 {
-    // Skip asio disconnect errors
-    if ((ec == asio::error::connection_aborted) ||
-        (ec == asio::error::connection_refused) ||
-        (ec == asio::error::connection_reset) ||
-        (ec == asio::error::eof) ||
-        (ec == asio::error::operation_aborted))
+    auto tail = size - consumed;
+    receive_pending_ = retained + tail;
+    if(receive_pending_ == 0)
         return;
 
-    //on_error(ec);
-}
+    auto data = receive_buffer_.data();
+    if(data && bytes >= data && bytes < data + receive_buffer_.capacity())
+    {
+        // Both moves go towards the front, the head is never overwritten
+        if(bytes != data)
+            std::memmove(data, bytes, retained);
+        if(retained != consumed || bytes != data)
+            std::memmove(data + retained, bytes + consumed, tail);
+        return;
+    }
 
-// ---------------------------------------------------------------------------
+    // Parsed from a buffer the session does not own
+    if(receive_buffer_.capacity() < receive_pending_)
+    {
+        auto& pool = worker_.buffer_pool_;
+        pool.release(receive_buffer_);
+        receive_buffer_ = pool.acquire(receive_pending_);
+        if(!receive_buffer_)
+        {
+            receive_pending_ = 0;
+            disconnect(make_error(session_error::receive_buffer_full));
+            return;
+        }
+    }
 
-WebServer::WebServer(
-        std::string host,
-        uint16_t port,
-        OnCb const& cb)
-    : started_(false)
-    , last_session_id_(0)
-    , io_context_(std::make_shared<asio::io_context>())
-    , socket_acceptor_(*io_context_)
-    , on_error_(cb)
-    , host_(std::move(host))
-    , port_(port)
-{
-    
+    std::memcpy(receive_buffer_.data(), bytes, retained);
+    std::memcpy(receive_buffer_.data() + retained, bytes + consumed, tail);
 }
 
-WebServer::~WebServer()
+void
+WebSession::on_receive(void const* buffer, std::size_t size)
 {
-    if(context_worker_thread_.joinable())
-        context_worker_thread_.join();
-}
+    std::error_code ec;
 
-void 
-WebServer::start()
-{
-    asio::error_code ec;
-    assert(!started_ && "Webserver is already started");
-    
-    started_ = true;
+    // The connection will be closed, ignore anything sent after the last request
+    if (close_after_send_)
+        return;
+
+    auto bytes = static_cast<const char*>(buffer);
+    std::size_t offset = 0;
 
-    // Run I/O thread 
-    context_worker_thread_ = std::thread(&WebServer::context_handler, this);
+    auto const requests_served = requests_served_;
 
-    auto start_handler = [this]()
+    // Bytes of an unfinished request to keep, and to drop after them
+    std::size_t retained = 0;
+    std::size_t consumed = 0;
+
+    // A buffer can carry several pipelined requests, they are handled in order
+    while (offset < size)
     {
-        asio::error_code ec;
-        asio::ip::tcp::endpoint endpoint(asio::ip::make_address(host_, ec), port_);
-        
-        if(ec.value())
+        // parser
+        auto result = parser_.parse(bytes + offset, size - offset, ec);
+        if (ec)
         {
-            on_error_(ec);
-            return;
-        }
+            auto response = limit_response(ec);
+            auto const head_rejected = ec == http::make_error(http::http_error::request_rejected);
+            if (!response.empty() || head_rejected)
+            {
+                // Answered before the rest of the request is read. The
+                // response of a rejected head is already queued.
+                reject(response);
+                offset = size;
+                retained = 0;
+                consumed = 0;
+                break;
+            }
 
-        auto _ = socket_acceptor_.open(endpoint.protocol(), ec);
-        if (ec.value())
-        {
-            on_error_(ec);
+            //logger_->error("[http_session][on_received] failed to parser start line {}", ec.message());
+            disconnect(ec);
             return;
         }
-        
-        socket_acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true), ec);
-        _ = socket_acceptor_.bind(endpoint, ec);
-        if(ec.value())
+
+        if (parser_.parsephase() != http::parse_phase::finished)
         {
-            on_error_(ec);
-            return;
+            // need more, the parsed head stays in the buffer for the request views
+            //logger_->info("[http_session][on_received] need more bytes...");
+            retained = parser_.retained();
+            consumed = parser_.consumed();
+
+            // A busy body reader holds back the rest of the request
+            if (parser_.paused())
+                pause_body();
+
+            // A body gathered across reads is held like a queued response
+            charge_body();
+            if (body_charged_ > 0 && server_->over_memory_budget())
+            {
+                reject(overloaded_response);
+                offset = size;
+                retained = 0;
+                consumed = 0;
+            }
+            break;
         }
 
-        socket_acceptor_.listen();
-
-        // Perform first server accept
-        accept();
-    };
-
-    io_context_->dispatch(start_handler);
-}
-
-void
-WebServer::accept()
-{
-    asio::error_code ec;
-    assert(started_ && "Server it not started");
-    if(!started_)
-    {
-        ec = make_error(server_error::server_not_started);
-        on_error_(ec);
-        return;
-    }
+        offset += parser_.consumed();
 
-    auto accept_handler = [this, &ec]()
-    {
-        if(!started_)
+        if (!result)
         {
-            ec = make_error(server_error::server_not_started);
-            on_error_(ec);
+            //logger_->error("[http_session][on_received] no http request");
+            disconnect(ec);
             return;
         }
 
-        auto session_id = ++last_session_id_;
-        auto session = create_session(session_id);
-        register_session(session);
-
-        auto async_accept_handler = [this, session_id, session](std::error_code ec)
+        if (server_->overloaded())
         {
-            if(ec)
-            {
-                on_error_(ec);
-                return;
-            }
-
-            
-            session->connect();
+            // Shed the load before any middleware runs, a request with a
+            // body was already checked by on_head
+            reject(overloaded_response);
+            offset = size;
+            break;
+        }
 
-            auto disconnect_session = [session_id, session](asio::error_code ec)
-            {
-                if(!session->is_connected())
-                    return;
+        // The response is queued, pipelined responses are sent with one write
+        auto keep_alive = handle_request(*result);
 
-                session->disconnect();
-            };
+        // The next request of this connection starts from a clean parser
+        // and an empty arena
+        finish_request();
+        parser_.reset();
+        worker_.request_arena_.reset();
 
-            // Expire session
-           asio::steady_timer expire_session_t(*io_context_);
-           expire_session_t.expires_after(std::chrono::seconds(15));
-           expire_session_t.async_wait(disconnect_session);
+        if (!keep_alive)
+        {
+            // Disconnect once the responses are flushed
+            close_after_send_ = true;
+            offset = size;
+            break;
+        }
+    }
 
+    // The body of a handled or rejected request is given back
+    charge_body();
 
-            // Next server accept
-            accept();
-        };
+    // Incomplete request, wait for the next read to complete it
+    keep_pending(bytes + offset, size - offset, retained, consumed);
 
-        socket_acceptor_.async_accept(session->socket(), async_accept_handler);
-    };
+    update_read_deadline(requests_served != requests_served_);
 
-    io_context_->dispatch(accept_handler);
+    // send responses
+    flush();
+    //logger_->info("[http_session][on_received] Message sent to the client");
 }
 
 void
-WebServer::stop()
+WebSession::pause_body()
 {
-    asio::error_code ec;
-    assert(!started_ && "Service is not started");
-    if(!started_)
-    {
-        ec = make_error(service_error::service_not_started);
-        on_error_(ec);
+    if(body_paused_)
         return;
-    }
 
-    started_ = false;
+    // Until resume_body, the session is not recycled
+    body_paused_ = true;
+    ++pending_ops_;
 
-    if(context_worker_thread_.joinable())
-        context_worker_thread_.join();
+    // The armed multishot receive is stopped, a read wait is not renewed
+    if(worker_.uring_ && receiving_)
+        worker_.uring_->cancel(receive_op_);
 }
 
-shared_ptr<WebSession>
-WebServer::create_session(uint64_t session_id)
+void
+WebSession::resume_body()
 {
-    auto self = shared_from_this();
-    return std::make_shared<WebSession>(session_id, self, on_error_);
-}
+    --pending_ops_;
+    body_paused_ = false;
+    parser_.resume();
+
+    if(connected_)
+    {
+        // The bytes kept meanwhile: the rest of the request and the next ones
+        if(receive_pending_ > 0)
+            on_receive(receive_buffer_.data(), receive_pending_);
+
+        release_receive_buffer();
+
+        if(connected_ && !close_after_send_)
+            try_receive();
+    }
+
+    try_release();
+}
+
+void
+WebSession::linger()
+{
+    if(lingering_)
+        return;
+
+    // Closing with unread input resets the connection, and the client may
+    // lose the response before reading it: the input is read and dropped
+    // until the client closes, or the deadline
+    asio::error_code ec;
+    socket_.shutdown(asio::socket_base::shutdown_send, ec);
+    if(ec)
+    {
+        disconnect(ec);
+        return;
+    }
+
+    lingering_ = true;
+
+    auto const timeout = server_->options_.linger_timeout;
+    if(timeout.count() == 0)
+    {
+        disconnect();
+        return;
+    }
+
+    timer_wheel_.arm(read_deadline_, timeout, static_cast<std::uint8_t>(deadline::linger));
+    try_receive();
+}
+
+void
+WebSession::charge_body()
+{
+    auto const buffered = parser_.body_buffered();
+    if (buffered >= body_charged_)
+        server_->buffered_bytes_ += buffered - body_charged_;
+    else
+        server_->buffered_bytes_ -= body_charged_ - buffered;
+
+    body_charged_ = buffered;
+}
+
+void
+WebSession::reject(std::string_view response)
+{
+    parser_.reset();
+    finish_request();
+    close_after_send_ = true;
+
+    // The client may still be sending the request
+    linger_on_close_ = true;
+
+    if(!response.empty())
+        enqueue_static(response);
+}
+
+std::shared_ptr<http::body_reader>
+WebSession::on_head(http::http_request const& head, std::error_code& ec)
+{
+    // Shed the load before the body is read: a client that expects
+    // "100-continue" never sends it, the body of the others is dropped by
+    // the lingering close instead of being charged to the budget
+    if(server_->overloaded())
+    {
+        enqueue_static(overloaded_response);
+        ec = http::make_error(http::http_error::request_rejected);
+        return nullptr;
+    }
+
+    // The body may come with later reads, the worker arena is reset in
+    // between: the state kept from the head has the memory of the session
+    http::http_request request = head;
+    request.arena(hold_arena());
+
+    // The route is resolved once, the complete request reuses it
+    head_routed_ = resolve(request);
+    head_resolved_ = true;
+
+    // The values view the target, the receive buffer may move before the
+    // body is complete
+    for(std::size_t i = 0; head_routed_ && i < match_.values.size; ++i)
+        match_offsets_[i] = static_cast<std::size_t>(match_.values.values[i].data() - head.target().data());
+
+    // HTTP/1.0 clients do not wait for an interim response (RFC 7231 5.1.1)
+    auto const& headers = head.headers();
+    auto expect = headers.find(http::http_field::expect);
+    auto const expects_continue = head.version() >= 11 && expect != headers.end() &&
+        common::string_utils::iequals(expect->second, "100-continue");
+
+    // The client waits before sending the body: decide on the head alone
+    if(expects_continue && !accept_head(request))
+    {
+        ec = http::make_error(http::http_error::request_rejected);
+        return nullptr;
+    }
+
+    head_accepted_ = expects_continue;
+
+    // The first middleware that streams the body of the request wins
+    std::shared_ptr<http::body_reader> reader;
+    for(auto& middleware : server_->middlewares_)
+    {
+        reader = middleware->accept_body(request);
+        if(reader)
+            break;
+    }
+
+    // Flushed at the end of the read, before any byte of the body is expected
+    if(expects_continue)
+        enqueue_static(continue_response);
+
+    return reader;
+}
+
+bool
+WebSession::accept_head(http::http_request const& head)
+{
+    http::http_response response{head.arena()};
+    for(auto& middleware : server_->middlewares_)
+    {
+        if(middleware->accept_head(head, response))
+            continue;
+
+        // The body is never read, the connection cannot be reused
+        response.set_header("Connection", "close");
+        enqueue(response.build_header());
+        enqueue(response.release_body());
+        return false;
+    }
+
+    return true;
+}
+
+bool
+WebSession::handle_request(http::http_request& request)
+{
+    // Headers and scratch state from the arena, the queued strings are not
+    http::http_response response{request.arena()};
+
+    if(!head_resolved_)
+        resolve(request);
+    else
+    {
+        // Resolved by on_head, the values move with the target. The values
+        // stored in the context by accept_head are kept.
+        for(std::size_t i = 0; head_routed_ && i < match_.values.size; ++i)
+            match_.values.values[i] = request.target().substr(match_offsets_[i], match_.values.values[i].size());
+
+        if(head_routed_)
+            request.match(&match_);
+
+        request.context(&context_);
+        request.head_accepted(head_accepted_);
+    }
+
+    // middlewares
+    for(auto& middleware : server_->middlewares_)
+    {
+        if(!middleware->execute(request, response))
+        {
+            break;
+        }
+    }
+
+    // Persistent connection
+    ++requests_served_;
+    auto max_requests = server_->options_.max_keep_alive_requests;
+    auto keep_alive = request.keep_alive() &&
+        (max_requests == 0 || requests_served_ < max_requests);
+
+    // A handler may close the connection, it is never kept open against
+    // its header, and the header always tells what the server does
+    auto const connection = common::string_utils::to_lower(response.header("Connection"));
+    if(connection.find("close") != std::string::npos)
+        keep_alive = false;
+
+    response.set_header("Connection", keep_alive ? "keep-alive" : "close");
+
+    // The body is moved, not copied, into the send queue
+    enqueue(response.build_header());
+    enqueue(response.release_body());
+
+    ++responses_pending_;
+    ++server_->inflight_requests_;
+
+    return keep_alive;
+}
+
+bool
+WebSession::resolve(http::http_request& request)
+{
+    // Request-scoped values of the middlewares, cleared with the request
+    request.context(&context_);
+
+    // The route is matched once, the middlewares share the result
+    for(auto& middleware : server_->middlewares_)
+    {
+        if(middleware->resolve(request, match_))
+        {
+            request.match(&match_);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::pmr::memory_resource*
+WebSession::hold_arena()
+{
+    if(!head_arena_)
+    {
+        arena_block_ = worker_.buffer_pool_.acquire();
+        head_arena_.emplace(arena_block_.data(), arena_block_.capacity(), std::pmr::new_delete_resource());
+    }
+
+    // The complete request is made by the parser with the same memory
+    parser_.arena(&*head_arena_);
+    return &*head_arena_;
+}
+
+void
+WebSession::finish_request()
+{
+    match_ = {};
+    head_resolved_ = false;
+    head_routed_ = false;
+    head_accepted_ = false;
+
+    // The values may hold memory of the arena
+    context_.clear();
+
+    if(head_arena_)
+    {
+        head_arena_.reset();
+        worker_.buffer_pool_.release(arena_block_);
+        parser_.arena(worker_.request_arena_.resource());
+    }
+}
+
+void
+WebSession::update_read_deadline(bool request_completed)
+{
+    auto const& options = server_->options_;
+
+    auto arm = [this](std::chrono::seconds timeout, deadline kind)
+    {
+        if (timeout.count() == 0)
+        {
+            read_deadline_.cancel();
+            return;
+        }
+
+        timer_wheel_.arm(read_deadline_, timeout, static_cast<std::uint8_t>(kind));
+    };
+
+    auto const current = read_deadline_.armed()
+        ? static_cast<deadline>(read_deadline_.kind())
+        : deadline::none;
+
+    if (close_after_send_ || parser_.paused())
+    {
+        // No more requests are read from this connection, or the server
+        // holds back the body, not the client
+        read_deadline_.cancel();
+        return;
+    }
+
+    if (parser_.parsephase() == http::parse_phase::not_started)
+    {
+        // Waiting for the next request of a persistent connection
+        if (receive_pending_ == 0 && requests_served_ > 0)
+        {
+            if (request_completed || current != deadline::keep_alive)
+                arm(options.keep_alive_timeout, deadline::keep_alive);
+            return;
+        }
+
+        // The header deadline counts from the first byte of the request,
+        // slow clients do not extend it by trickling bytes
+        if (request_completed || current != deadline::header_read)
+            arm(options.header_timeout, deadline::header_read);
+        return;
+    }
+
+    // Receiving the body, every read is progress
+    arm(options.body_timeout, deadline::body_read);
+}
+
+void
+WebSession::on_deadline(timer_wheel::entry& e, void* owner)
+{
+    auto session = static_cast<WebSession*>(owner);
+    if(!session->connected_)
+        return;
+
+    // The end of a lingering close is not an error
+    if(e.kind() == static_cast<std::uint8_t>(deadline::linger))
+    {
+        session->disconnect();
+        return;
+    }
+
+    session->disconnect(make_error(session_error::deadline_expired));
+}
+
+bool
+WebSession::send_async(void const* buffer, size_t size)
+{
+    asio::error_code ec;
+
+    if(size == 0)
+    {
+        ec = make_error(session_error::sent_bytes_is_zero);
+        disconnect();
+        return false;
+    }
+
+    assert((buffer != nullptr) && "Pointer to the buffer should no be null!");
+    if(buffer == nullptr)
+    {
+        ec = make_error(session_error::sent_buffer_is_nullptr);
+        disconnect();
+        return 0;
+    }
+
+    // Copy into an owned chunk of the send queue
+    auto bytes = static_cast<char const*>(buffer);
+    enqueue(std::string(bytes, bytes + size));
+
+    flush();
+    return true;
+}
+
+bool
+WebSession::send_response(std::string header, std::string body)
+{
+    enqueue(std::move(header));
+    enqueue(std::move(body));
+
+    flush();
+    return true;
+}
+
+void
+WebSession::enqueue(std::string chunk)
+{
+    if(chunk.empty())
+        return;
+
+    std::scoped_lock locker(send_lock_);
+
+    // The deque never moves its elements, so the buffer stays valid
+    auto& stored = send_chunks_main_.emplace_back(std::move(chunk));
+    send_buffers_main_.emplace_back(stored.data(), stored.size());
+
+    // Update Statistics
+    bytes_pending_ += stored.size();
+    server_->buffered_bytes_ += stored.size();
+}
+
+void
+WebSession::enqueue_static(std::string_view chunk)
+{
+    std::scoped_lock locker(send_lock_);
+
+    send_buffers_main_.emplace_back(chunk.data(), chunk.size());
+
+    // Update Statistics
+    bytes_pending_ += chunk.size();
+    server_->buffered_bytes_ += chunk.size();
+}
+
+void
+WebSession::sent(std::size_t size)
+{
+    // The counters were reset if the session was disconnected meanwhile
+    size = std::min(size, bytes_sending_);
+
+    bytes_sending_ -= size;
+    bytes_sent_ += size;
+    server_->buffered_bytes_ -= size;
+}
+
+void
+WebSession::flush_completed()
+{
+    send_chunks_flush_.clear();
+    send_buffers_flush_.clear();
+
+    server_->inflight_requests_ -= responses_sending_;
+    responses_sending_ = 0;
+}
+
+void
+WebSession::flush()
+{
+    {
+        std::scoped_lock locker(send_lock_);
+
+        // Avoid multiple send handlers
+        if(sending_ || send_buffers_main_.empty())
+            return;
+    }
+
+    ++pending_ops_;
+    auto send_handler = [this]()
+    {
+        --pending_ops_;
+        try_send();
+        try_release();
+    };
+
+    io_context_->dispatch(send_handler);
+}
+
+void
+WebSession::try_send()
+{
+    if(sending_)
+        return;
+
+    // Swap send queues
+    if(send_buffers_flush_.empty())
+    {
+        std::scoped_lock locker(send_lock_);
+
+        // Swap flush and main queues, the chunks are not moved in memory
+        send_chunks_flush_.swap(send_chunks_main_);
+        send_buffers_flush_.swap(send_buffers_main_);
+
+        // Update statistic
+        bytes_sending_ += bytes_pending_;
+        bytes_pending_ = 0;
+        responses_sending_ += responses_pending_;
+        responses_pending_ = 0;
+    }
+
+    // Check if the flush queue is empty
+    // because the main queue can be empty
+    if(send_buffers_flush_.empty())
+    {
+        write_deadline_.cancel();
+
+        // Everything was sent, close the connection if it was requested
+        if(close_after_send_)
+        {
+            if(linger_on_close_)
+                linger();
+            else
+                disconnect();
+        }
+
+        return;
+    }
+
+    // Async write with the write handler
+    sending_ = true;
+
+    auto write_timeout = server_->options_.write_timeout;
+    if(write_timeout.count() > 0)
+        timer_wheel_.arm(write_deadline_, write_timeout, static_cast<std::uint8_t>(deadline::write));
+
+    if(worker_.uring_)
+    {
+        send_iov_.clear();
+        send_iov_offset_ = 0;
+        for(auto const& b : send_buffers_flush_)
+            send_iov_.push_back(iovec{const_cast<void*>(b.data()), b.size()});
+
+        submit_send();
+        return;
+    }
+
+    ++pending_ops_;
+    auto async_write_handler = [this](std::error_code ec, size_t size)
+    {
+        sending_ = false;
+        --pending_ops_;
+
+        // Update statistics
+        sent(size);
+
+        if(ec)
+        {
+            //send_error(ec);
+            disconnect(ec);
+            try_release();
+            return;
+        }
+
+        // The whole flush queue was sent
+        flush_completed();
+
+        // Try to send again if the session is valid
+        try_send();
+    };
+
+    // Headers and bodies of all queued responses in one gathered write (writev)
+    asio::async_write(socket_, send_buffers_flush_, async_write_handler);
+}
+
+void
+WebSession::submit_send()
+{
+    auto remaining = send_iov_.size() - send_iov_offset_;
+
+    send_msg_ = msghdr{};
+    send_msg_.msg_iov = send_iov_.data() + send_iov_offset_;
+    send_msg_.msg_iovlen = std::min<std::size_t>(remaining, IOV_MAX);
+
+    ++pending_ops_;
+    worker_.uring_->send(socket_.native_handle(), &send_msg_, send_op_);
+}
+
+void
+WebSession::on_uring_send(uring_operation& op, int result, bool, char const*)
+{
+    auto session = static_cast<WebSession*>(op.owner);
+    --session->pending_ops_;
+
+    if(!session->connected_)
+    {
+        session->sending_ = false;
+        session->try_release();
+        return;
+    }
+
+    if(result < 0)
+    {
+        session->sending_ = false;
+        session->disconnect(asio::error_code(-result, asio::error::get_system_category()));
+        session->try_release();
+        return;
+    }
+
+    // Update statistics
+    auto size = static_cast<std::size_t>(result);
+    session->sent(size);
+
+    // Skip what the kernel took, a short send resumes inside an iovec
+    auto& iov = session->send_iov_;
+    auto& index = session->send_iov_offset_;
+    while(index < iov.size() && size >= iov[index].iov_len)
+        size -= iov[index++].iov_len;
+
+    if(index < iov.size())
+    {
+        iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + size;
+        iov[index].iov_len -= size;
+        session->submit_send();
+        return;
+    }
+
+    // The whole flush queue was sent
+    session->sending_ = false;
+    session->flush_completed();
+
+    session->try_send();
+    session->try_release();
+}
+
+void
+WebSession::send_error(asio::error_code ec)
+{
+    // Skip asio disconnect errors
+    if ((ec == asio::error::connection_aborted) ||
+        (ec == asio::error::connection_refused) ||
+        (ec == asio::error::connection_reset) ||
+        (ec == asio::error::eof) ||
+        (ec == asio::error::operation_aborted))
+        return;
+
+    //on_error(ec);
+}
+
+// ---------------------------------------------------------------------------
+
+WebServer::WebServer(
+        std::string host,
+        uint16_t port,
+        OnCb const& cb,
+        server_options options)
+    : options_(options)
+    , started_(false)
+    , next_worker_(0)
+    , shard_acceptors_(false)
+    , host_(std::move(host))
+    , port_(port)
+    , on_error_(cb)
+{
+    auto io_threads = options_.io_threads;
+    if(io_threads == 0)
+        io_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // The worker index is part of the session ids
+    io_threads = std::min(io_threads, session_registry<WebSession>::max_shards);
+
+    workers_.reserve(io_threads);
+    for(std::size_t i = 0; i < io_threads; ++i)
+        workers_.push_back(std::make_unique<WebWorker>(this, i, options_));
+
+    if(options_.transport == transport_backend::io_uring)
+    {
+        for(auto& worker : workers_)
+        {
+            asio::error_code ec;
+            worker->uring_ = io_uring_transport::create(*worker->io_context_, ec);
+            if(worker->uring_)
+            {
+                worker->accept_op_ = uring_operation{&WebServer::on_uring_accept, worker.get()};
+                continue;
+            }
+
+            // Unsupported kernel or build: every worker stays on the asio reactor
+            on_error_(ec);
+            for(auto& w : workers_)
+                w->uring_.reset();
+            break;
+        }
+    }
+
+#if defined(SO_REUSEPORT)
+    shard_acceptors_ = options_.reuse_port && io_threads > 1;
+#endif
+}
+
+WebServer::~WebServer()
+{
+    for(auto& worker : workers_)
+    {
+        worker->io_context_->stop();
+        if(worker->thread_.joinable())
+            worker->thread_.join();
+    }
+}
+
+void 
+WebServer::start()
+{
+    assert(!started_ && "Webserver is already started");
+    
+    started_ = true;
+
+    // Before any I/O thread reads them
+    for(auto& middleware : middlewares_)
+        middleware->prepare();
+
+    for(auto& w : workers_)
+    {
+        auto& worker = *w;
+
+        // Run I/O thread
+        worker.thread_ = std::thread(&WebServer::context_handler, this, std::ref(worker));
+
+        auto timer_wheel_handler = [this, &worker]()
+        {
+            run_timer_wheel(worker);
+        };
+
+        worker.io_context_->dispatch(timer_wheel_handler);
+
+        // Without SO_REUSEPORT only the first worker accepts
+        if(!shard_acceptors_ && worker.index_ != 0)
+            continue;
+
+        auto start_handler = [this, &worker]()
+        {
+            listen(worker);
+        };
+
+        worker.io_context_->dispatch(start_handler);
+    }
+}
+
+void
+WebServer::listen(WebWorker& worker)
+{
+    asio::error_code ec;
+    asio::ip::tcp::endpoint endpoint(asio::ip::make_address(host_, ec), port_);
+
+    if(ec.value())
+    {
+        on_error_(ec);
+        return;
+    }
+
+    auto& acceptor = worker.acceptor_;
+
+    auto _ = acceptor.open(endpoint.protocol(), ec);
+    if (ec.value())
+    {
+        on_error_(ec);
+        return;
+    }
+
+    acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true), ec);
+
+#if defined(SO_REUSEPORT)
+    // Every worker binds the same endpoint, the kernel balances the connections
+    if(shard_acceptors_)
+    {
+        using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        acceptor.set_option(reuse_port(true), ec);
+        if(ec.value())
+        {
+            on_error_(ec);
+            return;
+        }
+    }
+#endif
+
+    _ = acceptor.bind(endpoint, ec);
+    if(ec.value())
+    {
+        on_error_(ec);
+        return;
+    }
+
+    acceptor.listen();
+    worker.listen_protocol_ = endpoint.protocol();
+
+    // Perform first server accept
+    accept(worker);
+}
+
+WebWorker&
+WebServer::next_worker(WebWorker& acceptor_worker)
+{
+    // Sharded acceptors keep the session on the thread that accepted it
+    if(shard_acceptors_)
+        return acceptor_worker;
+
+    return *workers_[next_worker_++ % workers_.size()];
+}
+
+void
+WebServer::accept(WebWorker& worker)
+{
+    asio::error_code ec;
+    assert(started_ && "Server it not started");
+    if(!started_)
+    {
+        ec = make_error(server_error::server_not_started);
+        on_error_(ec);
+        return;
+    }
+
+    auto accept_handler = [this, &worker]()
+    {
+        if(!started_)
+        {
+            auto ec = make_error(server_error::server_not_started);
+            on_error_(ec);
+            return;
+        }
+
+        if(connection_limit_reached())
+        {
+            // Pause, the next closed session re-arms the accept. Check again
+            // in case it closed before the flag was visible.
+            worker.accept_paused_ = true;
+            if(connection_limit_reached() || !worker.accept_paused_.exchange(false))
+                return;
+        }
+
+        if(worker.uring_)
+        {
+            // One multishot accept serves the listening socket
+            worker.uring_->accept_multishot(worker.acceptor_.native_handle(), worker.accept_op_);
+            return;
+        }
+
+        auto& session_worker = next_worker(worker);
+
+        auto async_accept_handler = [this, &worker, &session_worker](std::error_code ec, asio::ip::tcp::socket socket)
+        {
+            if(ec)
+            {
+                on_error_(ec);
+                return;
+            }
+
+            ++connections_;
+
+            auto connect_handler = [this, &session_worker, socket = std::move(socket)]() mutable
+            {
+                // Sessions are taken from the pool and registered by the worker that runs them
+                auto session = create_session(session_worker, std::move(socket));
+                session->connect();
+            };
+
+            // The session belongs to its worker from now on
+            asio::dispatch(*session_worker.io_context_, std::move(connect_handler));
+
+            // Next server accept
+            accept(worker);
+        };
+
+        // The socket is created on the io_context of the worker that will run the session
+        worker.acceptor_.async_accept(*session_worker.io_context_, async_accept_handler);
+    };
+
+    worker.io_context_->dispatch(accept_handler);
+}
+
+void
+WebServer::on_uring_accept(uring_operation& op, int result, bool more, char const*)
+{
+    auto& worker = *static_cast<WebWorker*>(op.owner);
+    auto server = worker.server_;
+
+    if(!server->started_)
+    {
+        if(result >= 0)
+            ::close(result);
+        return;
+    }
+
+    if(result < 0)
+    {
+        server->on_error_(asio::error_code(-result, asio::error::get_system_category()));
+    }
+    else if(server->connection_limit_reached())
+    {
+        // The multishot accept cannot be paused, shed the connection instead
+        ::send(result, overloaded_response.data(), overloaded_response.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        ::close(result);
+    }
+    else
+    {
+        auto& session_worker = server->next_worker(worker);
+        auto fd = result;
+        auto protocol = worker.listen_protocol_;
+        ++server->connections_;
+
+        auto connect_handler = [server, &session_worker, fd, protocol]()
+        {
+            asio::error_code ec;
+            asio::ip::tcp::socket socket(*session_worker.io_context_);
+            auto _ = socket.assign(protocol, fd, ec);
+            if(ec)
+            {
+                ::close(fd);
+                --server->connections_;
+                server->resume_accepting();
+                server->on_error_(ec);
+                return;
+            }
+
+            auto session = server->create_session(session_worker, std::move(socket));
+            session->connect();
+        };
+
+        asio::dispatch(*session_worker.io_context_, connect_handler);
+    }
+
+    // The kernel ended the multishot accept, arm it again
+    if(!more)
+        server->accept(worker);
+}
 
 void
-WebServer::register_session(shared_ptr<WebSession> session)
+WebServer::stop()
+{
+    asio::error_code ec;
+    assert(started_ && "Service is not started");
+    if(!started_)
+    {
+        ec = make_error(service_error::service_not_started);
+        on_error_(ec);
+        return;
+    }
+
+    started_ = false;
+
+    for(auto& worker : workers_)
+        worker->io_context_->stop();
+
+    for(auto& worker : workers_)
+    {
+        if(worker->thread_.joinable())
+            worker->thread_.join();
+    }
+}
+
+WebSession*
+WebServer::create_session(WebWorker& worker, asio::ip::tcp::socket socket)
 {
-    std::unique_lock<std::shared_mutex> m(sessions_lock_);
+    // Recycled session, or a new one constructed in the slab of the worker
+    auto session = worker.session_pool_.acquire(this, worker, on_error_);
 
-    sessions_.emplace(session->session_id(), session);
+    // The id comes from the slot of the worker registry, no shared counter or lock
+    auto session_id = worker.sessions_.insert(session);
+    session->attach(session_id, std::move(socket));
+
+    return session;
 }
 
 void
 WebServer::unregister_session(uint64_t id)
 {
-    std::unique_lock<std::shared_mutex> m (sessions_lock_);
+    // Called from the thread of the session, which owns the shard
+    auto& worker = *workers_[session_registry<WebSession>::shard_of(id)];
+    if(!worker.sessions_.erase(id))
+        return;
+
+    --connections_;
+    resume_accepting();
+}
+
+bool
+WebServer::connection_limit_reached() const noexcept
+{
+    return options_.max_connections != 0 &&
+        connections_.load(std::memory_order_relaxed) >= options_.max_connections;
+}
+
+bool
+WebServer::overloaded() const noexcept
+{
+    if(options_.max_inflight_requests != 0 &&
+        inflight_requests_.load(std::memory_order_relaxed) >= options_.max_inflight_requests)
+        return true;
+
+    return over_memory_budget();
+}
+
+bool
+WebServer::over_memory_budget() const noexcept
+{
+    return options_.memory_budget != 0 &&
+        buffered_bytes_.load(std::memory_order_relaxed) >= options_.memory_budget;
+}
+
+void
+WebServer::resume_accepting()
+{
+    if(connection_limit_reached())
+        return;
+
+    for(auto& worker : workers_)
+    {
+        if(worker->accept_paused_.exchange(false))
+            accept(*worker);
+    }
+}
 
-    auto it = sessions_.find(id);
-    if(it != sessions_.end())
+void
+WebServer::for_each_session(std::function<void(WebSession&)> fn)
+{
+    for(auto& w : workers_)
     {
-        sessions_.erase(it);
+        auto& worker = *w;
+        auto for_each_handler = [&worker, fn]()
+        {
+            worker.sessions_.for_each(fn);
+        };
+
+        asio::post(*worker.io_context_, for_each_handler);
     }
 }
 
@@ -551,20 +1637,39 @@ WebServer::add_middleware(shared_ptr<http::middleware> const middleware)
 }
 
 void
-WebServer::context_handler()
+WebServer::run_timer_wheel(WebWorker& worker)
+{
+    auto tick_handler = [this, &worker](asio::error_code const& ec)
+    {
+        if(ec || !started_)
+            return;
+
+        // Expire the deadlines of the sessions of this worker
+        worker.timer_wheel_.advance();
+
+        run_timer_wheel(worker);
+    };
+
+    // One steady timer per worker drives all the session deadlines
+    worker.timer_wheel_tick_.expires_after(worker.timer_wheel_.resolution());
+    worker.timer_wheel_tick_.async_wait(tick_handler);
+}
+
+void
+WebServer::context_handler(WebWorker& worker)
 {
     try
     {
-        asio::io_context::work worker(*io_context_);
+        auto work = asio::make_work_guard(*worker.io_context_);
 
         do
         {
             // Blocks execution while there are unfinished asynchronous operations.
             // While inside the call to io_context::run(), the I/O execution context dequeue
             // the result of the operation, translates it into error_code, and then passes it to your completion handler.
-            io_context_->run();
+            worker.io_context_->run();
         }
-        while(started_);
+        while(started_ && !worker.io_context_->stopped());
     }
     catch(std::exception const& ex)
     {
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <asio.hpp>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <sys/socket.h>
+
+namespace webcrown {
+namespace server {
+
+/// Completion target of an operation submitted to the ring.
+/// Embedded in the object that owns the operation (session or worker).
+struct uring_operation
+{
+    /// \param result   bytes transferred, accepted fd, or -errno
+    /// \param more     a multishot operation stays armed
+    /// \param data     received bytes for buffer-select receives, they are
+    ///                 only valid during the call
+    using callback = void (*)(uring_operation& op, int result, bool more, char const* data);
+
+    callback cb{nullptr};
+    void* owner{nullptr};
+};
+
+/// Linux io_uring transport of one I/O thread.
+/// Accepts with a multishot accept, receives with multishot receives into a
+/// ring of provided buffers registered with the kernel, and batches the
+/// submissions: operations queued while handling completions are submitted
+/// with one io_uring_enter. Completions are signalled through an eventfd
+/// watched by the io_context, so timers and posted handlers keep working.
+///
+/// Registered (fixed) buffers are not used. Receives cannot target them,
+/// the provided buffer ring is what plays their role here: the receive
+/// buffers are handed to the kernel once and recycled without any
+/// per-operation setup. Sends gather the strings of each response, which are
+/// allocated per response and cannot be registered up front.
+///
+/// Only available when built with ENABLE_IO_URING (WEBCROWN_HAS_IO_URING),
+/// create() returns nullptr otherwise or when the kernel lacks support.
+class io_uring_transport
+{
+    struct ring_state;
+
+    asio::io_context& io_context_;
+    std::unique_ptr<ring_state> state_;
+    asio::posix::stream_descriptor completion_event_;
+    bool submit_scheduled_;
+public:
+    static std::unique_ptr<io_uring_transport> create(asio::io_context& io_context, std::error_code& ec);
+
+    explicit io_uring_transport(asio::io_context& io_context);
+    ~io_uring_transport();
+
+    io_uring_transport(io_uring_transport const&) = delete;
+    io_uring_transport& operator=(io_uring_transport const&) = delete;
+
+    /// Accepts connections on listen_fd until cancelled, one completion per connection
+    void accept_multishot(int listen_fd, uring_operation& op);
+
+    /// Receives into provided buffers until the connection ends or is cancelled
+    void receive_multishot(int fd, uring_operation& op);
+
+    /// Gathered send of msg, which must live until the completion
+    void send(int fd, msghdr const* msg, uring_operation& op);
+
+    /// Cancels every operation on fd, their completions are still delivered
+    void cancel(int fd);
+
+    /// Cancels the operation of op, like a multishot receive: its last
+    /// completion fails with -ECANCELED
+    void cancel(uring_operation& op);
+
+private:
+    void wait_completions();
+    void reap();
+    void schedule_submit();
+};
+
+} // server
+} // webcrown
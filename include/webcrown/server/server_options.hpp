@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace webcrown {
+namespace server {
+
+/// Socket I/O implementation of the I/O threads
+enum class transport_backend
+{
+    /// asio reactor (epoll, kqueue, ...), available everywhere
+    asio,
+    /// Linux io_uring, requires a build with ENABLE_IO_URING. The server
+    /// falls back to asio when the kernel or the build lacks support.
+    io_uring
+};
+
+/// Tuning knobs of the WebServer.
+/// The defaults keep the historical behaviour: one I/O thread.
+struct server_options
+{
+    /// Number of I/O threads. Each thread drives its own io_context,
+    /// accepts its own connections and keeps them until they are closed.
+    /// Zero means one thread per core (std::thread::hardware_concurrency).
+    std::size_t io_threads{1};
+
+    /// When enabled, and supported by the platform, every I/O thread
+    /// opens its own acceptor with SO_REUSEPORT so the kernel balances the
+    /// incoming connections. Otherwise the first thread accepts and
+    /// distributes the sessions round-robin between the threads.
+    bool reuse_port{true};
+
+    /// A persistent connection without any request during this
+    /// interval is closed by the server.
+    std::chrono::seconds keep_alive_timeout{15};
+
+    /// Maximum number of requests served by one connection before the
+    /// server answers with "Connection: close". Zero means unlimited.
+    std::size_t max_keep_alive_requests{1000};
+
+    /// Time allowed to receive the start line and the headers of a request,
+    /// counted from its first byte. Zero disables the deadline.
+    std::chrono::seconds header_timeout{10};
+
+    /// Maximum silence while receiving a request body.
+    std::chrono::seconds body_timeout{30};
+
+    /// Maximum time without progress while sending a response.
+    std::chrono::seconds write_timeout{30};
+
+    /// Time a connection closed after a rejected request keeps reading and
+    /// dropping the rest of the request, so that the client receives the
+    /// response instead of a reset. Zero closes right away.
+    std::chrono::seconds linger_timeout{2};
+
+    /// Free receive buffers each I/O thread keeps for reuse, in bytes.
+    /// Sessions borrow receive buffers only while reading.
+    std::size_t receive_buffer_cache{32 * 1024 * 1024};
+
+    /// Admission control: open connections accepted at most. The acceptors
+    /// pause at the limit and resume when a connection closes.
+    /// Zero means unlimited.
+    std::size_t max_connections{0};
+
+    /// Requests whose response is not sent yet, across all connections.
+    /// Past the limit new requests are answered 503 without running the
+    /// middlewares or reading their body, and their connection is closed.
+    /// Zero means unlimited.
+    std::size_t max_inflight_requests{0};
+
+    /// Bytes queued for sending and request bodies gathered across reads,
+    /// across all connections. Past the budget new requests are answered 503
+    /// like above, as is a request whose body is still being read.
+    /// Zero means unlimited.
+    std::size_t memory_budget{0};
+
+    /// Socket I/O implementation, chosen when the server is constructed.
+    transport_backend transport{transport_backend::asio};
+
+    /// Request size limits, enforced while the request is read. Past them
+    /// the request is answered 414 (request line), 431 (header fields) or
+    /// 413 (body) and the connection is closed, the rest is read and dropped
+    /// during linger_timeout, never buffered.
+    std::size_t max_start_line{8192};
+    std::size_t max_header_fields{100};
+    std::size_t max_header_bytes{16 * 1024};
+    std::size_t max_body_size{64 * 1024 * 1024};
+
+    /// Longest chunk size line, extensions included, or trailer field line
+    /// of a chunked body. A longer line is malformed, the connection is
+    /// closed like for any other parse error.
+    std::size_t max_chunk_line{1024};
+};
+
+} // server
+} // webcrown
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace webcrown {
+namespace server {
+
+/// Generation-tagged slot array of the sessions of one I/O thread.
+/// Only the owning thread inserts, erases and iterates, so no lock is needed;
+/// other threads reach a shard by posting to its io_context.
+///
+/// A session id packs the slot index, the shard (worker) index and the
+/// generation of the slot:
+///     [ generation : 24 ][ shard : 8 ][ slot : 32 ]
+/// The generation is bumped when a slot is freed, so an id of a closed
+/// session never resolves to the session that reuses its slot.
+template <typename T>
+class session_registry
+{
+    struct slot
+    {
+        T* value{nullptr};
+        std::uint32_t generation{1};
+    };
+
+    std::uint32_t shard_;
+    std::vector<slot> slots_;
+    std::vector<std::uint32_t> free_;
+    std::size_t size_{0};
+
+    static constexpr std::uint32_t generation_mask = 0xffffff;
+public:
+    static constexpr std::size_t max_shards = 256;
+
+    explicit session_registry(std::uint32_t shard)
+        : shard_(shard)
+    {
+        assert(shard < max_shards);
+    }
+
+    session_registry(session_registry const&) = delete;
+    session_registry& operator=(session_registry const&) = delete;
+
+    static std::uint32_t shard_of(std::uint64_t id) noexcept
+    {
+        return static_cast<std::uint32_t>((id >> 32) & 0xff);
+    }
+
+    /// Stores the value in a free slot
+    /// \return the id of the slot
+    std::uint64_t insert(T* value)
+    {
+        std::uint32_t index;
+        if (!free_.empty())
+        {
+            index = free_.back();
+            free_.pop_back();
+        }
+        else
+        {
+            index = static_cast<std::uint32_t>(slots_.size());
+            slots_.emplace_back();
+        }
+
+        auto& s = slots_[index];
+        s.value = value;
+        ++size_;
+
+        return (static_cast<std::uint64_t>(s.generation) << 40) |
+               (static_cast<std::uint64_t>(shard_) << 32) |
+               index;
+    }
+
+    /// Frees the slot of id, stale ids are ignored
+    bool erase(std::uint64_t id)
+    {
+        auto s = resolve(id);
+        if (!s)
+            return false;
+
+        s->value = nullptr;
+        s->generation = (s->generation + 1) & generation_mask;
+        if (s->generation == 0)
+            s->generation = 1;
+
+        free_.push_back(static_cast<std::uint32_t>(s - slots_.data()));
+        --size_;
+        return true;
+    }
+
+    T* find(std::uint64_t id) const
+    {
+        auto s = const_cast<session_registry*>(this)->resolve(id);
+        return s ? s->value : nullptr;
+    }
+
+    /// Calls f for every registered value
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        for (auto const& s : slots_)
+        {
+            if (s.value)
+                f(*s.value);
+        }
+    }
+
+    std::size_t size() const noexcept { return size_; }
+
+private:
+    slot* resolve(std::uint64_t id)
+    {
+        auto index = static_cast<std::uint32_t>(id & 0xffffffff);
+        auto generation = static_cast<std::uint32_t>(id >> 40) & generation_mask;
+
+        if (shard_of(id) != shard_ || index >= slots_.size())
+            return nullptr;
+
+        auto& s = slots_[index];
+        if (s.value == nullptr || s.generation != generation)
+            return nullptr;
+
+        return &s;
+    }
+};
+
+} // server
+} // webcrown
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace webcrown {
+namespace server {
+
+/// Pool of recyclable objects allocated in slabs.
+/// Objects are constructed once, in place, inside slabs of SlabSize slots.
+/// A released object is not destroyed: it goes back to the free list with
+/// everything it owns (buffers, containers capacity) and is handed out again
+/// by the next acquire. The pool is meant to be used by one thread.
+template <typename T, std::size_t SlabSize = 64>
+class slab_pool
+{
+    struct slab_deleter
+    {
+        void operator()(std::byte* p) const noexcept
+        {
+            ::operator delete(p, std::align_val_t{alignof(T)});
+        }
+    };
+
+    using slab_ptr = std::unique_ptr<std::byte, slab_deleter>;
+
+    std::vector<slab_ptr> slabs_;
+    std::vector<T*> free_;
+    std::vector<T*> objects_;
+    // Slots used in the last slab
+    std::size_t slab_used_{SlabSize};
+public:
+    slab_pool() = default;
+
+    slab_pool(slab_pool const&) = delete;
+    slab_pool& operator=(slab_pool const&) = delete;
+
+    ~slab_pool()
+    {
+        for (auto obj : objects_)
+            obj->~T();
+    }
+
+    /// Returns a recycled object, or constructs a new one with args.
+    template <typename... Args>
+    T* acquire(Args&&... args)
+    {
+        if (!free_.empty())
+        {
+            auto obj = free_.back();
+            free_.pop_back();
+            return obj;
+        }
+
+        if (slab_used_ == SlabSize)
+        {
+            auto raw = ::operator new(sizeof(T) * SlabSize, std::align_val_t{alignof(T)});
+            slabs_.emplace_back(static_cast<std::byte*>(raw));
+            slab_used_ = 0;
+
+            // Keep the free list from growing during a connection storm
+            free_.reserve(slabs_.size() * SlabSize);
+            objects_.reserve(slabs_.size() * SlabSize);
+        }
+
+        auto slot = slabs_.back().get() + sizeof(T) * slab_used_;
+        auto obj = ::new (static_cast<void*>(slot)) T(std::forward<Args>(args)...);
+        ++slab_used_;
+
+        objects_.push_back(obj);
+        return obj;
+    }
+
+    /// Gives the object back to the pool, it is not destroyed.
+    void release(T* obj)
+    {
+        assert(obj != nullptr);
+        free_.push_back(obj);
+    }
+
+    /// Number of objects constructed by the pool
+    std::size_t capacity() const noexcept { return objects_.size(); }
+
+    /// Number of objects ready to be reused
+    std::size_t available() const noexcept { return free_.size(); }
+};
+
+} // server
+} // webcrown
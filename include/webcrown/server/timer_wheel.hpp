@@ -0,0 +1,190 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cassert>
+#include <vector>
+
+namespace webcrown {
+namespace server {
+
+/// Hashed timer wheel.
+/// Deadlines are rounded up to the wheel resolution and linked into the
+/// slot of their expiration tick, so arming, rearming and cancelling are O(1)
+/// and do not allocate. One wheel serves all the sessions of an I/O thread;
+/// it is not thread safe.
+class timer_wheel
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// Intrusive node, embedded in the object that owns the deadline.
+    class entry
+    {
+        friend class timer_wheel;
+
+        using callback = void (*)(entry& e, void* owner);
+
+        entry* prev_{nullptr};
+        entry* next_{nullptr};
+        timer_wheel* wheel_{nullptr};
+        std::uint64_t expires_tick_{0};
+        std::uint8_t kind_{0};
+        callback cb_{nullptr};
+        void* owner_{nullptr};
+    public:
+        explicit entry(callback cb, void* owner) noexcept
+            : cb_(cb)
+            , owner_(owner)
+        {}
+
+        entry(entry const&) = delete;
+        entry& operator=(entry const&) = delete;
+
+        ~entry() { cancel(); }
+
+        bool armed() const noexcept { return wheel_ != nullptr; }
+
+        /// Caller defined tag of the armed deadline
+        std::uint8_t kind() const noexcept { return kind_; }
+
+        void cancel() noexcept
+        {
+            if (wheel_)
+                wheel_->unlink(*this);
+        }
+    };
+
+    explicit timer_wheel(
+        std::chrono::milliseconds resolution = std::chrono::milliseconds(100),
+        std::size_t slots = 1024)
+        : resolution_(resolution)
+        , slots_(slots, nullptr)
+        , mask_(slots - 1)
+        , current_tick_(0)
+        , origin_(clock::now())
+        , size_(0)
+    {
+        assert((slots & mask_) == 0 && "The number of slots must be a power of two");
+    }
+
+    timer_wheel(timer_wheel const&) = delete;
+    timer_wheel& operator=(timer_wheel const&) = delete;
+
+    std::chrono::milliseconds resolution() const noexcept { return resolution_; }
+
+    /// Number of armed entries
+    std::size_t size() const noexcept { return size_; }
+
+    /// Arms (or rearms) the entry to expire after timeout.
+    template <typename Duration>
+    void arm(entry& e, Duration timeout, std::uint8_t kind = 0)
+    {
+        auto ticks = (std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count() +
+                      resolution_.count() - 1) / resolution_.count();
+
+        // Never expire in the slot that is being processed
+        auto expires = tick_of(clock::now()) + static_cast<std::uint64_t>(ticks > 0 ? ticks : 1);
+
+        if (e.wheel_)
+            unlink(e);
+
+        e.expires_tick_ = expires;
+        e.kind_ = kind;
+        link(e);
+    }
+
+    /// Expires the entries up to now.
+    /// Must be called about once per resolution, late calls catch up.
+    void advance(clock::time_point now = clock::now())
+    {
+        auto const target = tick_of(now);
+
+        while (current_tick_ < target)
+        {
+            ++current_tick_;
+
+            // Move the due entries first, the callbacks may arm or cancel
+            // others, those still due included
+            auto e = slots_[current_tick_ & mask_];
+            while (e)
+            {
+                auto next = e->next_;
+                if (e->expires_tick_ <= current_tick_)
+                {
+                    unlink(*e);
+                    e->expires_tick_ = due_tick;
+                    link(*e);
+                }
+                e = next;
+            }
+
+            while (due_)
+            {
+                auto& expired = *due_;
+                unlink(expired);
+                expired.cb_(expired, expired.owner_);
+            }
+
+            // Nothing left to expire, jump straight to now
+            if (size_ == 0)
+                current_tick_ = target;
+        }
+    }
+
+private:
+    std::uint64_t tick_of(clock::time_point t) const noexcept
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(t - origin_);
+        return static_cast<std::uint64_t>(elapsed.count() / resolution_.count());
+    }
+
+    /// List of the entry: its slot, or the due list
+    entry*& head_of(entry const& e) noexcept
+    {
+        return e.expires_tick_ == due_tick ? due_ : slots_[e.expires_tick_ & mask_];
+    }
+
+    void link(entry& e) noexcept
+    {
+        auto& head = head_of(e);
+        e.prev_ = nullptr;
+        e.next_ = head;
+        if (head)
+            head->prev_ = &e;
+        head = &e;
+        e.wheel_ = this;
+        ++size_;
+    }
+
+    void unlink(entry& e) noexcept
+    {
+        if (e.prev_)
+            e.prev_->next_ = e.next_;
+        else
+            head_of(e) = e.next_;
+
+        if (e.next_)
+            e.next_->prev_ = e.prev_;
+
+        e.prev_ = nullptr;
+        e.next_ = nullptr;
+        e.wheel_ = nullptr;
+        --size_;
+    }
+
+private:
+    // Expiration tick of the entries whose callbacks are about to run
+    static constexpr std::uint64_t due_tick = ~std::uint64_t{0};
+
+    std::chrono::milliseconds resolution_;
+    std::vector<entry*> slots_;
+    entry* due_{nullptr};
+    std::uint64_t mask_;
+    std::uint64_t current_tick_;
+    clock::time_point origin_;
+    std::size_t size_;
+};
+
+} // server
+} // webcrown
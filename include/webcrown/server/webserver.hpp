@@ -2,11 +2,22 @@
 #include "asio/io_context.hpp"
 #include "webcrown/server/http/http_parser.hpp"
 #include "webcrown/server/http/middlewares/http_middleware.hpp"
+#include "webcrown/server/http/request_arena.hpp"
+#include "webcrown/server/server_options.hpp"
+#include "webcrown/server/timer_wheel.hpp"
+#include "webcrown/server/slab_pool.hpp"
+#include "webcrown/server/session_registry.hpp"
+#include "webcrown/server/buffer_pool.hpp"
+#include "webcrown/server/io_uring_transport.hpp"
 #include <asio.hpp>
+#include <array>
 #include <memory>
-#include <shared_mutex>
+#include <memory_resource>
+#include <optional>
 #include <vector>
-#include <map>
+#include <deque>
+#include <thread>
+#include <sys/uio.h>
 
 namespace webcrown {
 namespace server {
@@ -16,35 +27,120 @@ using std::shared_ptr;
 using std::atomic;
 
 class WebServer;
+class WebWorker;
 
-class WebSession : public std::enable_shared_from_this<WebSession>
+/// HTTP connection.
+/// Sessions are pooled by their worker: a closed session is recycled, with its
+/// parser and buffers, once none of its asynchronous operations is pending.
+class WebSession
 {
+    friend class WebServer;
+
     using OnCb = std::function<void(asio::error_code ec)>;
 
+    /// Kind of the deadline armed in the timer wheel
+    enum class deadline : std::uint8_t
+    {
+        none = 0,
+        header_read,
+        body_read,
+        keep_alive,
+        write,
+        linger
+    };
+
     shared_ptr<asio::io_context> io_context_;
-    shared_ptr<WebServer> server_;
+    WebWorker& worker_;
+    timer_wheel& timer_wheel_;
+    WebServer* server_;
     asio::ip::tcp::socket socket_;
 
-    atomic<bool> connected_;
-    atomic<bool> receiving_;
+    // Sessions are constructed in memory of the slab pool, nothing is zeroed
+    atomic<bool> connected_{false};
+    atomic<bool> receiving_{false};
+    // The body reader holds back the request, nothing is read
+    bool body_paused_{false};
+
+    // Asynchronous operations holding a reference to this session
+    std::size_t pending_ops_{0};
+    bool release_scheduled_{false};
 
     uint64_t session_id_;
 
-    vector<uint8_t> receive_buffer_;
+    // Borrowed from the worker pool while reading or holding an incomplete request
+    buffer_pool::buffer receive_buffer_;
+    // Bytes of an incomplete request at the beginning of the receive buffer
+    size_t receive_pending_{0};
+
+    // Statistics
+    size_t bytes_pending_{0};
+    size_t bytes_sending_{0};
+    size_t bytes_received_{0};
+    size_t bytes_sent_{0};
 
     std::mutex send_lock_;
 
-    std::vector<uint8_t> send_buffer_main_;
-    std::vector<uint8_t> send_buffer_flush_;
-    size_t send_buffer_flush_offset;
+    // Send queues: owned chunks and the buffers gathered by one write.
+    // Main is filled while flush is being written.
+    std::deque<std::string> send_chunks_main_;
+    std::vector<asio::const_buffer> send_buffers_main_;
+    std::deque<std::string> send_chunks_flush_;
+    std::vector<asio::const_buffer> send_buffers_flush_;
+
+    std::atomic<bool> sending_{false};
+    bool close_after_send_{false};
+    // A rejected request may still be arriving: after the response the
+    // input is drained before the close, see linger()
+    bool linger_on_close_{false};
+    bool lingering_{false};
+
+    // Persistent connection
+    std::size_t requests_served_{0};
+
+    // Responses in the main and flush queues, counted as in-flight requests
+    std::size_t responses_pending_{0};
+    std::size_t responses_sending_{0};
+
+    // Bytes of the body gathered by the parser, counted in the memory budget
+    std::size_t body_charged_{0};
+
+    // Header, body and keep-alive deadlines share the read entry
+    timer_wheel::entry read_deadline_;
+    timer_wheel::entry write_deadline_;
+
+    // io_uring transport: completion targets and the gathered send in flight
+    uring_operation receive_op_;
+    uring_operation send_op_;
+    std::vector<iovec> send_iov_;
+    std::size_t send_iov_offset_{0};
+    msghdr send_msg_{};
 
-    std::atomic<bool> sending_;
     http::parser parser_;
+
+    // Route of the request being read. A request with a body is resolved
+    // when its head is parsed, the complete request reuses the match.
+    http::route_match match_;
+    // Offsets of the path values in the target, the receive buffer moves
+    // while the body is read
+    std::array<std::size_t, http::max_path_parameters> match_offsets_{};
+    bool head_resolved_{false};
+    bool head_routed_{false};
+    bool head_accepted_{false};
+
+    // Values of the middlewares for the request being read, kept from its
+    // head to its response
+    http::http_context context_;
+
+    // Memory of a request whose head was handled before its body arrived,
+    // it outlives the reads in between. A block of the buffer pool.
+    buffer_pool::buffer arena_block_;
+    std::optional<std::pmr::monotonic_buffer_resource> head_arena_;
+
     OnCb& on_error_;
 public:
     explicit WebSession(
-        uint64_t session_id,
-        shared_ptr<WebServer> server,
+        WebServer* server,
+        WebWorker& worker,
         OnCb& cb);
 
     ~WebSession();
@@ -55,6 +151,10 @@ public:
     bool send_async(void const* buffer, size_t size);
     bool send_async(std::string_view text) { return send_async(text.data(), text.size()); }
 
+    /// Sends a response without copying it: header and body are moved into
+    /// the send queue and written with one gathered write.
+    bool send_response(std::string header, std::string body);
+
     void on_receive(void const* buffer, std::size_t size);
 
     bool is_connected() const noexcept { return connected_; }
@@ -64,34 +164,187 @@ public:
 private:
     void clear_buffers();
 
+    /// Brings the memory budget in line with the body gathered by the parser
+    void charge_body();
+
+    /// Shuts down the sending side and drops the input until the client
+    /// closes or the linger deadline expires, then disconnects
+    void linger();
+
+    /// Stops reading while the body reader is busy, see body_reader::pause
+    void pause_body();
+
+    /// Posted when the body reader resumes: parses the bytes kept meanwhile
+    /// and reads again
+    void resume_body();
+
+    /// Takes ownership of an accepted connection
+    void attach(uint64_t session_id, asio::ip::tcp::socket socket);
+
+    /// Gives the session back to the pool of its worker when it is
+    /// disconnected and no asynchronous operation references it anymore
+    void try_release();
+
     void try_receive();
 
+    /// Reads the available bytes into a pooled buffer and parses them
+    void receive();
+
+    /// Returns the receive buffer to the pool when no incomplete request needs it
+    void release_receive_buffer();
+
+    /// Keeps the incomplete request found at the end of a parsed buffer
+    /// at the beginning of the receive buffer: its retained head, then the
+    /// bytes the parser did not consume
+    void keep_pending(char const* bytes, std::size_t size, std::size_t retained, std::size_t consumed);
+
+    /// Parses bytes received by the io_uring transport in one of its
+    /// provided buffers, completing the pending request if there is one
+    void receive_provided(char const* data, std::size_t size);
+
+    static void on_uring_receive(uring_operation& op, int result, bool more, char const* data);
+
     void try_send();
 
-    std::size_t option_receive_buffer_size() const;
+    /// Submits the unsent part of the flush queue to the io_uring transport
+    void submit_send();
+
+    static void on_uring_send(uring_operation& op, int result, bool more, char const* data);
+
+    /// Appends an owned chunk to the main send queue
+    void enqueue(std::string chunk);
+
+    /// Appends a buffer with static storage duration, it is not copied
+    void enqueue_static(std::string_view chunk);
+
+    /// Accounts bytes that left the flush queue
+    void sent(std::size_t size);
+
+    /// Forgets the responses of the flush queue once it was written
+    void flush_completed();
+
+    /// Starts writing the send queue if no write is in progress
+    void flush();
+
+    /// Arms the read deadline that matches the parser state
+    /// \param request_completed a request was handled by the last read
+    void update_read_deadline(bool request_completed);
+
+    static void on_deadline(timer_wheel::entry& e, void* owner);
+
+    /// Answers from a preformatted buffer (503, 413, 414, 431) without running
+    /// the middlewares, and closes the connection once it is sent: the rest
+    /// of the request is dropped until then, and drained by linger()
+    void reject(std::string_view response);
+
+    /// Head of a request with a body: answers "Expect: 100-continue" and
+    /// picks the reader of the body
+    std::shared_ptr<http::body_reader> on_head(http::http_request const& head, std::error_code& ec);
+
+    /// Runs middleware::accept_head, queues the response of a rejection
+    /// \return whether the body of the request is wanted
+    bool accept_head(http::http_request const& head);
+
+    /// Resolves the route of the request into match_, the request points to
+    /// it and to context_
+    /// \return whether a middleware routes the requests
+    bool resolve(http::http_request& request);
+
+    /// Resolves the route unless on_head did, runs the middlewares and
+    /// queues the response.
+    /// \return whether the connection is kept open
+    bool handle_request(http::http_request& request);
+
+    /// Memory of the request being read from its head, see head_arena_
+    std::pmr::memory_resource* hold_arena();
+
+    /// Forgets the route, the context and the memory of the request being read
+    void finish_request();
+
     void send_error(asio::error_code ec);
 };
 
+/// One I/O thread of the server.
+/// Owns an io_context and, when SO_REUSEPORT is available, its own acceptor.
+/// Sessions accepted by a worker run on its io_context until they are closed.
+class WebWorker
+{
+    friend class WebServer;
+    friend class WebSession;
+
+    WebServer* server_;
+    std::size_t index_;
+    shared_ptr<asio::io_context> io_context_;
+    asio::ip::tcp::acceptor acceptor_;
+    // Protocol of the bound endpoint, written by listen() on this thread
+    asio::ip::tcp listen_protocol_;
+    std::thread thread_;
+
+    // The connection limit was reached, accept is re-armed when a session closes
+    atomic<bool> accept_paused_{false};
+
+    // io_uring transport, null when the sessions use the asio reactor
+    std::unique_ptr<io_uring_transport> uring_;
+    uring_operation accept_op_;
+
+    // Deadlines of the sessions of this worker
+    timer_wheel timer_wheel_;
+    asio::steady_timer timer_wheel_tick_;
+
+    // Open sessions of this worker, only touched by its thread
+    session_registry<WebSession> sessions_;
+
+    // Receive buffers lent to the sessions of this worker
+    buffer_pool buffer_pool_;
+
+    // Transient state of the requests parsed and handled within one read of
+    // a session, reset after each of them. A request whose head was handled
+    // in an earlier read has the arena of its session instead.
+    http::request_arena request_arena_;
+
+    // Recycled sessions, declared last: destroyed before the wheel and the context
+    slab_pool<WebSession> session_pool_;
+public:
+    explicit WebWorker(WebServer* server, std::size_t index, server_options const& options)
+        : server_(server)
+        , index_(index)
+        , io_context_(std::make_shared<asio::io_context>(1))
+        , acceptor_(*io_context_)
+        , listen_protocol_(asio::ip::tcp::v4())
+        , timer_wheel_tick_(*io_context_)
+        , sessions_(static_cast<std::uint32_t>(index))
+        , buffer_pool_(options.receive_buffer_cache)
+    {}
+
+    WebWorker(WebWorker const&) = delete;
+    WebWorker& operator=(WebWorker const&) = delete;
+
+    std::size_t index() const noexcept { return index_; }
+    shared_ptr<asio::io_context>& asio_context() noexcept { return io_context_; }
+
+    bool uses_io_uring() const noexcept { return uring_ != nullptr; }
+};
+
 class WebServer : public std::enable_shared_from_this<WebServer>
 {
     friend class WebSession;
     
     using OnCb = std::function<void(asio::error_code ec)>;
 
-    shared_ptr<asio::io_context> io_context_;
-
-    vector<std::thread> working_threads_;
-    std::thread context_worker_thread_;
+    server_options options_;
+    vector<std::unique_ptr<WebWorker>> workers_;
     atomic<bool> started_;
-    atomic<uint64_t> last_session_id_;
+    atomic<std::size_t> next_worker_;
+    bool shard_acceptors_;
+
+    // Admission control, shared by all the workers
+    atomic<std::size_t> connections_{0};
+    atomic<std::size_t> inflight_requests_{0};
+    atomic<std::size_t> buffered_bytes_{0};
 
-    asio::ip::tcp::acceptor socket_acceptor_;
     std::string host_;
     uint16_t port_;
 
-    std::shared_mutex sessions_lock_;
-    std::map<uint64_t, shared_ptr<WebSession>> sessions_;
-
     OnCb on_error_;
 
     vector<shared_ptr<http::middleware>> middlewares_;
@@ -99,7 +352,8 @@ public:
     explicit WebServer(
         std::string host,
         uint16_t port,
-        OnCb const& cb);
+        OnCb const& cb,
+        server_options options = {});
 
     WebServer(WebServer const&) = delete;
     WebServer(WebServer &&) = delete;
@@ -115,17 +369,41 @@ public:
 
     void add_middleware(shared_ptr<http::middleware> const middleware);
 
+    /// io_context of the first I/O thread
     shared_ptr<asio::io_context>& asio_context() noexcept
-    { return io_context_; }
+    { return workers_.front()->io_context_; }
+
+    std::size_t io_threads() const noexcept { return workers_.size(); }
+
+    /// Calls fn for every open session, e.g. to broadcast or to close them.
+    /// fn runs on the I/O thread of the session: each worker walks its own
+    /// sessions, so neither the workers nor the accepts are stopped.
+    void for_each_session(std::function<void(WebSession&)> fn);
 private:
-    void context_handler();
-    void accept();
+    void context_handler(WebWorker& worker);
+    void run_timer_wheel(WebWorker& worker);
+    void listen(WebWorker& worker);
+    void accept(WebWorker& worker);
+
+    static void on_uring_accept(uring_operation& op, int result, bool more, char const* data);
+
+    WebWorker& next_worker(WebWorker& acceptor_worker);
+
+    bool connection_limit_reached() const noexcept;
+
+    /// Past the in-flight request limit or the memory budget
+    bool overloaded() const noexcept;
+
+    bool over_memory_budget() const noexcept;
+
+    /// Re-arms the acceptors paused by the connection limit
+    void resume_accepting();
 
-    shared_ptr<WebSession> create_session(
-        uint64_t session_id
+    WebSession* create_session(
+        WebWorker& worker,
+        asio::ip::tcp::socket socket
     );
 
-    void register_session(shared_ptr<WebSession> s);
     void unregister_session(uint64_t id);
 };
 
@@ -0,0 +1,269 @@
+#include "webcrown/server/http/http_parser.hpp"
+#include "webcrown/server/http/middlewares/auth_middleware.hpp"
+#include "webcrown/server/http/middlewares/pipeline.hpp"
+#include "webcrown/server/http/middlewares/routing_middleware.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+
+using namespace webcrown::server::http;
+
+namespace {
+
+struct current_user : context_key<std::string, 0> {};
+
+/// A pipeline whose authorized route only has a context callback, and the
+/// state of the session that handles one request, see WebSession
+class auth_middleware_test : public ::testing::Test
+{
+protected:
+    pipeline<auth_middleware, routing_middleware> chain_;
+    int verified_{0};
+    std::string handled_by_;
+
+    route_match match_;
+    http_context context_;
+    bool head_accepted_{false};
+    std::optional<http_response> rejection_;
+
+    void SetUp() override
+    {
+        auto r = std::make_shared<route>(http_method::post, "/orders/:id",
+            [this](http_request const&, http_response& response, path_parameters_type const& parameters, http_context const& context)
+            {
+                auto user = context.get<current_user>();
+                handled_by_ = user ? *user + " " + std::string(parameters[0].value) : "nobody";
+                response.set_status(http_status::ok);
+            });
+
+        chain_.get<routing_middleware>().add_router(r);
+
+        auto& auth = chain_.get<auth_middleware>();
+        auth.authorize_route(r, auth_authorization_level::admin);
+        auth.context_callback([this](std::string const& token, std::shared_ptr<route>, auth_authorization_level, http_context& context)
+        {
+            ++verified_;
+            if (token != "admin-token")
+                return auth_result(false, "invalid token");
+
+            context.emplace<current_user>("admin");
+            return auth_result(true, "");
+        });
+
+        chain_.prepare();
+    }
+
+    /// The head of the request: resolved once, then accept_head before the
+    /// client sends the body
+    std::shared_ptr<body_reader> on_head(http_request const& head, std::error_code& ec)
+    {
+        http_request request = head;
+        request.context(&context_);
+        if (chain_.resolve(request, match_))
+            request.match(&match_);
+
+        http_response response;
+        if (!chain_.accept_head(request, response))
+        {
+            rejection_.emplace(std::move(response));
+            ec = make_error(http_error::request_rejected);
+            return nullptr;
+        }
+
+        head_accepted_ = true;
+        return chain_.accept_body(request);
+    }
+
+    /// The complete request reuses the match and the context of its head
+    http_status handle(std::string const& input)
+    {
+        parser p;
+        p.on_head([this](http_request const& head, std::error_code& ec) { return on_head(head, ec); });
+
+        std::error_code ec;
+        auto request = p.parse(input.data(), input.size(), ec);
+        if (ec)
+            return rejection_ ? rejection_->status() : http_status::bad_request;
+
+        request->match(&match_);
+        request->context(&context_);
+        request->head_accepted(head_accepted_);
+
+        http_response response;
+        chain_.execute(*request, response);
+        return response.status();
+    }
+};
+
+std::string expect_request(std::string const& token)
+{
+    return "POST /orders/42 HTTP/1.1\r\n"
+           "Host: localhost\r\n"
+           "Authorization: Bearer " + token + "\r\n"
+           "Expect: 100-continue\r\n"
+           "Content-Length: 2\r\n"
+           "\r\n"
+           "{}";
+}
+
+}
+
+TEST_F(auth_middleware_test, authorizes_an_expect_request_once)
+{
+    EXPECT_EQ(handle(expect_request("admin-token")), http_status::ok);
+
+    EXPECT_EQ(verified_, 1);
+    EXPECT_EQ(handled_by_, "admin 42");
+}
+
+TEST_F(auth_middleware_test, rejects_an_expect_request_before_its_body)
+{
+    EXPECT_EQ(handle(expect_request("guest-token")), http_status::unauthorized);
+
+    EXPECT_EQ(verified_, 1);
+    EXPECT_TRUE(handled_by_.empty());
+}
+
+TEST_F(auth_middleware_test, uses_the_context_callback_without_a_context)
+{
+    // Outside of the server the request has no context
+    std::string const input = "POST /orders/42 HTTP/1.1\r\nHost: localhost\r\nAuthorization: Bearer admin-token\r\n\r\n";
+    parser p;
+    std::error_code ec;
+    auto request = p.parse(input.data(), input.size(), ec);
+    ASSERT_TRUE(request);
+
+    http_response response;
+    EXPECT_TRUE(chain_.get<auth_middleware>().execute(*request, response));
+    EXPECT_EQ(verified_, 1);
+}
+
+namespace {
+
+/// Authorizes its own route objects, the router has others for the same
+/// paths: /admin/users is more specific than the authorized /admin/:section
+class distinct_routes_test : public ::testing::Test
+{
+protected:
+    pipeline<auth_middleware, routing_middleware> chain_;
+    routing_middleware router_;
+    auth_middleware auth_;
+    int handled_{0};
+
+    void SetUp() override
+    {
+        auto handler = [this](http_request const&, http_response& response, path_parameters_type const&, http_context const&)
+        {
+            ++handled_;
+            response.set_status(http_status::ok);
+        };
+
+        auto verify = [](std::string const& token, std::shared_ptr<route>, auth_authorization_level)
+        {
+            return token == "admin-token" ? auth_result(true, "") : auth_result(false, "invalid token");
+        };
+
+        for (auto* router : {&chain_.get<routing_middleware>(), &router_})
+        {
+            router->add_router(std::make_shared<route>(http_method::get, "/orders/:id", handler));
+            router->add_router(std::make_shared<route>(http_method::get, "/admin/users", handler));
+        }
+
+        for (auto* auth : {&chain_.get<auth_middleware>(), &auth_})
+        {
+            auto orders = std::make_shared<route>(http_method::get, "/orders/:id");
+            auto admin = std::make_shared<route>(http_method::get, "/admin/:section");
+            auth->authorize_route(orders, auth_authorization_level::admin);
+            auth->authorize_route(admin, auth_authorization_level::admin);
+            auth->callback(verify);
+        }
+
+        chain_.prepare();
+        router_.prepare();
+    }
+
+    /// Resolved once, like the server does
+    template <typename Execute>
+    http_status handle(std::string const& input, middleware const& resolver, Execute execute)
+    {
+        parser p;
+        std::error_code ec;
+        auto request = p.parse(input.data(), input.size(), ec);
+        if (ec)
+            return http_status::bad_request;
+
+        route_match match;
+        if (resolver.resolve(*request, match))
+            request->match(&match);
+
+        http_response response;
+        execute(*request, response);
+        return response.status();
+    }
+
+    http_status handle_pipeline(std::string const& input)
+    {
+        return handle(input, chain_, [this](http_request const& request, http_response& response)
+        {
+            chain_.execute(request, response);
+        });
+    }
+
+    /// The middlewares registered one by one on the server
+    http_status handle_chain(std::string const& input)
+    {
+        return handle(input, router_, [this](http_request const& request, http_response& response)
+        {
+            auth_.execute(request, response) && router_.execute(request, response);
+        });
+    }
+};
+
+std::string get_request(std::string const& target, std::string const& token)
+{
+    return "GET " + target + " HTTP/1.1\r\n"
+           "Host: localhost\r\n"
+           "Authorization: Bearer " + token + "\r\n"
+           "\r\n";
+}
+
+}
+
+TEST_F(distinct_routes_test, authorizes_the_path_of_another_route_object)
+{
+    EXPECT_EQ(handle_pipeline(get_request("/orders/42", "guest-token")), http_status::unauthorized);
+    EXPECT_EQ(handle_chain(get_request("/orders/42", "guest-token")), http_status::unauthorized);
+    EXPECT_EQ(handled_, 0);
+
+    EXPECT_EQ(handle_pipeline(get_request("/orders/42", "admin-token")), http_status::ok);
+    EXPECT_EQ(handle_chain(get_request("/orders/42", "admin-token")), http_status::ok);
+    EXPECT_EQ(handled_, 2);
+}
+
+TEST_F(distinct_routes_test, authorizes_a_more_specific_route)
+{
+    EXPECT_EQ(handle_pipeline(get_request("/admin/users", "guest-token")), http_status::unauthorized);
+    EXPECT_EQ(handle_chain(get_request("/admin/users", "guest-token")), http_status::unauthorized);
+    EXPECT_EQ(handled_, 0);
+
+    EXPECT_EQ(handle_pipeline(get_request("/admin/users", "admin-token")), http_status::ok);
+    EXPECT_EQ(handle_chain(get_request("/admin/users", "admin-token")), http_status::ok);
+    EXPECT_EQ(handled_, 2);
+}
+
+TEST(route, overlaps_the_routes_sharing_a_target)
+{
+    route const section(http_method::get, "/admin/:section");
+
+    EXPECT_TRUE(section.overlaps(route(http_method::get, "/admin/users")));
+    EXPECT_TRUE(section.overlaps(route(http_method::get, "/admin/:name")));
+    EXPECT_TRUE(route(http_method::get, "/admin/users").overlaps(section));
+    EXPECT_FALSE(section.overlaps(route(http_method::post, "/admin/users")));
+    EXPECT_FALSE(section.overlaps(route(http_method::get, "/admin/")));
+    EXPECT_FALSE(section.overlaps(route(http_method::get, "/admin/users/edit")));
+    EXPECT_FALSE(section.overlaps(route(http_method::get, "/users/admin")));
+}
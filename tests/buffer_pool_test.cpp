@@ -0,0 +1,114 @@
+#include "webcrown/server/buffer_pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <utility>
+
+using webcrown::server::buffer_pool;
+
+TEST(buffer_pool, has_size_classes_of_4kb_times_4)
+{
+    EXPECT_EQ(buffer_pool::class_size(0), 4u * 1024);
+    EXPECT_EQ(buffer_pool::class_size(1), 16u * 1024);
+    EXPECT_EQ(buffer_pool::class_size(2), 64u * 1024);
+    EXPECT_EQ(buffer_pool::class_size(3), 256u * 1024);
+    EXPECT_EQ(buffer_pool::class_size(4), 1024u * 1024);
+    EXPECT_EQ(buffer_pool::max_buffer_size, buffer_pool::class_size(buffer_pool::size_classes - 1));
+}
+
+TEST(buffer_pool, borrows_the_smallest_class_that_fits)
+{
+    buffer_pool pool;
+
+    struct { std::size_t min_size; std::size_t capacity; } const cases[] = {
+        {0, 4096},
+        {1, 4096},
+        {4096, 4096},
+        {4097, 16 * 1024},
+        {64 * 1024, 64 * 1024},
+        {64 * 1024 + 1, 256 * 1024},
+        {buffer_pool::max_buffer_size, buffer_pool::max_buffer_size}
+    };
+
+    for (auto const& c : cases)
+    {
+        auto b = pool.acquire(c.min_size);
+        ASSERT_TRUE(b) << c.min_size;
+        EXPECT_EQ(b.capacity(), c.capacity) << c.min_size;
+
+        // Every byte is usable
+        b.data()[b.capacity() - 1] = 'x';
+        pool.release(b);
+    }
+}
+
+TEST(buffer_pool, refuses_a_size_above_the_largest_class)
+{
+    buffer_pool pool;
+    auto b = pool.acquire(buffer_pool::max_buffer_size + 1);
+
+    EXPECT_FALSE(b);
+    EXPECT_EQ(b.capacity(), 0u);
+}
+
+TEST(buffer_pool, reuses_a_released_buffer_of_the_same_class)
+{
+    buffer_pool pool;
+
+    auto small = pool.acquire(100);
+    auto const small_data = small.data();
+    pool.release(small);
+    EXPECT_FALSE(small);
+    EXPECT_EQ(pool.cached_bytes(), 4096u);
+
+    // Another class allocates
+    auto large = pool.acquire(5000);
+    EXPECT_NE(large.data(), small_data);
+    EXPECT_EQ(pool.cached_bytes(), 4096u);
+
+    auto again = pool.acquire(4096);
+    EXPECT_EQ(again.data(), small_data);
+    EXPECT_EQ(pool.cached_bytes(), 0u);
+
+    pool.release(large);
+    pool.release(again);
+    EXPECT_EQ(pool.cached_bytes(), 4096u + 16 * 1024);
+}
+
+TEST(buffer_pool, frees_the_buffers_past_its_cache)
+{
+    buffer_pool pool(20 * 1024);
+
+    auto a = pool.acquire(16 * 1024);
+    auto b = pool.acquire(4096);
+    auto c = pool.acquire(4096);
+
+    pool.release(a);
+    pool.release(b);
+    EXPECT_EQ(pool.cached_bytes(), 20u * 1024);
+
+    // Freed, the handle is emptied all the same
+    pool.release(c);
+    EXPECT_FALSE(c);
+    EXPECT_EQ(pool.cached_bytes(), 20u * 1024);
+}
+
+TEST(buffer_pool, moves_a_borrowed_buffer)
+{
+    buffer_pool pool;
+    auto b = pool.acquire();
+    auto const data = b.data();
+
+    auto moved = std::move(b);
+    EXPECT_EQ(moved.data(), data);
+    EXPECT_EQ(moved.capacity(), 4096u);
+
+    // An empty handle is ignored
+    buffer_pool::buffer empty;
+    pool.release(empty);
+    EXPECT_EQ(pool.cached_bytes(), 0u);
+
+    pool.release(moved);
+    EXPECT_EQ(pool.cached_bytes(), 4096u);
+}
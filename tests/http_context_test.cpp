@@ -0,0 +1,116 @@
+#include "webcrown/server/http/http_request.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory_resource>
+#include <string>
+
+using namespace webcrown::server::http;
+
+namespace {
+
+/// Counts its live instances
+struct tracked
+{
+    static inline int alive = 0;
+
+    int value;
+
+    explicit tracked(int value) noexcept : value(value) { ++alive; }
+    ~tracked() { --alive; }
+};
+
+struct user_id : context_key<int, 0> {};
+struct user_name : context_key<std::string, 1> {};
+struct first_tracked : context_key<tracked, 2> {};
+struct second_tracked : context_key<tracked, 7> {};
+struct arena_string : context_key<std::pmr::string, 3> {};
+
+class http_context_test : public ::testing::Test
+{
+protected:
+    void SetUp() override { tracked::alive = 0; }
+};
+
+}
+
+TEST_F(http_context_test, stores_a_value_per_key)
+{
+    http_context context;
+    EXPECT_EQ(context.get<user_id>(), nullptr);
+
+    context.emplace<user_id>(42);
+    context.emplace<user_name>(100, 'x');
+
+    ASSERT_NE(context.get<user_id>(), nullptr);
+    EXPECT_EQ(*context.get<user_id>(), 42);
+    EXPECT_EQ(*context.get<user_name>(), std::string(100, 'x'));
+
+    // The same value through a const context
+    http_context const& view = context;
+    EXPECT_EQ(view.get<user_id>(), context.get<user_id>());
+}
+
+TEST_F(http_context_test, destroys_a_replaced_value)
+{
+    http_context context;
+
+    context.emplace<first_tracked>(1);
+    EXPECT_EQ(tracked::alive, 1);
+
+    auto& replaced = context.emplace<first_tracked>(2);
+    EXPECT_EQ(tracked::alive, 1);
+    EXPECT_EQ(replaced.value, 2);
+    EXPECT_EQ(context.get<first_tracked>(), &replaced);
+}
+
+TEST_F(http_context_test, destroys_an_erased_value)
+{
+    http_context context;
+    context.emplace<first_tracked>(1);
+    context.emplace<second_tracked>(2);
+
+    context.erase<first_tracked>();
+    EXPECT_EQ(tracked::alive, 1);
+    EXPECT_EQ(context.get<first_tracked>(), nullptr);
+    EXPECT_EQ(context.get<second_tracked>()->value, 2);
+
+    // Erasing an empty slot does nothing
+    context.erase<first_tracked>();
+    EXPECT_EQ(tracked::alive, 1);
+}
+
+TEST_F(http_context_test, destroys_the_values_once)
+{
+    {
+        http_context context;
+        context.emplace<first_tracked>(1);
+        context.emplace<second_tracked>(2);
+        context.emplace<user_name>("a string longer than the small string buffer");
+
+        context.clear();
+        EXPECT_EQ(tracked::alive, 0);
+        EXPECT_EQ(context.get<user_name>(), nullptr);
+
+        // Reused for the next request, destroyed with the context
+        context.emplace<first_tracked>(3);
+        EXPECT_EQ(tracked::alive, 1);
+    }
+
+    EXPECT_EQ(tracked::alive, 0);
+}
+
+TEST_F(http_context_test, keeps_a_value_allocated_from_an_arena)
+{
+    char memory[1024];
+    std::pmr::monotonic_buffer_resource arena(memory, sizeof(memory), std::pmr::null_memory_resource());
+
+    http_context context;
+    auto& value = context.emplace<arena_string>(200, 'a', &arena);
+    EXPECT_EQ(value.get_allocator().resource(), &arena);
+    EXPECT_GE(static_cast<void const*>(value.data()), static_cast<void const*>(memory));
+    EXPECT_LT(static_cast<void const*>(value.data()), static_cast<void const*>(memory + sizeof(memory)));
+
+    // Destroyed before the arena, like the server does
+    context.clear();
+}
@@ -0,0 +1,309 @@
+#include "webcrown/server/http/http_parser.hpp"
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <string>
+#include <system_error>
+
+using webcrown::server::http::http_error;
+using webcrown::server::http::http_request;
+using webcrown::server::http::make_error;
+using webcrown::server::http::parser;
+using webcrown::server::http::parser_limits;
+
+namespace {
+
+/// Parses a complete request in one call, the request views the string
+std::optional<http_request> parse(parser& p, std::string const& request, std::error_code& ec)
+{
+    return p.parse(request.data(), request.size(), ec);
+}
+
+/// Feeds the request step bytes at a time, like a session: the retained
+/// head and the bytes not consumed are passed again with the next ones
+class stepped_parse
+{
+public:
+    parser p;
+    std::string pending;
+    std::size_t fed{0};
+
+    std::optional<http_request> parse(std::string const& input, std::size_t step, std::error_code& ec)
+    {
+        while (fed < input.size())
+        {
+            auto const next = input.substr(fed, step);
+            fed += next.size();
+            pending += next;
+
+            auto request = p.parse(pending.data(), pending.size(), ec);
+            if (ec || request)
+                return request;
+
+            pending = pending.substr(0, p.retained()) + pending.substr(p.consumed());
+        }
+
+        return std::nullopt;
+    }
+};
+
+std::string with_header_name(std::string const& name)
+{
+    return "GET / HTTP/1.1\r\nHost: localhost\r\n" + name + ": value\r\n\r\n";
+}
+
+}
+
+TEST(http_parser, accepts_token_header_names)
+{
+    // Every tchar, '|' and '~' included
+    auto const input = with_header_name("X-!#$%&'*+-.^_`|~09azAZ");
+    parser p;
+    std::error_code ec;
+    auto request = parse(p, input, ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_EQ(request->headers().size(), 2u);
+}
+
+TEST(http_parser, rejects_separators_in_header_names)
+{
+    for (char separator : std::string("\"(),/;<=>?@[\\]{}"))
+    {
+        auto const input = with_header_name(std::string("X-Custom") + separator + "Name");
+        parser p;
+        std::error_code ec;
+        auto request = parse(p, input, ec);
+
+        EXPECT_EQ(ec, make_error(http_error::bad_field)) << "separator " << separator;
+        EXPECT_FALSE(request);
+    }
+}
+
+TEST(http_parser, rejects_separators_past_the_vector_width)
+{
+    // The separator is found by the vector kernel, not by the scalar tail
+    auto const input = with_header_name(std::string(40, 'x') + "|~" + std::string(40, 'y') + "(z");
+    parser p;
+    std::error_code ec;
+    auto request = parse(p, input, ec);
+
+    EXPECT_EQ(ec, make_error(http_error::bad_field));
+    EXPECT_FALSE(request);
+}
+
+TEST(http_parser, accepts_http_1_0)
+{
+    std::string const close = "GET / HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    parser p;
+    std::error_code ec;
+    auto request = parse(p, close, ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_EQ(request->version(), 10);
+    EXPECT_FALSE(request->keep_alive());
+
+    std::string const keep_alive = "GET / HTTP/1.0\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    p.reset();
+    request = parse(p, keep_alive, ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_TRUE(request->keep_alive());
+}
+
+TEST(http_parser, rejects_other_versions)
+{
+    for (std::string version : {"HTTP/0.9", "HTTP/1.2", "HTTP/2.0"})
+    {
+        auto const input = "GET / " + version + "\r\nHost: localhost\r\n\r\n";
+        parser p;
+        std::error_code ec;
+        auto request = parse(p, input, ec);
+
+        EXPECT_EQ(ec, make_error(http_error::bad_version)) << version;
+        EXPECT_FALSE(request);
+    }
+}
+
+TEST(http_parser, rejects_chunked_http_1_0)
+{
+    std::string const input = "POST / HTTP/1.0\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n";
+    parser p;
+    std::error_code ec;
+    auto request = parse(p, input, ec);
+
+    EXPECT_EQ(ec, make_error(http_error::bad_transfer_encoding));
+    EXPECT_FALSE(request);
+}
+
+TEST(http_parser, limits_the_target_across_reads)
+{
+    parser_limits limits;
+    limits.start_line = 64;
+
+    auto const input = "GET /" + std::string(200, 'a') + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    stepped_parse s;
+    s.p.limits(limits);
+    std::error_code ec;
+    auto request = s.parse(input, 7, ec);
+
+    // Rejected before the end of the line is received
+    EXPECT_EQ(ec, make_error(http_error::start_line_too_long));
+    EXPECT_FALSE(request);
+    EXPECT_LE(s.fed, limits.start_line + 7);
+}
+
+TEST(http_parser, limits_a_header_line_across_reads)
+{
+    parser_limits limits;
+    limits.header_bytes = 128;
+
+    auto const input = "GET / HTTP/1.1\r\nHost: localhost\r\nX-Large: " + std::string(500, 'a') + "\r\n\r\n";
+    stepped_parse s;
+    s.p.limits(limits);
+    std::error_code ec;
+    auto request = s.parse(input, 5, ec);
+
+    EXPECT_EQ(ec, make_error(http_error::header_too_large));
+    EXPECT_FALSE(request);
+    EXPECT_LT(s.fed, input.size() / 2);
+}
+
+TEST(http_parser, limits_the_head_across_reads)
+{
+    parser_limits limits;
+    limits.header_bytes = 128;
+
+    auto head = [](int fields)
+    {
+        std::string input = "GET / HTTP/1.1\r\nHost: localhost\r\n";
+        for (int i = 0; i < fields; ++i)
+            input += "X-Field-" + std::to_string(i) + ": value\r\n";
+        return input + "\r\n";
+    };
+
+    // Each line is short, the head as a whole is not
+    auto const input = head(10);
+    stepped_parse s;
+    s.p.limits(limits);
+    std::error_code ec;
+    auto request = s.parse(input, 3, ec);
+
+    EXPECT_EQ(ec, make_error(http_error::header_too_large));
+    EXPECT_FALSE(request);
+    EXPECT_LT(s.fed, input.size());
+
+    auto const accepted = head(4);
+    stepped_parse t;
+    t.p.limits(limits);
+    ec.clear();
+    request = t.parse(accepted, 3, ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_EQ(request->headers().size(), 5u);
+}
+
+TEST(http_parser, parses_a_chunked_body_byte_by_byte)
+{
+    std::string const input =
+        "POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "4\r\nWiki\r\n"
+        "5;name=value\r\npedia\r\n"
+        "e\r\n in\r\n\r\nchunks.\r\n"
+        "0\r\nTrailer: ignored\r\n\r\n";
+
+    stepped_parse s;
+    std::error_code ec;
+    auto request = s.parse(input, 1, ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_EQ(s.fed, input.size());
+    EXPECT_EQ(request->body(), "Wikipedia in\r\n\r\nchunks.");
+}
+
+TEST(http_parser, parses_a_content_length_body_byte_by_byte)
+{
+    std::string const input =
+        "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 12\r\n\r\n"
+        "hello\r\nworld"
+        "GET /next HTTP/1.1\r\n\r\n";
+
+    stepped_parse s;
+    std::error_code ec;
+    auto request = s.parse(input, 1, ec);
+
+    // The request ends with its body, the next one is not read
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_EQ(request->body(), "hello\r\nworld");
+    EXPECT_EQ(s.fed, input.find("GET /next"));
+}
+
+TEST(http_parser, limits_the_chunk_size_line)
+{
+    parser_limits limits;
+    limits.chunk_line = 64;
+
+    std::string const head = "POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n";
+    auto const extensions = "1;" + std::string(200, 'x') + "\r\na\r\n0\r\n\r\n";
+
+    // Split, the partial line is not kept past the limit
+    auto const input = head + extensions;
+    stepped_parse s;
+    s.p.limits(limits);
+    std::error_code ec;
+    auto request = s.parse(input, 1, ec);
+
+    EXPECT_EQ(ec, make_error(http_error::bad_chunk));
+    EXPECT_FALSE(request);
+    EXPECT_EQ(s.fed, head.size() + limits.chunk_line);
+
+    // Whole
+    parser p;
+    p.limits(limits);
+    ec.clear();
+    request = parse(p, input, ec);
+
+    EXPECT_EQ(ec, make_error(http_error::bad_chunk));
+    EXPECT_FALSE(request);
+
+    // The trailer lines too
+    auto const trailer = head + "0\r\nX-Trailer: " + std::string(200, 'x') + "\r\n\r\n";
+    stepped_parse t;
+    t.p.limits(limits);
+    ec.clear();
+    request = t.parse(trailer, 1, ec);
+
+    EXPECT_EQ(ec, make_error(http_error::bad_chunk));
+    EXPECT_FALSE(request);
+}
+
+TEST(http_parser, reads_the_connection_options)
+{
+    auto keep_alive = [](std::string const& version, std::string const& connection)
+    {
+        auto const input = "GET / " + version + "\r\nHost: localhost\r\nConnection: " + connection + "\r\n\r\n";
+        parser p;
+        std::error_code ec;
+        auto request = parse(p, input, ec);
+        EXPECT_TRUE(request) << ec.message();
+        return request && request->keep_alive();
+    };
+
+    EXPECT_FALSE(keep_alive("HTTP/1.1", "close"));
+    EXPECT_FALSE(keep_alive("HTTP/1.1", "Upgrade, CLOSE"));
+    EXPECT_FALSE(keep_alive("HTTP/1.0", "keep-alive ,\tClose "));
+    EXPECT_TRUE(keep_alive("HTTP/1.0", "Keep-Alive"));
+    EXPECT_TRUE(keep_alive("HTTP/1.0", " , keep-alive,"));
+    EXPECT_TRUE(keep_alive("HTTP/1.1", "upgrade"));
+
+    // Options are whole tokens
+    EXPECT_TRUE(keep_alive("HTTP/1.1", "x-closed"));
+    EXPECT_FALSE(keep_alive("HTTP/1.0", "x-keep-alive-later"));
+}
@@ -0,0 +1,47 @@
+#include "webcrown/server/http/http_response.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using webcrown::server::http::http_response;
+using webcrown::server::http::http_status;
+
+TEST(http_response, frames_the_body_with_its_length)
+{
+    http_response response;
+    response.set_status(http_status::ok);
+    response.add_header("Content-Type", "text/plain");
+    response.set_body("hello");
+
+    EXPECT_EQ(response.build(),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 5\r\n"
+        "\r\n"
+        "hello");
+}
+
+TEST(http_response, replaces_the_content_length_of_the_handler)
+{
+    http_response response;
+    response.set_status(http_status::ok);
+    response.add_header("content-length", "100");
+    response.set_body("hello");
+
+    auto const message = response.build_header();
+    EXPECT_NE(message.find("content-length: 5\r\n"), std::string::npos) << message;
+    EXPECT_EQ(message.find("100"), std::string::npos) << message;
+
+    // Built again after the body changed
+    response.set_body("hello, world");
+    EXPECT_NE(response.build_header().find("content-length: 12\r\n"), std::string::npos);
+}
+
+TEST(http_response, has_no_length_without_content)
+{
+    http_response response;
+    response.set_status(http_status::no_content);
+
+    EXPECT_EQ(response.build(), "HTTP/1.1 204 No Content\r\n\r\n");
+}
@@ -0,0 +1,165 @@
+#include "webcrown/server/io_uring_transport.hpp"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+using webcrown::server::io_uring_transport;
+using webcrown::server::uring_operation;
+
+namespace {
+
+/// Completions seen by an operation
+struct completions
+{
+    std::string data;
+    int result{0};
+    int count{0};
+    bool more{false};
+};
+
+void record(uring_operation& op, int result, bool more, char const* data)
+{
+    auto& seen = *static_cast<completions*>(op.owner);
+    seen.result = result;
+    seen.more = more;
+    ++seen.count;
+
+    if (data && result > 0)
+        seen.data.append(data, static_cast<std::size_t>(result));
+}
+
+/// Runs the io_context until done() or a second has passed
+template <typename Done>
+bool run_until(asio::io_context& io_context, Done done)
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (!done() && std::chrono::steady_clock::now() < deadline)
+        io_context.run_one_for(std::chrono::milliseconds(50));
+
+    return done();
+}
+
+class io_uring_transport_test : public ::testing::Test
+{
+protected:
+    asio::io_context io_context_{1};
+    std::unique_ptr<io_uring_transport> transport_;
+
+    void SetUp() override
+    {
+        std::error_code ec;
+        transport_ = io_uring_transport::create(io_context_, ec);
+        if (!transport_)
+            GTEST_SKIP() << "io_uring is not available: " << ec.message();
+    }
+};
+
+}
+
+TEST_F(io_uring_transport_test, receives_into_provided_buffers)
+{
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), 0);
+
+    completions seen;
+    uring_operation op{&record, &seen};
+    transport_->receive_multishot(fds[0], op);
+
+    ASSERT_EQ(::write(fds[1], "GET / HTTP/1.1\r\n", 16), 16);
+    ASSERT_TRUE(run_until(io_context_, [&] { return seen.data.size() == 16; }));
+    EXPECT_TRUE(seen.more);
+
+    // The multishot receive stays armed
+    ASSERT_EQ(::write(fds[1], "\r\n", 2), 2);
+    ASSERT_TRUE(run_until(io_context_, [&] { return seen.data.size() == 18; }));
+    EXPECT_EQ(seen.data, "GET / HTTP/1.1\r\n\r\n");
+
+    transport_->cancel(fds[0]);
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST_F(io_uring_transport_test, reports_end_of_stream)
+{
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), 0);
+
+    completions seen;
+    uring_operation op{&record, &seen};
+    transport_->receive_multishot(fds[0], op);
+
+    ::close(fds[1]);
+    ASSERT_TRUE(run_until(io_context_, [&] { return seen.count > 0; }));
+    EXPECT_EQ(seen.result, 0);
+    EXPECT_FALSE(seen.more);
+
+    ::close(fds[0]);
+}
+
+TEST_F(io_uring_transport_test, sends_gathered_buffers)
+{
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), 0);
+
+    std::string header = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n";
+    std::string body = "ok";
+    iovec iov[2] = {{header.data(), header.size()}, {body.data(), body.size()}};
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    completions seen;
+    uring_operation op{&record, &seen};
+    transport_->send(fds[0], &msg, op);
+
+    ASSERT_TRUE(run_until(io_context_, [&] { return seen.count > 0; }));
+    ASSERT_EQ(seen.result, static_cast<int>(header.size() + body.size()));
+
+    char received[128];
+    auto n = ::read(fds[1], received, sizeof(received));
+    EXPECT_EQ(std::string(received, static_cast<std::size_t>(n)), header + body);
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST_F(io_uring_transport_test, accepts_connections)
+{
+    auto listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_GE(listen_fd, 0);
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+    ASSERT_EQ(::listen(listen_fd, 16), 0);
+
+    socklen_t length = sizeof(address);
+    ASSERT_EQ(::getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length), 0);
+
+    completions seen;
+    uring_operation op{&record, &seen};
+    transport_->accept_multishot(listen_fd, op);
+
+    // The connection waits in the backlog until the accept is submitted
+    auto client = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_GE(client, 0);
+    ASSERT_EQ(::connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)), 0);
+
+    ASSERT_TRUE(run_until(io_context_, [&] { return seen.count > 0; }));
+    ASSERT_GE(seen.result, 0);
+    EXPECT_TRUE(seen.more);
+
+    ::close(seen.result);
+    ::close(client);
+    transport_->cancel(listen_fd);
+    ::close(listen_fd);
+}
@@ -0,0 +1,175 @@
+#include "webcrown/server/http/http_parser.hpp"
+#include "webcrown/server/http/multipart_parser.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace webcrown::server::http;
+
+namespace {
+
+/// Copies the parts, the views given to the handler end with the call
+class collected_parts : public multipart_handler
+{
+public:
+    struct part
+    {
+        std::string disposition;
+        std::string content_type;
+        std::string data;
+        bool ended{false};
+    };
+
+    std::vector<part> parts;
+
+    void on_part_begin(http_headers const& headers) override
+    {
+        auto& p = parts.emplace_back();
+        if (auto disposition = headers.find(http_field::content_disposition); disposition != headers.end())
+            p.disposition = disposition->second;
+        if (auto content_type = headers.find(http_field::content_type); content_type != headers.end())
+            p.content_type = content_type->second;
+    }
+
+    void on_part_data(std::string_view data) override
+    {
+        parts.back().data.append(data);
+    }
+
+    void on_part_end() override
+    {
+        parts.back().ended = true;
+    }
+};
+
+// The payloads hold partial delimiters, and the lone CRs held back at the
+// end of a piece
+std::string const first_payload = "line--XyZ-ish\r\n-XyZ\r\n--Xy\r\r\n-\r\n--";
+std::string const second_payload = "\r\r\r\n--X\r\n--xyz\r\n--Xy";
+
+std::string const body =
+    "preamble, ignored\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"first\"; filename=\"a;b.txt\"\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n" + first_payload + "\r\n"
+    "--XyZ  \r\n"
+    "Content-Disposition: form-data; name=second\r\n"
+    "\r\n" + second_payload + "\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"empty\"\r\n"
+    "\r\n"
+    "\r\n"
+    "--XyZ--\r\n"
+    "epilogue, ignored";
+
+collected_parts parse_in_steps(std::string const& input, std::size_t step, std::error_code& ec)
+{
+    multipart_parser parser;
+    parser.reset("XyZ");
+
+    collected_parts collected;
+    for (std::size_t offset = 0; offset < input.size() && !ec; offset += step)
+        parser.parse(std::string_view(input).substr(offset, step), collected, ec);
+
+    if (!ec && !parser.finished())
+        ec = make_error(http_error::bad_multipart);
+
+    return collected;
+}
+
+}
+
+TEST(multipart_parser, parses_the_parts_split_at_any_byte)
+{
+    for (std::size_t step : {1, 2, 3, 5, 13, 64, 4096})
+    {
+        std::error_code ec;
+        auto const collected = parse_in_steps(body, step, ec);
+
+        ASSERT_FALSE(ec) << "step " << step << " " << ec.message();
+        ASSERT_EQ(collected.parts.size(), 3u) << "step " << step;
+
+        auto const& first = collected.parts[0];
+        EXPECT_EQ(first.data, first_payload) << "step " << step;
+        EXPECT_EQ(first.content_type, "text/plain") << "step " << step;
+        EXPECT_EQ(multipart_parser::disposition_parameter(first.disposition, "filename"), "a;b.txt");
+
+        EXPECT_EQ(collected.parts[1].data, second_payload) << "step " << step;
+        EXPECT_EQ(multipart_parser::disposition_parameter(collected.parts[1].disposition, "name"), "second");
+        EXPECT_TRUE(collected.parts[1].content_type.empty());
+
+        EXPECT_TRUE(collected.parts[2].data.empty()) << "step " << step;
+        for (auto const& part : collected.parts)
+            EXPECT_TRUE(part.ended) << "step " << step;
+    }
+}
+
+TEST(multipart_parser, requires_the_close_delimiter)
+{
+    auto const unfinished = body.substr(0, body.find("--XyZ--"));
+
+    for (std::size_t step : {1, 2, 3, 5, 13, 64})
+    {
+        std::error_code ec;
+        parse_in_steps(unfinished, step, ec);
+        EXPECT_EQ(ec, make_error(http_error::bad_multipart)) << "step " << step;
+    }
+}
+
+TEST(multipart_parser, limits_the_headers_split_across_pieces)
+{
+    // A block received whole is bounded by the body, a split one is held
+    auto const input = "--XyZ\r\nX-Large: " + std::string(multipart_parser::header_limit, 'a') + "\r\n\r\ndata\r\n--XyZ--\r\n";
+
+    for (std::size_t step : {1, 13, 64})
+    {
+        std::error_code ec;
+        parse_in_steps(input, step, ec);
+        EXPECT_EQ(ec, make_error(http_error::bad_multipart)) << "step " << step;
+    }
+}
+
+TEST(multipart_parser, reads_the_boundary_parameter)
+{
+    EXPECT_EQ(multipart_parser::boundary_parameter("multipart/form-data; boundary=XyZ"), "XyZ");
+    EXPECT_EQ(multipart_parser::boundary_parameter("multipart/form-data; charset=utf-8; Boundary=\"a b;c\""), "a b;c");
+    EXPECT_TRUE(multipart_parser::boundary_parameter("multipart/form-data").empty());
+    EXPECT_TRUE(multipart_parser::boundary_parameter("multipart/form-data; boundary=" + std::string(71, 'a')).empty());
+}
+
+TEST(multipart_parser, keeps_the_part_headers_of_a_buffered_form)
+{
+    auto const input =
+        "POST /form HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Content-Type: multipart/form-data; boundary=XyZ\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "\r\n" + body;
+
+    parser p;
+    std::error_code ec;
+    auto request = p.parse(input.data(), input.size(), ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    auto const& uploads = request->uploads();
+    ASSERT_EQ(uploads.size(), 3u);
+
+    EXPECT_EQ(uploads[0].name, "first");
+    EXPECT_EQ(uploads[0].filename, "a;b.txt");
+    EXPECT_EQ(uploads[0].content_type, "text/plain");
+    EXPECT_EQ(uploads[0].disposition, "form-data; name=\"first\"; filename=\"a;b.txt\"");
+    EXPECT_EQ(uploads[0].bytes, first_payload);
+
+    EXPECT_EQ(uploads[1].name, "second");
+    EXPECT_TRUE(uploads[1].content_type.empty());
+    EXPECT_EQ(uploads[1].bytes, second_payload);
+
+    EXPECT_EQ(request->form_part("empty"), &uploads[2]);
+    EXPECT_EQ(uploads[2].size, 0u);
+}
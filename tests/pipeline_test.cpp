@@ -0,0 +1,217 @@
+#include "webcrown/server/http/http_parser.hpp"
+#include "webcrown/server/http/middlewares/pipeline.hpp"
+#include "webcrown/server/http/middlewares/routing_middleware.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace webcrown::server::http;
+
+namespace {
+
+using call_log = std::vector<std::string>;
+
+struct discarding_reader : body_reader
+{
+    void on_body_data(std::string_view, std::error_code&) override {}
+};
+
+/// Logs its calls, continues the chain unless told to stop
+template <char Name>
+class logging_middleware : public middleware
+{
+public:
+    call_log* log{nullptr};
+    bool stop{false};
+    bool reject_head{false};
+    std::shared_ptr<body_reader> reader;
+
+    bool execute(http_request const&, http_response& response) override
+    {
+        log->push_back(std::string(1, Name));
+        if (stop)
+            response.set_status(http_status::forbidden);
+        return !stop;
+    }
+
+    bool accept_head(http_request const&, http_response&) override
+    {
+        log->push_back(std::string("head ") + Name);
+        return !reject_head;
+    }
+
+    std::shared_ptr<body_reader> accept_body(http_request const&) override
+    {
+        log->push_back(std::string("body ") + Name);
+        return reader;
+    }
+
+    void prepare() override { log->push_back(std::string("prepare ") + Name); }
+};
+
+/// Only runs for the routes under /admin
+class admin_middleware : public logging_middleware<'s'>
+{
+public:
+    bool applies_to(route const& r) const
+    {
+        return r.path().rfind("/admin", 0) == 0;
+    }
+};
+
+using first = logging_middleware<'a'>;
+using last = logging_middleware<'z'>;
+
+class pipeline_test : public ::testing::Test
+{
+protected:
+    pipeline<first, admin_middleware, routing_middleware, last> chain_;
+    call_log log_;
+    std::shared_ptr<route> admin_;
+    std::shared_ptr<route> home_;
+
+    void SetUp() override
+    {
+        chain_.get<first>().log = &log_;
+        chain_.get<admin_middleware>().log = &log_;
+        chain_.get<last>().log = &log_;
+
+        auto handler = [this](http_request const&, http_response& response, path_parameters_type const&, http_context const&)
+        {
+            log_.push_back("route");
+            response.set_status(http_status::ok);
+        };
+
+        admin_ = std::make_shared<route>(http_method::get, "/admin/:page", handler);
+        home_ = std::make_shared<route>(http_method::get, "/", handler);
+        chain_.get<routing_middleware>().add_router(admin_);
+        chain_.get<routing_middleware>().add_router(home_);
+
+        chain_.prepare();
+        log_.clear();
+    }
+
+    /// Resolved by the server first when resolve is set, like the session
+    http_status get(std::string const& target, bool resolve = true)
+    {
+        auto const input = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        parser p;
+        std::error_code ec;
+        auto request = p.parse(input.data(), input.size(), ec);
+        if (!request)
+            return http_status::bad_request;
+
+        route_match match;
+        if (resolve && chain_.resolve(*request, match))
+            request->match(&match);
+
+        http_response response;
+        chain_.execute(*request, response);
+        return response.status();
+    }
+};
+
+}
+
+TEST_F(pipeline_test, prepares_the_middlewares_in_order)
+{
+    chain_.prepare();
+    EXPECT_EQ(log_, (call_log{"prepare a", "prepare s", "prepare z"}));
+}
+
+TEST_F(pipeline_test, masks_the_middlewares_of_each_route)
+{
+    // A bit per middleware, in the order of the chain
+    EXPECT_EQ(admin_->middleware_mask(), 0b1111u);
+    EXPECT_EQ(home_->middleware_mask(), 0b1101u);
+}
+
+TEST_F(pipeline_test, runs_the_middlewares_of_the_route_in_order)
+{
+    EXPECT_EQ(get("/admin/users"), http_status::ok);
+    EXPECT_EQ(log_, (call_log{"a", "s", "route"}));
+
+    // The router ends the chain of a handled request
+    log_.clear();
+    EXPECT_EQ(get("/"), http_status::ok);
+    EXPECT_EQ(log_, (call_log{"a", "route"}));
+}
+
+TEST_F(pipeline_test, resolves_the_route_when_the_server_did_not)
+{
+    EXPECT_EQ(get("/", false), http_status::ok);
+    EXPECT_EQ(log_, (call_log{"a", "route"}));
+}
+
+TEST_F(pipeline_test, runs_the_whole_chain_without_a_route)
+{
+    EXPECT_EQ(get("/missing"), http_status::not_found);
+    EXPECT_EQ(log_, (call_log{"a", "s"}));
+}
+
+TEST_F(pipeline_test, stops_at_the_middleware_that_answers)
+{
+    chain_.get<first>().stop = true;
+
+    EXPECT_EQ(get("/admin/users"), http_status::forbidden);
+    EXPECT_EQ(log_, (call_log{"a"}));
+}
+
+TEST_F(pipeline_test, stops_accepting_the_head_at_the_first_rejection)
+{
+    std::string const input = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    parser p;
+    std::error_code ec;
+    auto request = p.parse(input.data(), input.size(), ec);
+    ASSERT_TRUE(request);
+
+    http_response response;
+    EXPECT_TRUE(chain_.accept_head(*request, response));
+    EXPECT_EQ(log_, (call_log{"head a", "head s", "head z"}));
+
+    log_.clear();
+    chain_.get<admin_middleware>().reject_head = true;
+    EXPECT_FALSE(chain_.accept_head(*request, response));
+    EXPECT_EQ(log_, (call_log{"head a", "head s"}));
+}
+
+TEST_F(pipeline_test, takes_the_body_reader_of_the_first_middleware)
+{
+    std::string const input = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    parser p;
+    std::error_code ec;
+    auto request = p.parse(input.data(), input.size(), ec);
+    ASSERT_TRUE(request);
+
+    std::shared_ptr<body_reader> const reader = std::make_shared<discarding_reader>();
+    chain_.get<admin_middleware>().reader = reader;
+    chain_.get<last>().reader = std::make_shared<discarding_reader>();
+
+    EXPECT_EQ(chain_.accept_body(*request), reader);
+    EXPECT_EQ(log_, (call_log{"body a", "body s"}));
+}
+
+TEST(pipeline, does_not_resolve_without_a_router)
+{
+    pipeline<first, last> chain;
+    call_log log;
+    chain.get<first>().log = &log;
+    chain.get<last>().log = &log;
+
+    std::string const input = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    parser p;
+    std::error_code ec;
+    auto request = p.parse(input.data(), input.size(), ec);
+    ASSERT_TRUE(request);
+
+    route_match match;
+    EXPECT_FALSE(chain.resolve(*request, match));
+
+    http_response response;
+    EXPECT_TRUE(chain.execute(*request, response));
+    EXPECT_EQ(log, (call_log{"a", "z"}));
+}
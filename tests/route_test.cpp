@@ -0,0 +1,159 @@
+#include "webcrown/server/http/middlewares/route_tree.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+using webcrown::server::http::http_method;
+using webcrown::server::http::path_values;
+using webcrown::server::http::route;
+using webcrown::server::http::route_tree;
+
+namespace {
+
+constexpr std::string_view paths[] = {
+    "/",
+    "/users",
+    "/users/:id",
+    "/users/:id/posts/:post",
+    "/admin/users/edit/:user",
+    "/admin/models/:model_name",
+    "/admin/models/:model_name_p/add"
+};
+
+constexpr std::string_view targets[] = {
+    "/",
+    "/users",
+    "/users/",
+    "/users/42",
+    "/users/42?sort=/name",
+    "/users/42/posts/7",
+    "/users//posts/7",
+    "/admin/users/edit/bob",
+    "/admin/models/car",
+    "/admin/models/car/add",
+    "/admin/models/car/add/",
+    "/usersx"
+};
+
+}
+
+TEST(route, matches_like_the_route_tree)
+{
+    for (auto path : paths)
+    {
+        auto r = std::make_shared<route>(http_method::get, path);
+        route_tree tree;
+        tree.insert(r);
+
+        for (auto target : targets)
+        {
+            path_values matched;
+            path_values found;
+            auto const match = r->match(target, http_method::get, matched);
+
+            ASSERT_EQ(match, tree.find(http_method::get, target, found) != nullptr) << path << " " << target;
+            EXPECT_EQ(r->is_match_with_target_request(target, http_method::get), match);
+            EXPECT_FALSE(r->is_match_with_target_request(target, http_method::post));
+
+            if (!match)
+                continue;
+
+            ASSERT_EQ(matched.size, found.size);
+            for (std::size_t i = 0; i < matched.size; ++i)
+                EXPECT_EQ(matched.values[i], found.values[i]);
+        }
+    }
+}
+
+TEST(route, ignores_the_query)
+{
+    route r(http_method::get, "/users/:id");
+
+    path_values values;
+    ASSERT_TRUE(r.match("/users/42?tab=posts", http_method::get, values));
+    ASSERT_EQ(values.size, 1u);
+    EXPECT_EQ(values.values[0], "42");
+}
+
+TEST(route, does_not_match_inside_a_parameter_name)
+{
+    // ":user" is also a part of "users"
+    route r(http_method::get, "/admin/users/edit/:user");
+
+    path_values values;
+    ASSERT_TRUE(r.match("/admin/users/edit/bob", http_method::get, values));
+    EXPECT_EQ(values.values[0], "bob");
+    EXPECT_FALSE(r.match("/admin/bob/edit/bob", http_method::get, values));
+}
+
+namespace {
+
+constexpr std::string_view tree_paths[] = {
+    "/users/new",
+    "/users/:id",
+    "/users/:id/posts",
+    "/users/:id/posts/:post",
+    "/a/b/:y/d",
+    "/a/:x/:w/c"
+};
+
+struct tree_case
+{
+    std::string_view target;
+    std::string_view route;
+    std::vector<std::string_view> values;
+};
+
+}
+
+TEST(route_tree, goes_back_from_a_static_branch_to_a_parameter)
+{
+    route_tree tree;
+    for (auto path : tree_paths)
+        tree.insert(std::make_shared<route>(http_method::get, path));
+
+    tree_case const cases[] = {
+        // The static segment wins when it leads to a route
+        {"/users/new", "/users/new", {}},
+        // It does not, the parameter captures it
+        {"/users/new/posts", "/users/:id/posts", {"new"}},
+        {"/users/new/posts/7", "/users/:id/posts/:post", {"new", "7"}},
+        // A prefix of the static segment
+        {"/users/ne", "/users/:id", {"ne"}},
+        {"/users/newer", "/users/:id", {"newer"}},
+        {"/users/newer/posts", "/users/:id/posts", {"newer"}},
+        {"/users/42/posts?page=2", "/users/:id/posts", {"42"}},
+        // The values of the abandoned branch are dropped
+        {"/a/b/z/d", "/a/b/:y/d", {"z"}},
+        {"/a/b/z/c", "/a/:x/:w/c", {"b", "z"}},
+        // No route
+        {"/users/new/comments", {}, {}},
+        {"/users//posts", {}, {}},
+        {"/a/b/z/e", {}, {}}
+    };
+
+    for (auto const& c : cases)
+    {
+        path_values values;
+        auto const found = tree.find(http_method::get, c.target, values);
+        if (c.route.empty())
+        {
+            EXPECT_EQ(found, nullptr) << c.target;
+            continue;
+        }
+
+        ASSERT_NE(found, nullptr) << c.target;
+        EXPECT_EQ(found->path(), c.route) << c.target;
+        ASSERT_EQ(values.size, c.values.size()) << c.target;
+        for (std::size_t i = 0; i < values.size; ++i)
+            EXPECT_EQ(values.values[i], c.values[i]) << c.target;
+
+        // The route agrees on its own
+        EXPECT_TRUE(found->is_match_with_target_request(c.target, http_method::get)) << c.target;
+    }
+
+    EXPECT_EQ(tree.find(http_method::post, "/users/new"), nullptr);
+}
@@ -0,0 +1,115 @@
+#include "webcrown/server/session_registry.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+using webcrown::server::session_registry;
+
+TEST(session_registry, finds_an_inserted_value_by_its_id)
+{
+    session_registry<int> registry(3);
+    int a = 1;
+    int b = 2;
+
+    auto const id_a = registry.insert(&a);
+    auto const id_b = registry.insert(&b);
+
+    EXPECT_NE(id_a, id_b);
+    EXPECT_EQ(registry.find(id_a), &a);
+    EXPECT_EQ(registry.find(id_b), &b);
+    EXPECT_EQ(session_registry<int>::shard_of(id_a), 3u);
+    EXPECT_EQ(registry.size(), 2u);
+
+    // Never a valid id
+    EXPECT_EQ(registry.find(0), nullptr);
+}
+
+TEST(session_registry, does_not_resolve_an_erased_id)
+{
+    session_registry<int> registry(0);
+    int a = 1;
+
+    auto const id = registry.insert(&a);
+    EXPECT_TRUE(registry.erase(id));
+    EXPECT_EQ(registry.find(id), nullptr);
+    EXPECT_EQ(registry.size(), 0u);
+
+    EXPECT_FALSE(registry.erase(id));
+    EXPECT_EQ(registry.size(), 0u);
+}
+
+TEST(session_registry, gives_a_reused_slot_a_new_generation)
+{
+    session_registry<int> registry(0);
+    int closed = 1;
+    int reusing = 2;
+
+    auto const old_id = registry.insert(&closed);
+    registry.erase(old_id);
+    auto const new_id = registry.insert(&reusing);
+
+    // Same slot, another generation
+    EXPECT_EQ(new_id & 0xffffffff, old_id & 0xffffffff);
+    EXPECT_NE(new_id, old_id);
+    EXPECT_EQ(registry.find(old_id), nullptr);
+    EXPECT_FALSE(registry.erase(old_id));
+    EXPECT_EQ(registry.find(new_id), &reusing);
+}
+
+TEST(session_registry, ignores_the_ids_of_another_shard)
+{
+    session_registry<int> first(1);
+    session_registry<int> second(2);
+    int a = 1;
+    int b = 2;
+
+    auto const id_a = first.insert(&a);
+    auto const id_b = second.insert(&b);
+
+    // Same slot and generation, only the shard differs
+    EXPECT_NE(id_a, id_b);
+    EXPECT_EQ(first.find(id_b), nullptr);
+    EXPECT_FALSE(first.erase(id_b));
+    EXPECT_EQ(second.find(id_b), &b);
+}
+
+TEST(session_registry, skips_generation_zero_when_it_wraps)
+{
+    session_registry<int> registry(0);
+    int value = 1;
+
+    auto const first_id = registry.insert(&value);
+    auto id = first_id;
+    bool zero = false;
+
+    // 2^24 - 1 generations, then the first one again
+    for (std::uint32_t i = 0; i < 0xffffff; ++i)
+    {
+        registry.erase(id);
+        id = registry.insert(&value);
+        zero = zero || (id >> 40) == 0;
+    }
+
+    EXPECT_FALSE(zero);
+    EXPECT_EQ(id, first_id);
+    EXPECT_EQ(registry.find(id), &value);
+}
+
+TEST(session_registry, visits_the_registered_values)
+{
+    session_registry<int> registry(0);
+    int values[] = {0, 1, 2, 3};
+
+    std::vector<std::uint64_t> ids;
+    for (auto& value : values)
+        ids.push_back(registry.insert(&value));
+
+    registry.erase(ids[1]);
+
+    std::set<int*> visited;
+    registry.for_each([&](int& value) { visited.insert(&value); });
+    EXPECT_EQ(visited, (std::set<int*>{&values[0], &values[2], &values[3]}));
+}
@@ -0,0 +1,154 @@
+#include "webcrown/server/http/detail/simd_scan.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace webcrown::server::http::detail;
+
+namespace {
+
+using kernel = char const* (*)(char const*, char const*, scan_set const&) noexcept;
+
+/// The vector kernels the CPU runs, the scalar one is the reference
+std::vector<std::pair<char const*, kernel>> vector_kernels()
+{
+    std::vector<std::pair<char const*, kernel>> kernels;
+#if defined(WEBCROWN_SIMD_SCAN_X86)
+    if (__builtin_cpu_supports("sse4.2"))
+        kernels.emplace_back("sse4.2", scan_sse42);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.emplace_back("avx2", scan_avx2);
+#endif
+    return kernels;
+}
+
+/// Bytes that are not in the set, with the byte at stop when it is set
+std::string text_with_stop(std::size_t size, std::size_t stop, char stop_byte)
+{
+    std::string text(size, 'a');
+    for (std::size_t i = 0; i < size; ++i)
+        text[i] = static_cast<char>('A' + i % 26);
+
+    if (stop < size)
+        text[stop] = stop_byte;
+    return text;
+}
+
+}
+
+TEST(simd_scan, finds_the_stop_byte_at_every_position)
+{
+    auto const kernels = vector_kernels();
+    if (kernels.empty())
+        GTEST_SKIP() << "no vector kernel on this CPU";
+
+    // Every stop byte, at every position of a vector and its tail
+    for (auto const* set : {&header_name_stop, &header_value_stop, &target_stop})
+    {
+        for (int c = 0; c < 256; ++c)
+        {
+            if (!set->stop[static_cast<std::size_t>(c)])
+                continue;
+
+            for (std::size_t size : {15, 16, 31, 32, 33, 70})
+            {
+                for (std::size_t stop = 0; stop <= size; ++stop)
+                {
+                    auto const text = text_with_stop(size, stop, static_cast<char>(c));
+                    auto const first = text.data();
+                    auto const last = first + text.size();
+                    auto const expected = scan_scalar(first, last, *set);
+                    ASSERT_EQ(expected - first, static_cast<std::ptrdiff_t>(std::min(stop, size)));
+
+                    for (auto [name, scan_kernel] : kernels)
+                        ASSERT_EQ(scan_kernel(first, last, *set), expected) << name << " byte " << c << " at " << stop << " of " << size;
+                }
+            }
+        }
+    }
+}
+
+TEST(simd_scan, matches_the_scalar_kernel_on_random_bytes)
+{
+    auto const kernels = vector_kernels();
+    if (kernels.empty())
+        GTEST_SKIP() << "no vector kernel on this CPU";
+
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> printable(0x21, 0x7e);
+    std::uniform_int_distribution<int> any(0, 255);
+
+    for (int round = 0; round < 2000; ++round)
+    {
+        // Mostly printable, with a rare stop byte
+        std::string text(static_cast<std::size_t>(round % 97), ' ');
+        for (auto& c : text)
+            c = static_cast<char>(any(random) < 4 ? any(random) : printable(random));
+
+        for (auto const* set : {&header_name_stop, &header_value_stop, &target_stop})
+        {
+            // From every alignment of the first bytes
+            for (std::size_t offset = 0; offset < std::min<std::size_t>(text.size(), 4); ++offset)
+            {
+                auto const first = text.data() + offset;
+                auto const last = text.data() + text.size();
+                auto const expected = scan_scalar(first, last, *set);
+
+                for (auto [name, scan_kernel] : kernels)
+                    ASSERT_EQ(scan_kernel(first, last, *set), expected) << name << " round " << round;
+
+                EXPECT_EQ(scan(first, last, *set), expected);
+            }
+        }
+    }
+}
+
+TEST(pattern_searcher, finds_like_string_view)
+{
+    std::mt19937 random(11);
+    std::uniform_int_distribution<int> alphabet(0, 3);
+
+    // A small alphabet makes partial matches common
+    auto make = [&](std::size_t size)
+    {
+        std::string s(size, ' ');
+        for (auto& c : s)
+            c = "\r\n-X"[alphabet(random)];
+        return s;
+    };
+
+    for (int round = 0; round < 500; ++round)
+    {
+        auto const pattern = make(1 + static_cast<std::size_t>(round % 12));
+        pattern_searcher searcher(pattern);
+
+        for (std::size_t size : {0, 1, 31, 32, 33, 64, 100, 300})
+        {
+            auto const text = make(size);
+            ASSERT_EQ(searcher.find(text), std::string_view(text).find(pattern)) << "pattern " << round << " text " << size;
+        }
+    }
+}
+
+TEST(pattern_searcher, finds_a_delimiter_at_every_position)
+{
+    pattern_searcher searcher("\r\n--XyZ");
+
+    for (std::size_t size : {7, 31, 38, 39, 40, 70, 200})
+    {
+        for (std::size_t at = 0; at + searcher.size() <= size; ++at)
+        {
+            std::string text(size, 'x');
+            text.replace(at, searcher.size(), searcher.pattern());
+
+            ASSERT_EQ(searcher.find(text), at) << "at " << at << " of " << size;
+            EXPECT_EQ(searcher.find(std::string_view(text).substr(0, at + searcher.size() - 1)), std::string_view::npos);
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#include "webcrown/server/slab_pool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+using webcrown::server::slab_pool;
+
+namespace {
+
+/// Counts its constructions and destructions, keeps what it owns when
+/// recycled
+struct counted
+{
+    static inline int constructed = 0;
+    static inline int destroyed = 0;
+
+    int id;
+    std::vector<char> buffer;
+
+    explicit counted(int id) : id(id) { ++constructed; }
+    ~counted() { ++destroyed; }
+};
+
+struct alignas(64) aligned
+{
+    char byte{0};
+};
+
+class slab_pool_test : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        counted::constructed = 0;
+        counted::destroyed = 0;
+    }
+};
+
+}
+
+TEST_F(slab_pool_test, recycles_a_released_object_without_constructing_it)
+{
+    slab_pool<counted, 4> pool;
+
+    auto first = pool.acquire(1);
+    first->buffer.resize(4096);
+    pool.release(first);
+    EXPECT_EQ(pool.available(), 1u);
+
+    // The arguments only construct new objects
+    auto again = pool.acquire(2);
+    EXPECT_EQ(again, first);
+    EXPECT_EQ(again->id, 1);
+    EXPECT_GE(again->buffer.capacity(), 4096u);
+
+    EXPECT_EQ(counted::constructed, 1);
+    EXPECT_EQ(counted::destroyed, 0);
+    EXPECT_EQ(pool.capacity(), 1u);
+    EXPECT_EQ(pool.available(), 0u);
+}
+
+TEST_F(slab_pool_test, reuses_the_last_released_object_first)
+{
+    slab_pool<counted, 4> pool;
+
+    auto a = pool.acquire(1);
+    auto b = pool.acquire(2);
+    pool.release(a);
+    pool.release(b);
+
+    EXPECT_EQ(pool.acquire(0), b);
+    EXPECT_EQ(pool.acquire(0), a);
+    EXPECT_EQ(pool.acquire(3)->id, 3);
+}
+
+TEST_F(slab_pool_test, grows_by_slabs)
+{
+    slab_pool<counted, 4> pool;
+
+    std::vector<counted*> objects;
+    for (int i = 0; i < 10; ++i)
+        objects.push_back(pool.acquire(i));
+
+    EXPECT_EQ(pool.capacity(), 10u);
+    EXPECT_EQ(std::set<counted*>(objects.begin(), objects.end()).size(), 10u);
+
+    // Adjacent slots inside a slab
+    for (std::size_t slab = 0; slab < 3; ++slab)
+    {
+        for (std::size_t i = slab * 4 + 1; i < std::min<std::size_t>(slab * 4 + 4, objects.size()); ++i)
+            EXPECT_EQ(objects[i], objects[i - 1] + 1);
+    }
+
+    for (auto obj : objects)
+        pool.release(obj);
+
+    EXPECT_EQ(pool.available(), 10u);
+    EXPECT_EQ(counted::destroyed, 0);
+}
+
+TEST_F(slab_pool_test, destroys_every_object_once)
+{
+    {
+        slab_pool<counted, 4> pool;
+
+        // Released or still in use
+        for (int i = 0; i < 6; ++i)
+            pool.acquire(i);
+        pool.release(pool.acquire(6));
+    }
+
+    EXPECT_EQ(counted::constructed, 7);
+    EXPECT_EQ(counted::destroyed, 7);
+}
+
+TEST_F(slab_pool_test, aligns_the_objects)
+{
+    slab_pool<aligned, 3> pool;
+
+    for (int i = 0; i < 7; ++i)
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(pool.acquire()) % alignof(aligned), 0u);
+}
@@ -0,0 +1,179 @@
+#include "webcrown/server/timer_wheel.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using webcrown::server::timer_wheel;
+using namespace std::chrono_literals;
+
+namespace {
+
+/// Owner of the deadlines, records their expirations in order
+struct expirations
+{
+    std::vector<int> expired;
+    std::vector<std::uint8_t> kinds;
+
+    // Called back with the entry, its index is the position in entries
+    std::vector<timer_wheel::entry*> entries;
+
+    // Run by every callback, after the expiration is recorded
+    void (*on_expired)(expirations&, timer_wheel::entry&){nullptr};
+
+    static void on_deadline(timer_wheel::entry& e, void* owner)
+    {
+        auto self = static_cast<expirations*>(owner);
+        for (std::size_t i = 0; i < self->entries.size(); ++i)
+        {
+            if (self->entries[i] == &e)
+                self->expired.push_back(static_cast<int>(i));
+        }
+
+        self->kinds.push_back(e.kind());
+        if (self->on_expired)
+            self->on_expired(*self, e);
+    }
+};
+
+// The wheel ticks every 100ms, the margins keep the tests off the ticks
+// boundaries when the deadlines are armed a little after start
+class timer_wheel_test : public ::testing::Test
+{
+protected:
+    timer_wheel wheel_{100ms, 8};
+    expirations owner_;
+    timer_wheel::entry first_{&expirations::on_deadline, &owner_};
+    timer_wheel::entry second_{&expirations::on_deadline, &owner_};
+    timer_wheel::clock::time_point start_{timer_wheel::clock::now()};
+
+    void SetUp() override
+    {
+        owner_.entries = {&first_, &second_};
+    }
+};
+
+}
+
+TEST_F(timer_wheel_test, expires_an_entry_after_its_timeout)
+{
+    wheel_.arm(first_, 1s, 3);
+    EXPECT_TRUE(first_.armed());
+    EXPECT_EQ(wheel_.size(), 1u);
+
+    wheel_.advance(start_ + 900ms);
+    EXPECT_TRUE(owner_.expired.empty());
+
+    wheel_.advance(start_ + 1500ms);
+    ASSERT_EQ(owner_.expired, std::vector<int>{0});
+    EXPECT_EQ(owner_.kinds, std::vector<std::uint8_t>{3});
+    EXPECT_FALSE(first_.armed());
+    EXPECT_EQ(wheel_.size(), 0u);
+
+    // Expired once
+    wheel_.advance(start_ + 3s);
+    EXPECT_EQ(owner_.expired.size(), 1u);
+}
+
+TEST_F(timer_wheel_test, waits_at_least_one_tick)
+{
+    wheel_.arm(first_, 0ms);
+    wheel_.advance(start_);
+    EXPECT_TRUE(owner_.expired.empty());
+
+    wheel_.advance(start_ + 500ms);
+    EXPECT_EQ(owner_.expired, std::vector<int>{0});
+}
+
+TEST_F(timer_wheel_test, keeps_the_entries_past_a_turn_of_the_wheel)
+{
+    // 8 slots of 100ms: the entry is in the slot of the first turn too
+    wheel_.arm(first_, 2s);
+    wheel_.arm(second_, 300ms);
+
+    wheel_.advance(start_ + 1s);
+    EXPECT_EQ(owner_.expired, std::vector<int>{1});
+
+    wheel_.advance(start_ + 1900ms);
+    EXPECT_EQ(owner_.expired, std::vector<int>{1});
+
+    wheel_.advance(start_ + 2500ms);
+    EXPECT_EQ(owner_.expired, (std::vector<int>{1, 0}));
+}
+
+TEST_F(timer_wheel_test, rearms_and_cancels)
+{
+    wheel_.arm(first_, 300ms, 1);
+    wheel_.arm(first_, 1s, 2);
+    EXPECT_EQ(wheel_.size(), 1u);
+    EXPECT_EQ(first_.kind(), 2);
+
+    wheel_.arm(second_, 300ms);
+    second_.cancel();
+    EXPECT_FALSE(second_.armed());
+    EXPECT_EQ(wheel_.size(), 1u);
+
+    wheel_.advance(start_ + 900ms);
+    EXPECT_TRUE(owner_.expired.empty());
+
+    wheel_.advance(start_ + 1500ms);
+    EXPECT_EQ(owner_.expired, std::vector<int>{0});
+    EXPECT_EQ(owner_.kinds, std::vector<std::uint8_t>{2});
+}
+
+TEST_F(timer_wheel_test, unlinks_a_destroyed_entry)
+{
+    {
+        timer_wheel::entry temporary{&expirations::on_deadline, &owner_};
+        wheel_.arm(temporary, 300ms);
+        wheel_.arm(first_, 300ms);
+        EXPECT_EQ(wheel_.size(), 2u);
+    }
+
+    EXPECT_EQ(wheel_.size(), 1u);
+    wheel_.advance(start_ + 1s);
+    EXPECT_EQ(owner_.expired, std::vector<int>{0});
+}
+
+TEST_F(timer_wheel_test, lets_a_callback_cancel_an_entry_due_in_the_same_tick)
+{
+    // Like the read and write deadlines of a session that disconnects
+    owner_.on_expired = [](expirations& self, timer_wheel::entry& e)
+    {
+        for (auto other : self.entries)
+        {
+            if (other != &e)
+                other->cancel();
+        }
+    };
+
+    wheel_.arm(first_, 300ms);
+    wheel_.arm(second_, 300ms);
+
+    wheel_.advance(start_ + 1s);
+    EXPECT_EQ(owner_.expired.size(), 1u);
+    EXPECT_FALSE(first_.armed());
+    EXPECT_FALSE(second_.armed());
+    EXPECT_EQ(wheel_.size(), 0u);
+}
+
+TEST_F(timer_wheel_test, lets_a_callback_rearm_its_entry)
+{
+    static timer_wheel* wheel;
+    wheel = &wheel_;
+    owner_.on_expired = [](expirations& self, timer_wheel::entry& e)
+    {
+        if (self.expired.size() == 1)
+            wheel->arm(e, 300ms);
+    };
+
+    wheel_.arm(first_, 300ms);
+    wheel_.advance(start_ + 1s);
+    EXPECT_EQ(owner_.expired, std::vector<int>{0});
+    EXPECT_TRUE(first_.armed());
+
+    wheel_.advance(start_ + 3s);
+    EXPECT_EQ(owner_.expired, (std::vector<int>{0, 0}));
+}
@@ -0,0 +1,123 @@
+#include "webcrown/server/http/http_parser.hpp"
+#include "webcrown/server/http/middlewares/routing_middleware.hpp"
+#include "webcrown/server/http/middlewares/typed_route.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+using namespace webcrown::server::http;
+
+namespace {
+
+constexpr char user_order[] = "/users/:id/orders/:oid";
+constexpr char file[] = "/files/:name/:version";
+constexpr char page[] = "/pages/:slug";
+
+// Checked at compile time
+static_assert(route_pattern("/users/:id/orders/:oid").valid());
+static_assert(route_pattern("/users/:id/orders/:oid").parameters() == 2);
+static_assert(route_pattern("/").valid() && route_pattern("/").parameters() == 0);
+static_assert(route_pattern("/a_b/:snake_Case9").valid());
+static_assert(!route_pattern("").valid());
+static_assert(!route_pattern("users/:id").valid());
+static_assert(!route_pattern("/users/:").valid());
+static_assert(!route_pattern("/users/:/posts").valid());
+static_assert(!route_pattern("/users/x:id").valid());
+static_assert(!route_pattern("/users/:i-d").valid());
+static_assert(route_pattern("/:a/:b/:c/:d/:e/:f/:g/:h/:i/:j/:k/:l/:m/:n/:o/:p").valid());
+static_assert(!route_pattern("/:a/:b/:c/:d/:e/:f/:g/:h/:i/:j/:k/:l/:m/:n/:o/:p/:q").valid());
+
+/// Dispatches the requests to the typed routes, like the server
+class typed_route_test : public ::testing::Test
+{
+protected:
+    routing_middleware router_;
+    int handled_{0};
+    std::int64_t id_{0};
+    std::uint16_t oid_{0};
+    std::string name_;
+    std::string_view version_;
+
+    void SetUp() override
+    {
+        router_.add_router(make_route<user_order>(http_method::get,
+            [this](http_request const&, http_response& response, std::int64_t id, std::uint16_t oid)
+            {
+                ++handled_;
+                id_ = id;
+                oid_ = oid;
+                response.set_status(http_status::ok);
+            }));
+
+        router_.add_router(make_route<file>(http_method::get,
+            [this](http_request const&, http_response& response, std::string name, std::string_view version)
+            {
+                ++handled_;
+                name_ = std::move(name);
+                version_ = version;
+                response.set_status(http_status::ok);
+            }));
+
+        router_.prepare();
+    }
+
+    http_status get(std::string const& target)
+    {
+        auto const input = "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        parser p;
+        std::error_code ec;
+        auto request = p.parse(input.data(), input.size(), ec);
+        if (!request)
+            return http_status::bad_request;
+
+        route_match match;
+        if (router_.resolve(*request, match))
+            request->match(&match);
+
+        http_response response;
+        router_.execute(*request, response);
+        return response.status();
+    }
+};
+
+}
+
+TEST_F(typed_route_test, passes_the_parameters_as_arguments)
+{
+    EXPECT_EQ(get("/users/-42/orders/65535"), http_status::ok);
+    EXPECT_EQ(handled_, 1);
+    EXPECT_EQ(id_, -42);
+    EXPECT_EQ(oid_, 65535);
+
+    EXPECT_EQ(get("/files/report/v2?download=1"), http_status::ok);
+    EXPECT_EQ(handled_, 2);
+    EXPECT_EQ(name_, "report");
+}
+
+TEST_F(typed_route_test, answers_not_found_when_a_value_does_not_parse)
+{
+    // Not a number, partly a number, out of range, negative unsigned
+    for (std::string target : {"/users/abc/orders/1", "/users/12x/orders/1", "/users/1/orders/65536",
+                               "/users/1/orders/-1", "/users/99999999999999999999/orders/1"})
+    {
+        EXPECT_EQ(get(target), http_status::not_found) << target;
+    }
+
+    EXPECT_EQ(handled_, 0);
+}
+
+TEST_F(typed_route_test, declares_the_parameters_of_its_path)
+{
+    auto r = make_route<page>(http_method::post,
+        [](http_request const&, http_response&, std::string_view) {});
+
+    EXPECT_EQ(r->method(), http_method::post);
+    ASSERT_EQ(r->path_parameters().size(), 1u);
+    EXPECT_EQ(r->path_parameters()[0].name, "slug");
+    EXPECT_TRUE(r->typed_callback());
+    EXPECT_TRUE(r->is_match_with_target_request("/pages/intro", http_method::post));
+}
@@ -0,0 +1,340 @@
+#include "webcrown/server/http/http_parser.hpp"
+#include "webcrown/server/http/upload_spooler.hpp"
+
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+using namespace webcrown::server::http;
+
+namespace {
+
+std::string multipart_request(std::string const& payload)
+{
+    auto const body =
+        "--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "\r\n" + payload + "\r\n"
+        "--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"note\"\r\n"
+        "\r\n"
+        "small\r\n"
+        "--XyZ--\r\n";
+
+    return "POST /upload HTTP/1.1\r\n"
+           "Host: localhost\r\n"
+           "Content-Type: multipart/form-data; boundary=XyZ\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "\r\n" + body;
+}
+
+std::string payload(std::size_t size)
+{
+    std::string bytes;
+    for (std::size_t i = 0; i < size; ++i)
+        bytes += static_cast<char>('a' + i % 26);
+    return bytes;
+}
+
+std::string read_file(std::string_view path)
+{
+    std::ifstream file{std::string(path), std::ios::binary};
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+/// Spools to its own directory with one writer thread, which the gate can
+/// hold to keep the writes in flight. Parses like a session: the retained
+/// head and the bytes not consumed are passed again with the next ones.
+class upload_spooler_test : public ::testing::Test
+{
+protected:
+    std::string directory_;
+    spool_writer writer_{1};
+    upload_options options_;
+    parser parser_;
+    std::string pending_;
+
+    std::mutex lock_;
+    std::condition_variable changed_;
+    bool gate_open_{true};
+    int resumed_{0};
+
+    void SetUp() override
+    {
+        char name[] = "/tmp/webcrown-spool-test-XXXXXX";
+        ASSERT_NE(::mkdtemp(name), nullptr);
+        directory_ = name;
+
+        options_.memory_threshold = 16;
+        options_.write_buffer = 16;
+        options_.write_queue = 32;
+        options_.directory = directory_;
+        options_.writer = &writer_;
+
+        parser_.on_head([this](http_request const& head, std::error_code&) -> std::shared_ptr<body_reader>
+        {
+            return upload_spooler::accept(head, options_);
+        });
+
+        parser_.on_resume([this]
+        {
+            std::scoped_lock locker(lock_);
+            ++resumed_;
+            changed_.notify_all();
+        });
+    }
+
+    void TearDown() override
+    {
+        parser_.reset();
+        drain();
+        EXPECT_EQ(files(), 0u);
+        ::rmdir(directory_.c_str());
+    }
+
+    /// Holds the writer thread until open_gate
+    void close_gate()
+    {
+        {
+            std::scoped_lock locker(lock_);
+            gate_open_ = false;
+        }
+
+        writer_.post([this]
+        {
+            std::unique_lock locker(lock_);
+            changed_.wait(locker, [this] { return gate_open_; });
+        });
+    }
+
+    void open_gate()
+    {
+        std::scoped_lock locker(lock_);
+        gate_open_ = true;
+        changed_.notify_all();
+    }
+
+    /// The jobs posted before are done and destroyed
+    void drain()
+    {
+        std::mutex done_lock;
+        std::condition_variable done_changed;
+        bool done = false;
+
+        writer_.post([&]
+        {
+            std::scoped_lock locker(done_lock);
+            done = true;
+            done_changed.notify_all();
+        });
+
+        std::unique_lock locker(done_lock);
+        done_changed.wait(locker, [&] { return done; });
+    }
+
+    /// Waits for the resume of a paused parser, and resumes it
+    void resume()
+    {
+        std::unique_lock locker(lock_);
+        ASSERT_TRUE(changed_.wait_for(locker, std::chrono::seconds(5), [this] { return resumed_ > 0; }));
+        --resumed_;
+        parser_.resume();
+    }
+
+    std::optional<http_request> feed(std::string_view data, std::error_code& ec)
+    {
+        pending_.append(data);
+        auto request = parser_.parse(pending_.data(), pending_.size(), ec);
+        if (ec || request)
+            return request;
+
+        pending_ = pending_.substr(0, parser_.retained()) + pending_.substr(parser_.consumed());
+        return std::nullopt;
+    }
+
+    /// Feeds the request whole, and again once the parser is resumed
+    std::optional<http_request> parse(std::string const& input, std::error_code& ec)
+    {
+        auto request = feed(input, ec);
+        while (!ec && !request && parser_.paused())
+        {
+            resume();
+            request = feed({}, ec);
+        }
+
+        return request;
+    }
+
+    std::size_t files() const
+    {
+        std::size_t count = 0;
+        auto dir = ::opendir(directory_.c_str());
+        while (auto entry = ::readdir(dir))
+        {
+            if (entry->d_name[0] != '.')
+                ++count;
+        }
+
+        ::closedir(dir);
+        return count;
+    }
+};
+
+}
+
+TEST_F(upload_spooler_test, spools_the_large_parts)
+{
+    auto const bytes = payload(100);
+    std::error_code ec;
+    auto request = parse(multipart_request(bytes), ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    auto const& uploads = request->uploads();
+    ASSERT_EQ(uploads.size(), 2u);
+
+    EXPECT_EQ(uploads[0].name, "file");
+    EXPECT_EQ(uploads[0].filename, "a.bin");
+    EXPECT_EQ(uploads[0].content_type, "application/octet-stream");
+    ASSERT_TRUE(uploads[0].spooled());
+    EXPECT_EQ(uploads[0].size, bytes.size());
+    EXPECT_EQ(read_file(uploads[0].path), bytes);
+
+    EXPECT_EQ(uploads[1].name, "note");
+    EXPECT_FALSE(uploads[1].spooled());
+    EXPECT_TRUE(uploads[1].content_type.empty());
+    EXPECT_EQ(uploads[1].bytes, "small");
+
+    // Removed with the spooler, once the request is handled
+    EXPECT_EQ(files(), 1u);
+    parser_.reset();
+    drain();
+    EXPECT_EQ(files(), 0u);
+}
+
+TEST_F(upload_spooler_test, ends_the_body_once_the_writes_are_done)
+{
+    close_gate();
+
+    auto const input = multipart_request(payload(24));
+    std::error_code ec;
+    auto request = feed(input, ec);
+
+    // The writes are held, the complete body waits for them
+    ASSERT_FALSE(ec) << ec.message();
+    EXPECT_FALSE(request);
+    ASSERT_TRUE(parser_.paused());
+    EXPECT_FALSE(feed({}, ec));
+
+    open_gate();
+    resume();
+    request = feed({}, ec);
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_EQ(read_file(request->uploads()[0].path), payload(24));
+}
+
+TEST_F(upload_spooler_test, pauses_the_body_past_the_write_queue)
+{
+    close_gate();
+
+    auto const bytes = payload(1000);
+    auto const input = multipart_request(bytes);
+    std::error_code ec;
+    std::optional<http_request> request;
+
+    std::size_t offset = 0;
+    while (offset < input.size() && !parser_.paused())
+    {
+        request = feed(input.substr(offset, 8), ec);
+        ASSERT_FALSE(ec) << ec.message();
+        offset += 8;
+    }
+
+    // Held past write_queue bytes in flight, the next bytes are not taken
+    ASSERT_TRUE(parser_.paused());
+    EXPECT_LT(offset, input.size() / 2);
+
+    auto const held = pending_.size();
+    EXPECT_FALSE(feed(input.substr(offset, 8), ec));
+    EXPECT_EQ(pending_.size(), held + 8);
+    offset += 8;
+
+    open_gate();
+    while (!request && !ec)
+    {
+        if (parser_.paused())
+            resume();
+
+        request = feed(input.substr(std::min(offset, input.size()), 8), ec);
+        offset += 8;
+    }
+
+    ASSERT_FALSE(ec) << ec.message();
+    ASSERT_TRUE(request);
+    EXPECT_EQ(read_file(request->uploads()[0].path), bytes);
+}
+
+TEST_F(upload_spooler_test, fails_without_its_directory)
+{
+    options_.directory = directory_ + "/missing";
+
+    std::error_code ec;
+    auto request = parse(multipart_request(payload(100)), ec);
+
+    EXPECT_EQ(ec, std::errc::no_such_file_or_directory);
+    EXPECT_FALSE(request);
+}
+
+TEST_F(upload_spooler_test, fails_when_a_write_fails)
+{
+    // Writes past 32 bytes fail with EFBIG instead of raising SIGXFSZ
+    auto const previous_handler = ::signal(SIGXFSZ, SIG_IGN);
+    rlimit previous;
+    ::getrlimit(RLIMIT_FSIZE, &previous);
+    rlimit limit = previous;
+    limit.rlim_cur = 32;
+    ::setrlimit(RLIMIT_FSIZE, &limit);
+
+    std::error_code ec;
+    auto request = parse(multipart_request(payload(100)), ec);
+
+    ::setrlimit(RLIMIT_FSIZE, &previous);
+    ::signal(SIGXFSZ, previous_handler);
+
+    EXPECT_EQ(ec, std::errc::file_too_large);
+    EXPECT_FALSE(request);
+}
+
+TEST_F(upload_spooler_test, is_released_without_waiting_for_the_writes)
+{
+    close_gate();
+
+    std::error_code ec;
+    EXPECT_FALSE(feed(multipart_request(payload(100)), ec));
+    ASSERT_TRUE(parser_.paused());
+
+    // The request is abandoned, its writes hold the spooler and its file
+    parser_.reset();
+    EXPECT_EQ(files(), 1u);
+
+    open_gate();
+    drain();
+    EXPECT_EQ(files(), 0u);
+}
@@ -0,0 +1,319 @@
+#include "webcrown/server/http/middlewares/routing_middleware.hpp"
+#include "webcrown/server/http/upload_spooler.hpp"
+#include "webcrown/server/webserver.hpp"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <thread>
+
+using namespace webcrown::server;
+
+namespace {
+
+struct head_value : http::context_key<std::pmr::string, 0> {};
+
+/// Stores a value allocated from the arena of the request when its head is
+/// parsed, the response of the complete request echoes it. The requests
+/// without a body allocate from their arena too.
+class arena_middleware : public http::middleware
+{
+public:
+    static constexpr std::string_view value = "kept from the head of the request to its response";
+
+    std::shared_ptr<http::body_reader> accept_body(http::http_request const& request) override
+    {
+        request.context()->emplace<head_value>(value, request.arena());
+        return nullptr;
+    }
+
+    bool execute(http::http_request const& request, http::http_response& response) override
+    {
+        if (auto kept = request.context()->get<head_value>())
+            response.set_body(std::string(*kept));
+        else
+            response.set_body(std::string(std::pmr::string(256, 'x', request.arena())));
+
+        response.set_status(http::http_status::ok);
+        return false;
+    }
+};
+
+/// Answers /large with a body that fills the socket buffers of a client
+/// that does not read it
+class large_middleware : public http::middleware
+{
+public:
+    static constexpr std::size_t large_size = 32 * 1024 * 1024;
+
+    bool execute(http::http_request const& request, http::http_response& response) override
+    {
+        response.set_body(std::string(request.target() == "/large" ? large_size : 16, 'x'));
+        response.set_status(http::http_status::ok);
+        return false;
+    }
+};
+
+/// A free port of the loopback interface
+std::uint16_t free_port()
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+
+    socklen_t size = sizeof(address);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size);
+    ::close(fd);
+    return ntohs(address.sin_port);
+}
+
+/// Blocking client, the reads time out after a second
+class client
+{
+    int fd_{-1};
+public:
+    explicit client(std::uint16_t port)
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        // The server listens once its I/O thread runs
+        for (int attempt = 0; attempt < 100; ++attempt)
+        {
+            fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+                break;
+
+            ::close(fd_);
+            fd_ = -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        timeval timeout{1, 0};
+        ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    ~client() { if (fd_ >= 0) ::close(fd_); }
+
+    bool connected() const noexcept { return fd_ >= 0; }
+
+    /// Whether the bytes were all sent
+    bool send(std::string_view data)
+    {
+        return ::send(fd_, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+    }
+
+    /// No more requests, the server sees the end of the input
+    void shutdown() { ::shutdown(fd_, SHUT_WR); }
+
+    /// Reads until the server closes the connection: false when it was reset
+    bool closed_gracefully()
+    {
+        char buffer[4096];
+        for (;;)
+        {
+            auto const n = ::recv(fd_, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+                return n == 0;
+        }
+    }
+
+    /// Reads until the received bytes contain text, or a timeout
+    std::string receive_until(std::string_view text)
+    {
+        std::string received;
+        char buffer[4096];
+        while (received.find(text) == std::string::npos)
+        {
+            auto const n = ::recv(fd_, buffer, sizeof(buffer), 0);
+            if (n <= 0)
+                break;
+
+            received.append(buffer, static_cast<std::size_t>(n));
+        }
+
+        return received;
+    }
+};
+
+class webserver_test : public ::testing::Test
+{
+protected:
+    std::uint16_t port_{free_port()};
+    server_options options_;
+    std::shared_ptr<WebServer> server_;
+
+    void start(std::shared_ptr<http::middleware> middleware)
+    {
+        server_ = std::make_shared<WebServer>("127.0.0.1", port_, [](asio::error_code) {}, options_);
+        server_->add_middleware(std::move(middleware));
+        server_->start();
+    }
+
+    void TearDown() override
+    {
+        if (server_)
+            server_->stop();
+    }
+};
+
+}
+
+TEST_F(webserver_test, keeps_the_state_of_a_head_across_reads)
+{
+    start(std::make_shared<arena_middleware>());
+
+    client slow(port_);
+    client fast(port_);
+    ASSERT_TRUE(slow.connected());
+    ASSERT_TRUE(fast.connected());
+
+    // The head is handled, the body comes with a later read
+    slow.send("POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n\r\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Meanwhile the worker handles the requests of another session
+    for (int i = 0; i < 16; ++i)
+    {
+        fast.send("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        EXPECT_NE(fast.receive_until(std::string(256, 'x')).find("200 OK"), std::string::npos);
+    }
+
+    slow.send("body");
+    auto const response = slow.receive_until(arena_middleware::value);
+    EXPECT_NE(response.find("200 OK"), std::string::npos) << response;
+    EXPECT_NE(response.find(arena_middleware::value), std::string::npos) << response;
+}
+
+TEST_F(webserver_test, reads_an_upload_at_the_pace_of_its_writes)
+{
+    // Past 4KB in flight the session stops reading until the writes catch up
+    http::spool_writer writer{1};
+    http::upload_options options;
+    options.memory_threshold = 1024;
+    options.write_buffer = 1024;
+    options.write_queue = 4096;
+    options.writer = &writer;
+
+    auto upload = std::make_shared<http::route>(http::http_method::post, "/upload",
+        [](http::http_request const& request, http::http_response& response, http::path_parameters_type const&, http::http_context const&)
+        {
+            auto const& file = request.uploads().at(0);
+            std::ifstream spooled{std::string(file.path), std::ios::binary};
+            response.set_body(std::string(std::istreambuf_iterator<char>(spooled), std::istreambuf_iterator<char>()));
+            response.set_status(http::http_status::ok);
+        });
+    upload->stream_body(http::spool_uploads(options));
+
+    auto router = std::make_shared<http::routing_middleware>();
+    router->add_router(upload);
+    start(router);
+
+    std::string payload;
+    for (std::size_t i = 0; i < 256 * 1024; ++i)
+        payload += static_cast<char>('a' + i % 26);
+
+    auto const body = "--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"\r\n"
+        "\r\n" + payload + "\r\n"
+        "--XyZ--\r\n";
+
+    client c(port_);
+    ASSERT_TRUE(c.connected());
+    c.send("POST /upload HTTP/1.1\r\n"
+           "Host: localhost\r\n"
+           "Content-Type: multipart/form-data; boundary=XyZ\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "\r\n");
+
+    for (std::size_t offset = 0; offset < body.size(); offset += 16 * 1024)
+        c.send(std::string_view(body).substr(offset, 16 * 1024));
+
+    // A pipelined request waits for the upload
+    c.send("GET /missing HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+    auto const response = c.receive_until("404 Not Found");
+    EXPECT_EQ(response.find("HTTP/1.1 200 OK"), 0u) << response.substr(0, 200);
+    auto const echoed = response.find(payload);
+    ASSERT_NE(echoed, std::string::npos) << response.substr(0, 200);
+    EXPECT_NE(response.find("404 Not Found", echoed), std::string::npos);
+}
+
+TEST_F(webserver_test, drains_a_rejected_request_before_closing)
+{
+    options_.max_header_bytes = 1024;
+    start(std::make_shared<arena_middleware>());
+
+    client c(port_);
+    ASSERT_TRUE(c.connected());
+
+    // The head crosses the limit in the first read, the rest keeps coming
+    ASSERT_TRUE(c.send("GET / HTTP/1.1\r\nHost: localhost\r\nX-Large: " + std::string(4096, 'a')));
+    auto const response = c.receive_until("\r\n\r\n");
+    EXPECT_EQ(response.find("HTTP/1.1 431 Request Header Fields Too Large"), 0u) << response;
+
+    // Read and dropped by the server, the connection is not reset
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(c.send(std::string(16 * 1024, 'b')));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    c.shutdown();
+    EXPECT_TRUE(c.closed_gracefully());
+}
+
+TEST_F(webserver_test, closes_a_lingering_connection_at_its_deadline)
+{
+    options_.max_header_bytes = 1024;
+    options_.linger_timeout = std::chrono::seconds(1);
+    start(std::make_shared<arena_middleware>());
+
+    client c(port_);
+    ASSERT_TRUE(c.connected());
+
+    ASSERT_TRUE(c.send("GET / HTTP/1.1\r\nHost: localhost\r\nX-Large: " + std::string(4096, 'a')));
+    auto const response = c.receive_until("\r\n\r\n");
+    EXPECT_EQ(response.find("HTTP/1.1 431 Request Header Fields Too Large"), 0u) << response;
+
+    // The client neither finishes the request nor closes
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    EXPECT_TRUE(c.closed_gracefully());
+}
+
+TEST_F(webserver_test, refuses_a_body_at_its_head_when_overloaded)
+{
+    options_.memory_budget = 1024 * 1024;
+    start(std::make_shared<large_middleware>());
+
+    // Its response stays queued, over the budget
+    client reader(port_);
+    ASSERT_TRUE(reader.connected());
+    ASSERT_TRUE(reader.send("GET /large HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Answered before the body is sent
+    client uploader(port_);
+    ASSERT_TRUE(uploader.connected());
+    ASSERT_TRUE(uploader.send("POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: 1000\r\n\r\n"));
+
+    auto const response = uploader.receive_until("\r\n\r\n");
+    EXPECT_EQ(response.find("HTTP/1.1 503 Service Unavailable"), 0u) << response;
+}